@@ -0,0 +1,239 @@
+// This tool picks bits_per_key, slots per bucket and target load factor for a seeded
+// cuckoo_hashtable build, the pipeline example.cc runs: insert R, then repeat lookup
+// rounds over S and rehash the buckets that gave false positives until none are left.
+// It is invoked as:
+//
+//     ./autotune.exe [r_count] [s_count] [budget_seconds] [sample_fraction]
+//
+// R holds r_count keys (default 1M) and S s_count keys (default 100x r_count, as in
+// example.cc). Only sample_fraction (default 1%) of each is generated and built, once
+// for every candidate configuration in CANDIDATES and every load in LOADS. From each
+// sample build it extrapolates to the full sets:
+//
+//   tags    bucket count x slots x bits_per_key, for R at that load
+//   seeds   bucket count x the order-0 entropy of the sample's seeds, which is what an
+//           entropy coder shipping the seed array approaches
+//   build   the sample's insert and lookup/rehash time divided by sample_fraction
+//
+// and it prints every configuration, then the one with the fewest total bytes whose
+// build fits in budget_seconds (default 60) among those a CuckooFilter can be exported
+// from. Export (CopyInsert) needs kSeededSlotsPerBucket (4) slots per bucket, so the
+// 2- and 8-slot rows are marked with a * after their slot count: they only size a
+// cuckoo_hashtable kept as is, and when one of them would have been cheaper it is
+// reported on a line of its own. A configuration fails if R does not fit at that load
+// ("full"), or if S still has false positives after MAX_ROUNDS rounds. The last column
+// is the expected false positive rate on keys in neither set,
+// 2 x slots x load / 2^bits_per_key, which seeding does not improve, for callers who
+// also bound it.
+//
+// The estimates assume the sample behaves like the full sets: the number of S keys per
+// bucket is kept, so false positives per round carry over, but the slowest bucket, and
+// with it the round count, grows slowly with the table, so builds run a little longer
+// than estimated.
+//
+// Example output:
+//
+// $ ./autotune.exe 1000000 100000000 60 0.01
+//  bits slots  load  rounds  rehashed%  seed bits    tag MB   seed MB   total MB    build s  other fp%
+//     8    4   0.80     >64          -          -         -         -          -          -     2.5000
+//   ...
+//    12    4   0.90      13      49.64       2.00      1.67      0.07       1.74      25.67     0.1758
+//    12    4   0.95      18      53.38       2.13      1.58      0.07       1.65      36.16     0.1855
+//   ...
+//    10    2*  0.85    full          -          -         -         -          -          -     0.3320
+//   ...
+//    14    8*  0.90      10      50.68       1.98      1.94      0.03       1.98      27.76     0.0879
+//   ...
+// cheapest within 60.00 s: bits_per_key 12, 4 slots, load 0.95 (1.65 MB, 36.16 s)
+
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include "cuckoofilter.h"
+#include "cuckoohashtable.hh"
+#include "random.h"
+#include "timing.h"
+
+using namespace std;
+
+using namespace cuckoofilter;
+
+// Lookup rounds after which a build that still has false positives is given up
+const size_t MAX_ROUNDS = 64;
+
+// The target load factors tried for every candidate
+const double LOADS[] = {0.80, 0.85, 0.90, 0.95};
+
+// The outcome of one sample build, extrapolated to the full sets
+struct Estimate {
+  size_t bits_per_key;
+  size_t slots;
+  double load;
+  bool full;   // R did not fit
+  bool built;  // R fit and S was certified within MAX_ROUNDS
+  size_t rounds;
+  double rehashed_percent;
+  double seed_bits;  // per bucket, after entropy coding
+  double tag_bytes;
+  double seed_bytes;
+  double build_seconds;
+  double other_fp_percent;
+
+  double total_bytes() const { return tag_bytes + seed_bytes; }
+
+  // whether a seeded CuckooFilter can be copied out of the table
+  bool exportable() const { return slots == kSeededSlotsPerBucket; }
+};
+
+// The order-0 entropy of seeds, in bits per seed
+double Entropy(const vector<uint16_t>& seeds) {
+  map<uint16_t, size_t> counts;
+  for (const uint16_t s : seeds) counts[s]++;
+  double result = 0;
+  for (const auto& c : counts) {
+    const double p = static_cast<double>(c.second) / seeds.size();
+    result -= p * log2(p);
+  }
+  return result;
+}
+
+template <size_t bits_per_key, size_t slots>
+Estimate Build(double load, double fraction, size_t r_count, const vector<uint64_t>& r,
+               const vector<uint64_t>& s) {
+  using Table = cuckoohashtable::cuckoo_hashtable<uint64_t, bits_per_key,
+                                                  WyHasher<uint64_t>, equal_to<uint64_t>,
+                                                  allocator<uint64_t>, slots>;
+  Estimate result = {bits_per_key, slots, load, false, false, 0, 0, 0, 0, 0, 0,
+                     100.0 * 2 * slots * load / (1ull << bits_per_key)};
+  Table table(r.size() / load, cuckoohashtable::sizing_mode::exact);
+  const auto start_time = NowNanos();
+  try {
+    for (const auto k : r) table.insert(k);
+  } catch (const out_of_range&) {
+    result.full = true;
+    return result;
+  }
+  for (;;) {
+    table.start_lookup();
+    size_t false_positives = 0;
+    for (const auto q : s) false_positives += (table.lookup(q) >= 0);
+    ++result.rounds;
+    if (false_positives == 0) break;
+    if (result.rounds == MAX_ROUNDS) return result;
+    table.rehash_buckets();
+  }
+  const auto time = NowNanos() - start_time;
+
+  const vector<uint16_t> seeds = table.get_seeds();
+  size_t rehashed = 0;
+  for (const uint16_t seed : seeds) rehashed += (seed != 0);
+
+  // the bucket count an exactly sized table for all of R would have
+  const double buckets = ceil(r_count / load / slots);
+  result.built = true;
+  result.rehashed_percent = 100.0 * rehashed / seeds.size();
+  result.seed_bits = Entropy(seeds);
+  result.tag_bytes = buckets * slots * bits_per_key / CHAR_BIT;
+  result.seed_bytes = buckets * result.seed_bits / CHAR_BIT;
+  result.build_seconds = time / 1e9 / fraction;
+  return result;
+}
+
+using BuildFn = Estimate (*)(double, double, size_t, const vector<uint64_t>&,
+                             const vector<uint64_t>&);
+
+// The (bits_per_key, slots) pairs tried
+const BuildFn CANDIDATES[] = {
+    Build<8, 4>,  Build<10, 4>, Build<12, 4>, Build<14, 4>, Build<16, 4>,
+    Build<10, 2>, Build<12, 2>, Build<10, 8>, Build<12, 8>, Build<14, 8>,
+};
+
+void Print(const Estimate& e) {
+  cout << setw(5) << e.bits_per_key << setw(5) << e.slots << (e.exportable() ? " " : "*")
+       << fixed << setprecision(2) << setw(6) << e.load;
+  if (e.built) {
+    cout << setw(8) << e.rounds << setw(11) << e.rehashed_percent << setw(11)
+         << e.seed_bits << setw(10) << e.tag_bytes / 1e6 << setw(10)
+         << e.seed_bytes / 1e6 << setw(11) << e.total_bytes() / 1e6 << setw(11)
+         << e.build_seconds;
+  } else {
+    cout << setw(8) << (e.full ? "full" : ">" + to_string(MAX_ROUNDS)) << setw(11) << "-"
+         << setw(11) << "-" << setw(10) << "-" << setw(10) << "-" << setw(11) << "-"
+         << setw(11) << "-";
+  }
+  cout << setw(11) << setprecision(4) << e.other_fp_percent << endl;
+}
+
+void PrintChoice(const Estimate& e) {
+  cout << "bits_per_key " << e.bits_per_key << ", " << e.slots << " slots, load "
+       << e.load << " (" << e.total_bytes() / 1e6 << " MB, " << e.build_seconds << " s)"
+       << endl;
+}
+
+int main(int argc, char* argv[]) {
+  size_t r_count = 1000 * 1000;
+  size_t s_count = 0;
+  double budget_seconds = 60;
+  double fraction = 0.01;
+  if (argc > 5) {
+    cerr << "Usage: " << argv[0]
+         << " [r_count] [s_count] [budget_seconds] [sample_fraction]" << endl;
+    return 1;
+  }
+  for (int i = 1; i < argc; ++i) {
+    stringstream input_string(argv[i]);
+    if (i == 1) input_string >> r_count;
+    if (i == 2) input_string >> s_count;
+    if (i == 3) input_string >> budget_seconds;
+    if (i == 4) input_string >> fraction;
+    if (input_string.fail() || fraction <= 0 || fraction > 1) {
+      cerr << "Invalid number: " << argv[i];
+      return 2;
+    }
+  }
+  if (argc <= 2) s_count = 100 * r_count;
+
+  // Random keys, so a sample of R and S is drawn like the sets themselves:
+  const vector<uint64_t> r = GenerateRandom64(max<size_t>(1, r_count * fraction));
+  const vector<uint64_t> s = GenerateRandom64(s_count * fraction);
+
+  cout << setw(5) << right << "bits" << setw(6) << "slots" << setw(6) << "load"
+       << setw(8) << "rounds" << setw(11) << "rehashed%" << setw(11) << "seed bits"
+       << setw(10) << "tag MB" << setw(10) << "seed MB" << setw(11) << "total MB"
+       << setw(11) << "build s" << setw(11) << "other fp%" << endl;
+  vector<Estimate> estimates;
+  for (const BuildFn build : CANDIDATES) {
+    for (const double load : LOADS) {
+      estimates.push_back(build(load, fraction, r_count, r, s));
+      Print(estimates.back());
+    }
+  }
+
+  // The cheapest exportable configuration, and the cheapest of all
+  const Estimate* best = nullptr;
+  const Estimate* best_any = nullptr;
+  for (const auto& e : estimates) {
+    if (!e.built || e.build_seconds > budget_seconds) continue;
+    if (best_any == nullptr || e.total_bytes() < best_any->total_bytes()) best_any = &e;
+    if (e.exportable() && (best == nullptr || e.total_bytes() < best->total_bytes())) {
+      best = &e;
+    }
+  }
+  cout << endl << setprecision(2);
+  if (best == nullptr) {
+    cout << "no exportable configuration builds within " << budget_seconds << " s"
+         << endl;
+    return 3;
+  }
+  cout << "cheapest within " << budget_seconds << " s: ";
+  PrintChoice(*best);
+  if (best_any != best) {
+    cout << "cheaper, but not exportable to a CuckooFilter: ";
+    PrintChoice(*best_any);
+  }
+}
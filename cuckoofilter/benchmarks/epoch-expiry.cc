@@ -0,0 +1,104 @@
+// This benchmark checks that items added to a CuckooFilter over an EpochTable expire
+// once their epoch leaves the window, including after the 4-bit stored epoch has
+// wrapped around several times. It is invoked as:
+//
+//     ./epoch-expiry.exe [keys_per_epoch] [window] [epochs]
+//
+// The filter is sized for window (default 4) epochs of keys_per_epoch (default 100K)
+// keys each at a 95% load factor. For each of epochs (default 40) epochs, it is moved
+// to the epoch with SetEpoch and the epoch's keys are added; cuckoo kicks then move
+// older tags around, which must not refresh their epochs. After each epoch:
+//
+//   added     keys of the epoch whose Add succeeded
+//   missed    keys added in the epochs of the window that are not found
+//   expired   keys of the 16 epochs before the window that are found: false
+//             positives only, had the wrapped epochs let their tags match again
+//   size      Size(), which must count the live items and no expired ones
+//
+// Any failed Add, missed key or miscounted size fails the run.
+//
+// Example output:
+//
+// $ ./epoch-expiry.exe
+//   epoch   added  missed  expired     size
+//       7  100000       0   0.184%   400000
+//      15  100000       0   0.186%   400000
+//      23  100000       0   0.183%   400000
+//      31  100000       0   0.184%   400000
+//      39  100000       0   0.189%   400000
+
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "cuckoofilter.h"
+#include "random.h"
+
+using namespace std;
+
+using namespace cuckoofilter;
+
+using Filter = CuckooFilter<uint64_t, 12, WyHasher<uint64_t>, EpochTable>;
+
+// the number of keys the filter contains
+size_t Found(const Filter& filter, const vector<uint64_t>& keys) {
+  size_t found = 0;
+  for (const uint64_t key : keys) found += filter.Contain(key) == Ok;
+  return found;
+}
+
+int main(int argc, char* argv[]) {
+  size_t keys_per_epoch = 100 * 1000;
+  size_t window = 4;
+  size_t epochs = 40;
+  if (argc > 4) {
+    cerr << "Usage: " << argv[0] << " [keys_per_epoch] [window] [epochs]" << endl;
+    return 1;
+  }
+  for (int i = 1; i < argc; ++i) {
+    stringstream input_string(argv[i]);
+    if (i == 1) input_string >> keys_per_epoch;
+    if (i == 2) input_string >> window;
+    if (i == 3) input_string >> epochs;
+    if (input_string.fail() || window == 0 || window > EpochTable<12>::kNumEpochs) {
+      cerr << "Invalid number: " << argv[i];
+      return 2;
+    }
+  }
+
+  Filter filter(keys_per_epoch * window / 0.95, Exact);
+  vector<vector<uint64_t>> keys;
+  bool wrong = false;
+  cout << setw(7) << "epoch" << setw(8) << "added" << setw(8) << "missed" << setw(9)
+       << "expired" << setw(9) << "size" << endl;
+  for (size_t epoch = 0; epoch < epochs; ++epoch) {
+    filter.SetEpoch(epoch, window);
+    keys.push_back(GenerateRandom64(keys_per_epoch));
+    size_t added = 0;
+    for (const uint64_t key : keys.back()) added += filter.Add(key) == Ok;
+
+    vector<uint64_t> live, expired;
+    for (size_t e = 0; e <= epoch; ++e) {
+      auto& to = epoch - e < window ? live : expired;
+      if (epoch - e < window + EpochTable<12>::kNumEpochs) {
+        to.insert(to.end(), keys[e].begin(), keys[e].end());
+      }
+    }
+    const size_t missed = live.size() - Found(filter, live);
+    const double expired_rate =
+        expired.empty() ? 0 : static_cast<double>(Found(filter, expired)) / expired.size();
+    if (epoch % 8 == 7 || epoch + 1 == epochs) {
+      cout << setw(7) << epoch << setw(8) << added << setw(8) << missed << setw(8) << fixed
+           << setprecision(3) << expired_rate * 100 << "%" << setw(9) << filter.Size() << endl;
+    }
+    // a 12-bit tag matches a random key in 8 slots about 0.2% of the time
+    wrong |= added < keys.back().size() || missed > 0 || expired_rate > 0.01 ||
+             filter.Size() != live.size();
+  }
+  if (wrong) {
+    cerr << "Keys were not added, live keys were lost, or expired ones were still found or counted"
+         << endl;
+    return 4;
+  }
+}
@@ -0,0 +1,180 @@
+// This benchmark compares the seeded 64-bit hashes that can back the per-bucket seed
+// rehash scheme: CityHash64WithSeed (CityHasher, used by example.cc) and
+// HashUtil::WyHash (WyHasher). MurmurHash2 is included in the throughput table as a
+// 32-bit reference point. It is invoked as:
+//
+//     ./hash-throughput.exe 1000000
+//
+// The first table reports throughput for 8, 16 and 32-byte keys. The second reports,
+// for each of the first few seeds, the avalanche bias of 8-byte keys: the largest
+// deviation from 1/2 of the probability that flipping one input bit flips one output
+// bit, over all 64x64 (input bit, output bit) pairs. The last column is the same bias
+// between seed s and seed s + 1 for the same key; the rehash scheme relies on it being
+// small, since a bucket whose fingerprints collide under seed s is only fixed if seed
+// s + 1 gives it fresh fingerprints.
+//
+// Example output:
+//
+// $ ./hash-throughput.exe 1000000
+//                   ns/hash   ns/hash   ns/hash      GB/s
+//                    8 byte   16 byte   32 byte   32 byte
+//     CityHash64      8.28     11.07     12.06      2.65
+//         WyHash      5.56      6.25      8.63      3.71
+//    MurmurHash2      9.38     12.92     20.94      1.53
+//
+//                 seed    max bias   mean bias  vs seed+1
+//     CityHash64     0      0.0133      0.0028     0.0107
+//     CityHash64     1      0.0125      0.0028     0.0075
+//     ...
+//         WyHash     0      0.0138      0.0028     0.0097
+//         WyHash     1      0.0133      0.0028     0.0123
+//     ...
+//
+// With 20000 samples per entry, a bias around 0.013 is what an ideal hash shows over
+// 4096 pairs, so both hashes avalanche fully for every seed.
+
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "city_hasher.hh"
+#include "hashutil.h"
+#include "random.h"
+#include "timing.h"
+
+using namespace std;
+
+using namespace cuckoofilter;
+
+// The number of keys used to measure each avalanche matrix
+const size_t AVALANCHE_SAMPLE_SIZE = 20 * 1000;
+
+// The seeds whose avalanche behaviour is reported. The rehash scheme tries seeds in
+// increasing order from 0, so the small ones are the ones that matter.
+const uint64_t NUM_SEEDS = 8;
+
+struct CityFunction {
+  static const char* Name() { return "CityHash64"; }
+  uint64_t operator()(const void* buf, size_t length, uint64_t seed) const {
+    return CityHash64WithSeed(static_cast<const char*>(buf), length, seed);
+  }
+};
+
+struct WyFunction {
+  static const char* Name() { return "WyHash"; }
+  uint64_t operator()(const void* buf, size_t length, uint64_t seed) const {
+    return HashUtil::WyHash(buf, length, seed);
+  }
+};
+
+struct MurmurFunction {
+  static const char* Name() { return "MurmurHash2"; }
+  uint64_t operator()(const void* buf, size_t length, uint64_t seed) const {
+    return HashUtil::MurmurHash(buf, length, seed);
+  }
+};
+
+// Hashes count keys of key_bytes bytes each, stored back to back in keys, and returns
+// the time taken per hash in nanoseconds. The key length is a template parameter so
+// each hash is compiled the way a fixed-size key type would use it.
+template <typename Hash, size_t key_bytes>
+double NanosPerHash(const vector<uint64_t>& keys, size_t count) {
+  const Hash hash;
+  const char* const data = reinterpret_cast<const char*>(keys.data());
+  uint64_t sink = 0;
+  const auto start_time = NowNanos();
+  for (size_t i = 0; i < count; ++i) {
+    sink += hash(data + i * key_bytes, key_bytes, i & (NUM_SEEDS - 1));
+  }
+  const auto time = NowNanos() - start_time;
+  // Keep the hashes from being optimized away:
+  if (sink == 42) cerr << "";
+  return static_cast<double>(time) / count;
+}
+
+template <typename Hash>
+void PrintThroughput(const vector<uint64_t>& keys, size_t count) {
+  const double ns8 = NanosPerHash<Hash, 8>(keys, count);
+  const double ns16 = NanosPerHash<Hash, 16>(keys, count);
+  const double ns32 = NanosPerHash<Hash, 32>(keys, count);
+  cout << setw(15) << right << Hash::Name() << fixed << setprecision(2) << setw(10)
+       << ns8 << setw(10) << ns16 << setw(10) << ns32 << setw(10) << 32 / ns32 << endl;
+}
+
+// The avalanche bias of one seed, and between that seed and the next
+struct Avalanche {
+  double max_bias;
+  double mean_bias;
+  double next_seed_bias;
+};
+
+template <typename Hash>
+Avalanche MeasureAvalanche(const vector<uint64_t>& keys, uint64_t seed) {
+  const Hash hash;
+  // flips[i][j] counts the keys for which flipping input bit i flipped output bit j
+  vector<vector<size_t>> flips(64, vector<size_t>(64, 0));
+  vector<size_t> seed_flips(64, 0);
+  for (size_t k = 0; k < AVALANCHE_SAMPLE_SIZE; ++k) {
+    const uint64_t key = keys[k];
+    const uint64_t h = hash(&key, sizeof(key), seed);
+    for (int i = 0; i < 64; ++i) {
+      const uint64_t flipped = key ^ (1ull << i);
+      const uint64_t diff = h ^ hash(&flipped, sizeof(flipped), seed);
+      for (int j = 0; j < 64; ++j) flips[i][j] += (diff >> j) & 1;
+    }
+    const uint64_t diff = h ^ hash(&key, sizeof(key), seed + 1);
+    for (int j = 0; j < 64; ++j) seed_flips[j] += (diff >> j) & 1;
+  }
+  auto bias = [](size_t count) {
+    return fabs(static_cast<double>(count) / AVALANCHE_SAMPLE_SIZE - 0.5);
+  };
+  Avalanche result = {0, 0, 0};
+  for (int i = 0; i < 64; ++i) {
+    for (int j = 0; j < 64; ++j) {
+      result.max_bias = max(result.max_bias, bias(flips[i][j]));
+      result.mean_bias += bias(flips[i][j]) / (64 * 64);
+    }
+  }
+  for (int j = 0; j < 64; ++j) {
+    result.next_seed_bias = max(result.next_seed_bias, bias(seed_flips[j]));
+  }
+  return result;
+}
+
+template <typename Hash>
+void PrintAvalanche(const vector<uint64_t>& keys) {
+  for (uint64_t seed = 0; seed < NUM_SEEDS; ++seed) {
+    const Avalanche a = MeasureAvalanche<Hash>(keys, seed);
+    cout << setw(15) << right << Hash::Name() << setw(6) << seed << fixed
+         << setprecision(4) << setw(12) << a.max_bias << setw(12) << a.mean_bias
+         << setw(11) << a.next_seed_bias << endl;
+  }
+}
+
+int main(int argc, char* argv[]) {
+  if (argc != 2) {
+    cerr << "Usage: " << argv[0] << " <numberOfKeys>" << endl;
+    return 1;
+  }
+  const size_t count = max<size_t>(stoull(argv[1]), AVALANCHE_SAMPLE_SIZE);
+  // Room for count 32-byte keys:
+  const vector<uint64_t> keys = GenerateRandom64(4 * count);
+
+  cout << setw(15) << "" << setw(10) << "ns/hash" << setw(10) << "ns/hash" << setw(10)
+       << "ns/hash" << setw(10) << "GB/s" << endl;
+  cout << setw(15) << "" << setw(10) << "8 byte" << setw(10) << "16 byte" << setw(10)
+       << "32 byte" << setw(10) << "32 byte" << endl;
+  PrintThroughput<CityFunction>(keys, count);
+  PrintThroughput<WyFunction>(keys, count);
+  PrintThroughput<MurmurFunction>(keys, count);
+
+  cout << endl
+       << setw(15) << "" << setw(6) << "seed" << setw(12) << "max bias" << setw(12)
+       << "mean bias" << setw(11) << "vs seed+1" << endl;
+  PrintAvalanche<CityFunction>(keys);
+  PrintAvalanche<WyFunction>(keys);
+}
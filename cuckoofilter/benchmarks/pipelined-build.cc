@@ -0,0 +1,170 @@
+// This benchmark compares building a cuckoo_hashtable in phases, as example.cc does, with
+// the overlapped pipeline of pipelined_builder. It is invoked as:
+//
+//     ./pipelined-build.exe [add_count] [readers] [hash_workers]
+//
+// add_count (default 8M) random keys are written out as decimal text, one key per line,
+// split into one stream per reader (default 2). The phased build parses every stream
+// into a vector, then inserts the keys with the insert loop of the pipeline's owner
+// (prehash a batch, prefetch a few keys ahead), so that the two differ only in the
+// overlapping of the stages. The pipelined build has a reader thread parse each stream
+// while hash_workers (default 2) threads hash the parsed keys and the main thread
+// inserts the hashed ones, all at once. Both tables are sized for
+// the keys at a 95% load factor and must find every key afterwards.
+//
+// The owner's wait is the time the inserting thread found no hashed keys ready. When
+// it stays small, insertion is the bottleneck and parsing and hashing are hidden
+// behind it.
+//
+// Example output:
+//
+// $ ./pipelined-build.exe 8000000 2 2
+// phased:    parse   273 ms, insert  1022 ms, total  1295 ms
+// pipelined: total  1380 ms, owner waited    9 ms
+//
+// (That machine had a single core, so the stages took turns rather than overlapped,
+// and the pipeline paid for its threads and rings without hiding anything. With a
+// core per stage, its total can drop toward the phased insert time alone.)
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "cuckoohashtable.hh"
+#include "hashutil.h"
+#include "pipelinedbuilder.hh"
+#include "random.h"
+#include "timing.h"
+
+using namespace std;
+
+using namespace cuckoofilter;
+
+using Table = cuckoohashtable::cuckoo_hashtable<uint64_t, 12, WyHasher<uint64_t>>;
+
+// Parses up to max keys, one decimal number per line, from *text, which moves past them
+size_t ParseKeys(const char** text, const char* end, uint64_t* keys, size_t max) {
+  const char* p = *text;
+  size_t count = 0;
+  while (count < max && p < end) {
+    uint64_t key = 0;
+    while (*p != '\n') key = key * 10 + (*p++ - '0');
+    ++p;
+    keys[count++] = key;
+  }
+  *text = p;
+  return count;
+}
+
+// Parses every stream into a vector, then inserts the keys a batch at a time with the
+// owner's loop of pipelined_builder: prehash() the batch, then insert each key while
+// prefetching the buckets of the one kPipelinePrefetchKeys ahead. Returns the number
+// parsed.
+size_t BuildPhased(const vector<string>& streams, size_t max_keys, Table* table,
+                   uint64_t* parse_time, uint64_t* insert_time) {
+  auto start_time = NowNanos();
+  vector<uint64_t> parsed(max_keys);
+  size_t count = 0;
+  for (const string& stream : streams) {
+    const char* p = stream.data();
+    count += ParseKeys(&p, p + stream.size(), parsed.data() + count, max_keys - count);
+  }
+  *parse_time = NowNanos() - start_time;
+  start_time = NowNanos();
+  using cuckoohashtable::kPipelineBatchKeys;
+  using cuckoohashtable::kPipelinePrefetchKeys;
+  vector<Table::prehashed_key> batch;
+  batch.reserve(kPipelineBatchKeys);
+  for (size_t first = 0; first < count; first += kPipelineBatchKeys) {
+    const size_t batch_count = min(kPipelineBatchKeys, count - first);
+    batch.clear();
+    for (size_t k = 0; k < batch_count; ++k) {
+      batch.push_back(table->prehash(parsed[first + k]));
+    }
+    for (size_t k = 0; k < batch_count; ++k) {
+      if (k + kPipelinePrefetchKeys < batch_count) {
+        table->prefetch(batch[k + kPipelinePrefetchKeys]);
+      }
+      table->insert(move(batch[k]));
+    }
+  }
+  *insert_time = NowNanos() - start_time;
+  return count;
+}
+
+// Parses the streams on reader threads of builder, which hashes and inserts the keys
+// as they come; returns the number parsed
+size_t BuildPipelined(const vector<string>& streams,
+                      cuckoohashtable::pipelined_builder<Table>* builder) {
+  vector<cuckoohashtable::pipelined_builder<Table>::source> sources;
+  for (const string& stream : streams) {
+    const char* p = stream.data();
+    const char* end = p + stream.size();
+    sources.push_back([p, end](uint64_t* out, size_t max) mutable {
+      return ParseKeys(&p, end, out, max);
+    });
+  }
+  return builder->build(sources);
+}
+
+bool FindsAll(const Table& table, const vector<uint64_t>& keys) {
+  for (const uint64_t key : keys) {
+    if (table.find(key).first < 0) return false;
+  }
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  size_t add_count = 8 * 1000 * 1000;
+  size_t readers = 2;
+  size_t hash_workers = 2;
+  if (argc > 4) {
+    cerr << "Usage: " << argv[0] << " [add_count] [readers] [hash_workers]" << endl;
+    return 1;
+  }
+  for (int i = 1; i < argc; ++i) {
+    stringstream input_string(argv[i]);
+    if (i == 1) input_string >> add_count;
+    if (i == 2) input_string >> readers;
+    if (i == 3) input_string >> hash_workers;
+    if (input_string.fail() || (i > 1 && readers == 0)) {
+      cerr << "Invalid number: " << argv[i];
+      return 2;
+    }
+  }
+
+  const vector<uint64_t> keys = GenerateRandom64(add_count);
+  vector<string> streams(readers);
+  for (size_t i = 0; i < add_count; ++i) {
+    streams[i * readers / add_count] += to_string(keys[i]) + '\n';
+  }
+  const size_t init_size = add_count / 0.95;
+
+  Table phased(init_size);
+  uint64_t parse_time, insert_time;
+  const size_t count = BuildPhased(streams, add_count, &phased, &parse_time, &insert_time);
+
+  Table pipelined(init_size);
+  cuckoohashtable::pipelined_builder<Table> builder(pipelined, hash_workers);
+  const auto start_time = NowNanos();
+  const size_t built = BuildPipelined(streams, &builder);
+  const auto pipelined_time = NowNanos() - start_time;
+
+  cout << setw(11) << left << "phased:" << right << "parse " << setw(5)
+       << parse_time / 1000000 << " ms, insert " << setw(5) << insert_time / 1000000
+       << " ms, total " << setw(5) << (parse_time + insert_time) / 1000000 << " ms"
+       << endl;
+  cout << setw(11) << left << "pipelined:" << right << "total " << setw(5)
+       << pipelined_time / 1000000 << " ms, owner waited " << setw(4)
+       << builder.owner_wait_ns() / 1000000 << " ms" << endl;
+
+  if (count != add_count || built != add_count || !FindsAll(phased, keys) ||
+      !FindsAll(pipelined, keys)) {
+    cerr << "A build lost keys" << endl;
+    return 3;
+  }
+}
@@ -0,0 +1,137 @@
+// This benchmark builds a cuckoo_hashtable from a stream whose number of distinct keys
+// is not known up front, sized two ways. It is invoked as:
+//
+//     ./presized-build.exe [add_count] [distinct_count] [readers]
+//
+// add_count (default 8M) keys drawn from distinct_count (default 4M) random ones, each
+// of which appears at least once, are shuffled and split into one stream per reader
+// (default 2). Both tables are built from the streams by a pipelined_builder with 2
+// hash workers:
+//
+//   stream length  sized for add_count keys at a 95% load factor, the most the
+//                  stream could hold, with the bucket count rounded to a power of two
+//   presized       a first pass sketches the streams with one hyperloglog per reader;
+//                  presize() then sizes an exact table for the merged estimate
+//
+// The sketch pass reports its time and how far the estimate is from distinct_count.
+// Each table must find every distinct key afterwards.
+//
+// Example output:
+//
+// $ ./presized-build.exe 8000000 4000000 2
+// sketch:  38 ms, estimate 3968681 of 4000000 distinct keys (-0.78%)
+//                   slots    load  build ms
+// stream length  16777216   23.8%      1135
+// presized        4279388   93.5%      1334
+//
+// (The build time of the presized table includes its sketch pass. It takes longer
+// than the other one because a table 93% full walks longer cuckoo paths than one 24%
+// full: the pass buys a table a quarter the size, not a faster build.)
+
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <vector>
+
+#include "cardinality.hh"
+#include "cuckoohashtable.hh"
+#include "hashutil.h"
+#include "pipelinedbuilder.hh"
+#include "random.h"
+#include "timing.h"
+
+using namespace std;
+
+using namespace cuckoofilter;
+
+using Table = cuckoohashtable::cuckoo_hashtable<uint64_t, 12, WyHasher<uint64_t>>;
+using Source = cuckoohashtable::pipelined_builder<Table>::source;
+
+// One source per stream, copying the keys out in order
+vector<Source> Sources(const vector<vector<uint64_t>>& streams) {
+  vector<Source> sources;
+  for (const auto& stream : streams) {
+    const uint64_t* p = stream.data();
+    const uint64_t* end = p + stream.size();
+    sources.push_back([p, end](uint64_t* out, size_t max) mutable {
+      const size_t count = min<size_t>(max, end - p);
+      copy(p, p + count, out);
+      p += count;
+      return count;
+    });
+  }
+  return sources;
+}
+
+bool FindsAll(const Table& table, const vector<uint64_t>& keys) {
+  for (const uint64_t key : keys) {
+    if (table.find(key).first < 0) return false;
+  }
+  return true;
+}
+
+void Report(const char* name, const Table& table, uint64_t build_time) {
+  cout << setw(14) << left << name << right << setw(10) << table.capacity() << setw(7)
+       << fixed << setprecision(1) << table.load_factor() * 100 << "%" << setw(10)
+       << build_time / 1000000 << endl;
+}
+
+int main(int argc, char* argv[]) {
+  size_t add_count = 8 * 1000 * 1000;
+  size_t distinct_count = 4 * 1000 * 1000;
+  size_t readers = 2;
+  if (argc > 4) {
+    cerr << "Usage: " << argv[0] << " [add_count] [distinct_count] [readers]" << endl;
+    return 1;
+  }
+  for (int i = 1; i < argc; ++i) {
+    stringstream input_string(argv[i]);
+    if (i == 1) input_string >> add_count;
+    if (i == 2) input_string >> distinct_count;
+    if (i == 3) input_string >> readers;
+    if (input_string.fail() || readers == 0 || distinct_count == 0) {
+      cerr << "Invalid number: " << argv[i];
+      return 2;
+    }
+  }
+  if (distinct_count > add_count) {
+    cerr << "distinct_count exceeds add_count" << endl;
+    return 2;
+  }
+
+  const vector<uint64_t> distinct = GenerateRandom64(distinct_count);
+  vector<uint64_t> stream(distinct);
+  mt19937_64 random(1);
+  while (stream.size() < add_count) stream.push_back(distinct[random() % distinct_count]);
+  shuffle(stream.begin(), stream.end(), random);
+  vector<vector<uint64_t>> streams(readers);
+  for (size_t i = 0; i < add_count; ++i) streams[i * readers / add_count].push_back(stream[i]);
+
+  auto start_time = NowNanos();
+  Table by_length(add_count / cuckoohashtable::kPresizeMaxLoad);
+  cuckoohashtable::pipelined_builder<Table>(by_length, 2).build(Sources(streams));
+  const auto by_length_time = NowNanos() - start_time;
+
+  start_time = NowNanos();
+  const auto sketch = cuckoohashtable::sketch_sources(Sources(streams));
+  const auto sketch_time = NowNanos() - start_time;
+  Table presized(cuckoohashtable::presize(sketch), cuckoohashtable::sizing_mode::exact);
+  cuckoohashtable::pipelined_builder<Table>(presized, 2).build(Sources(streams));
+  const auto presized_time = NowNanos() - start_time;
+
+  const double estimate = sketch.estimate();
+  cout << "sketch: " << setw(3) << sketch_time / 1000000 << " ms, estimate " << fixed
+       << setprecision(0) << estimate << " of " << distinct_count << " distinct keys ("
+       << showpos << setprecision(2) << (estimate / distinct_count - 1) * 100 << noshowpos
+       << "%)" << endl;
+  cout << setw(14) << "" << setw(10) << "slots" << setw(8) << "load" << setw(10)
+       << "build ms" << endl;
+  Report("stream length", by_length, by_length_time);
+  Report("presized", presized, presized_time);
+
+  if (!FindsAll(by_length, distinct) || !FindsAll(presized, distinct)) {
+    cerr << "A build lost keys" << endl;
+    return 3;
+  }
+}
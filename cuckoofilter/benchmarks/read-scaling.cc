@@ -0,0 +1,239 @@
+// This benchmark reports how lookups on one shared, read-only structure scale with the
+// number of querying threads, the way worker threads query a single filter in
+// production. It is invoked as:
+//
+//     ./read-scaling.exe [add_count] [max_threads]
+//
+// add_count (default 4M) keys are added to a 12-bit CuckooFilter, a SimdBlockFilter and
+// a cuckoo_hashtable<uint64_t, 12>. Then 1, 2, 4, ... up to max_threads (default: all
+// hardware threads) threads, each pinned to its own CPU, query the same instance, and
+// the aggregate rate is reported in millions of lookups per second. The hashtable is
+// queried with find(), and with lookup() inside an open lookup round (start_lookup()),
+// which is how example.cc certifies the table.
+//
+// Reads that scale well stay close to max_threads times the 1-thread rate. A read path
+// that writes to shared memory, such as lookup() queueing a bucket for rehash, or a
+// shared counter, makes the cache lines it touches bounce between cores and shows up as
+// poor efficiency. To tell such writes apart from plain memory-bandwidth limits, each
+// structure is also checked before and after the threaded runs: the answers to a fixed
+// sample of queries, the hashtable's published seeds and its rehash worklist must not
+// change. The last line reports how many keys the filter took and its load, so that
+// its rate is known to be that of a full filter.
+//
+// Example output:
+//
+// $ ./read-scaling.exe 1000000 4
+//    threads  Single12 SimdBlock      find    lookup  (million lookups/sec)
+//          1     20.20     70.28     15.89      6.21
+//          2     23.03     71.98     13.97      6.13
+//          4     23.44     74.43     14.36      6.32
+// efficiency     29.0%     26.5%     22.6%     25.4%
+//
+// Single12: read path is read-only
+// SimdBlock: read path is read-only
+// find: read path is read-only
+// lookup: 0 seeds written, 261630 buckets queued for rehash, 0 sampled answers changed
+// Single12: 1000000 of 1000000 keys added, 95.4% load
+//
+// (That machine had a single core, so no configuration scales there.)
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <atomic>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cuckoofilter.h"
+#include "cuckoohashtable.hh"
+#include "random.h"
+#include "simd-block.h"
+#include "timing.h"
+
+using namespace std;
+
+using namespace cuckoofilter;
+
+// The number of queries each thread makes per measurement
+const size_t QUERIES_PER_THREAD = 2 * 1000 * 1000;
+
+// The number of queries whose answers are compared before and after the threaded runs
+const size_t CHECK_SAMPLE_SIZE = 100 * 1000;
+
+void PinToCpu(size_t cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu % thread::hardware_concurrency(), &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+// Runs fn over QUERIES_PER_THREAD queries on each of num_threads pinned threads, all
+// released together, and returns the aggregate queries per nanosecond. Thread t reads
+// its own slice of queries, so the only memory the threads share is the structure.
+template <typename Fn>
+double QueriesPerNano(const vector<uint64_t>& queries, size_t num_threads, Fn fn) {
+  atomic<size_t> ready(0);
+  atomic<bool> go(false);
+  vector<size_t> found(num_threads * 8, 0);  // one cache line per thread
+  vector<thread> threads;
+  for (size_t t = 0; t < num_threads; ++t) {
+    threads.emplace_back([&, t]() {
+      PinToCpu(t);
+      const uint64_t* const begin = &queries[t * QUERIES_PER_THREAD];
+      size_t local = 0;
+      ready++;
+      while (!go) {
+      }
+      for (size_t i = 0; i < QUERIES_PER_THREAD; ++i) {
+        local += fn(begin[i]);
+      }
+      found[t * 8] = local;
+    });
+  }
+  while (ready < num_threads) {
+  }
+  const auto start_time = NowNanos();
+  go = true;
+  for (auto& thread : threads) thread.join();
+  const auto time = NowNanos() - start_time;
+  return static_cast<double>(num_threads * QUERIES_PER_THREAD) / time;
+}
+
+// The answers fn gives on the first CHECK_SAMPLE_SIZE queries, from one thread
+template <typename Fn>
+vector<bool> SampleAnswers(const vector<uint64_t>& queries, Fn fn) {
+  vector<bool> result(CHECK_SAMPLE_SIZE);
+  for (size_t i = 0; i < CHECK_SAMPLE_SIZE; ++i) result[i] = fn(queries[i]);
+  return result;
+}
+
+size_t CountDifferences(const vector<bool>& x, const vector<bool>& y) {
+  size_t result = 0;
+  for (size_t i = 0; i < x.size(); ++i) result += (x[i] != y[i]);
+  return result;
+}
+
+// The writes a structure saw since the last check
+struct Writes {
+  size_t seeds;
+  size_t queued;
+};
+
+// One structure and read operation under test
+struct Reader {
+  string name;
+  function<bool(uint64_t)> read;
+  // The writes to the structure since the last call, if it can tell
+  function<Writes()> count_writes;
+  vector<double> rates;
+  vector<bool> answers;
+};
+
+int main(int argc, char* argv[]) {
+  size_t add_count = 4 * 1000 * 1000;
+  size_t max_threads = thread::hardware_concurrency();
+  if (argc > 3) {
+    cerr << "Usage: " << argv[0] << " [add_count] [max_threads]" << endl;
+    return 1;
+  }
+  for (int i = 1; i < argc; ++i) {
+    stringstream input_string(argv[i]);
+    input_string >> (i == 1 ? add_count : max_threads);
+    if (input_string.fail()) {
+      cerr << "Invalid number: " << argv[i];
+      return 2;
+    }
+  }
+
+  const vector<uint64_t> to_add = GenerateRandom64(add_count);
+  const vector<uint64_t> negatives = GenerateRandom64(QUERIES_PER_THREAD * max_threads);
+  // Half of the queries were added:
+  const auto queries = MixIn(&negatives[0], &negatives[negatives.size()], &to_add[0],
+                             &to_add[add_count], 0.5);
+
+  using Filter = CuckooFilter<uint64_t, 12, WyHasher<uint64_t>, SingleTable>;
+  unique_ptr<Filter> filter(new Filter(add_count));
+  size_t filter_added = 0;
+  for (const auto v : to_add) filter_added += filter->Add(v) == Ok;
+
+  SimdBlockFilter<> block(SimdBlockFilter<>::Bytes{add_count * 12 / CHAR_BIT});
+  block.AddAll(to_add.data(), add_count);
+
+  using Table = cuckoohashtable::cuckoo_hashtable<uint64_t, 12, WyHasher<uint64_t>>;
+  Table table(add_count);
+  for (const auto v : to_add) table.insert(v);
+
+  // lookup() may only queue buckets for rehash_buckets(); the published seeds, which
+  // the answers depend on, must stay as they are
+  vector<uint16_t> seeds = table.get_seeds();
+  size_t queued = table.num_dirty_buckets();
+  auto table_writes = [&table, &seeds, &queued]() {
+    const vector<uint16_t> now = table.get_seeds();
+    Writes result = {0, table.num_dirty_buckets() - queued};
+    for (size_t i = 0; i < now.size(); ++i) result.seeds += (now[i] != seeds[i]);
+    seeds = now;
+    queued = table.num_dirty_buckets();
+    return result;
+  };
+  auto no_count = []() { return Writes{0, 0}; };
+
+  vector<Reader> readers = {
+      {"Single12", [&filter](uint64_t q) { return filter->Contain(q) == Ok; }, no_count},
+      {"SimdBlock", [&block](uint64_t q) { return block.Find(q); }, no_count},
+      {"find", [&table](uint64_t q) { return table.find(q).first >= 0; }, table_writes},
+      // Concurrent seed bumps are compare-and-swaps and queue buckets under a lock;
+      // this measures what those shared writes cost.
+      {"lookup", [&table](uint64_t q) { return table.lookup(q) >= 0; }, table_writes},
+  };
+  table.start_lookup();
+
+  vector<size_t> thread_counts;
+  for (size_t n = 1; n < max_threads; n *= 2) thread_counts.push_back(n);
+  thread_counts.push_back(max_threads);
+  // One structure at a time, so the write check only sees its own reads:
+  vector<string> checks;
+  for (auto& r : readers) {
+    r.count_writes();
+    r.answers = SampleAnswers(queries, r.read);
+    for (const size_t n : thread_counts) {
+      r.rates.push_back(QueriesPerNano(queries, n, r.read));
+    }
+    const Writes writes = r.count_writes();
+    const size_t changed = CountDifferences(r.answers, SampleAnswers(queries, r.read));
+    ostringstream os;
+    os << r.name << ": ";
+    if (writes.seeds == 0 && writes.queued == 0 && changed == 0) {
+      os << "read path is read-only";
+    } else {
+      os << writes.seeds << " seeds written, " << writes.queued
+         << " buckets queued for rehash, " << changed << " sampled answers changed";
+    }
+    checks.push_back(os.str());
+  }
+
+  cout << setw(11) << right << "threads";
+  for (const auto& r : readers) cout << setw(10) << r.name;
+  cout << "  (million lookups/sec)" << endl;
+  for (size_t i = 0; i < thread_counts.size(); ++i) {
+    cout << setw(11) << thread_counts[i];
+    for (const auto& r : readers) {
+      cout << fixed << setprecision(2) << setw(10) << r.rates[i] * 1000;
+    }
+    cout << endl;
+  }
+  cout << setw(11) << "efficiency";
+  for (const auto& r : readers) {
+    cout << setprecision(1) << setw(9)
+         << 100 * r.rates.back() / (r.rates.front() * max_threads) << '%';
+  }
+  cout << endl << endl;
+  for (const auto& c : checks) cout << c << endl;
+  cout << "Single12: " << filter_added << " of " << add_count << " keys added, "
+       << fixed << setprecision(1) << 100 * filter->LoadFactor() << "% load" << endl;
+}
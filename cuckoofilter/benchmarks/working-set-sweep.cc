@@ -0,0 +1,248 @@
+// This benchmark reports lookup latency as the structure under test grows from
+// L1-resident to several times the last level cache, so that layout changes can be
+// judged at the sizes where they matter. It is invoked as:
+//
+//     ./working-set-sweep.exe [max_bytes] [alt_range]
+//
+// Sizes start at 8KB and double up to max_bytes, which defaults to 4x the LLC size
+// reported by sysconf(). At each size it builds, to roughly that many bytes:
+//
+//   Single12   CuckooFilter, 12-bit tags in a SingleTable, ns per Contain()
+//   Packed13   CuckooFilter, 13-bit semi-sorted tags in a PackedTable, ns per Contain()
+//   SimdBlock  SimdBlockFilter, ns per Find()
+//   find       cuckoo_hashtable<uint64_t, 12>, ns per find()
+//   lookup     the same table, ns per fingerprint lookup()
+//
+// The filters and the table are filled to 90% of their slots. Half of the queries are
+// keys that were inserted. After the sweep it reports the smallest share of its keys
+// any CuckooFilter took, so that a filter short of 90% would show, and the lowest load
+// reached among the filters without alt_range (alt_range rounds small tables up to a
+// whole block, which lowers their load).
+//
+// A nonzero alt_range (a power of two number of buckets) adds the filter and table
+// built with that alt_range, which keeps most alternate buckets in the same aligned
+// block of buckets as the first one:
+//
+//   Single12a  as Single12, with alt_range
+//   lookupa    as lookup, with alt_range
+//
+// and then reports the load at which inserts first fail into 8M slots, with and
+// without alt_range, for a SeededFilterBuilder and a cuckoo_hashtable, since small
+// blocks cost load.
+//
+// Example output:
+//
+// $ ./working-set-sweep.exe 1048576 1024
+// LLC: 107520 KB
+//          KB  Single12  Packed13  SimdBlock      find    lookup Single12a   lookupa
+//           8     40.82     49.17       4.56     18.68     33.86     28.14     37.50
+//          16     36.11     49.69       4.66     19.91     34.94     33.89     42.12
+//          32     33.49     43.57       3.02     15.38     33.33     31.76     39.49
+//          64     37.06     46.56       3.76     20.74     35.88     33.18     39.15
+//         128     33.22     42.63       4.63     19.84     30.71     31.87     30.76
+//         256     37.38     48.51       4.19     21.30     34.39     33.55     38.19
+//         512     37.36     48.31       4.23     22.43     35.09     34.27     40.18
+//        1024     36.44     56.12       4.46     21.34     44.54     32.77     38.85
+// filters took at least 100.0% of their keys, lowest load 89.9%
+//
+// max load, 8M slots:
+//   alt_range    filter     table
+//           0     0.958     0.959
+//        1024     0.958     0.959
+//
+// (The "hashtable is full" notices the table prints are left out. Latency differences
+// between the whole-table and block-local schemes stay within run-to-run noise on
+// that single-core machine; the page locality is aimed at tables far beyond the TLB
+// reach, at max_bytes of several hundred MB.)
+
+#include <unistd.h>
+
+#include <climits>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include "cuckoofilter.h"
+#include "cuckoohashtable.hh"
+#include "random.h"
+#include "seededbuilder.h"
+#include "simd-block.h"
+#include "timing.h"
+
+using namespace std;
+
+using namespace cuckoofilter;
+
+// The smallest size measured
+const uint64_t MIN_BYTES = 8 << 10;
+
+// The number of queries timed at each size
+const size_t QUERY_COUNT = 2 * 1000 * 1000;
+
+// The fraction of slots filled before querying
+const double LOAD = 0.9;
+
+// Used if sysconf() does not know the LLC size
+const uint64_t DEFAULT_LLC_BYTES = 32 << 20;
+
+// The number of slots the achievable load is measured at, a multiple of every
+// alt_range up to 2M buckets
+const size_t LOAD_SLOTS = 8 << 20;
+
+// The smallest share of its keys a CuckooFilter took, and the lowest load factor a
+// CuckooFilter without alt_range was timed at
+double min_keys_added = 1, min_filter_load = 1;
+
+uint64_t LastLevelCacheBytes() {
+  for (const int name : {_SC_LEVEL4_CACHE_SIZE, _SC_LEVEL3_CACHE_SIZE,
+                         _SC_LEVEL2_CACHE_SIZE}) {
+    const long bytes = sysconf(name);
+    if (bytes > 0) return bytes;
+  }
+  return DEFAULT_LLC_BYTES;
+}
+
+// Times fn over every query and returns nanoseconds per query.
+template <typename Fn>
+double NanosPerQuery(const vector<uint64_t>& queries, Fn fn) {
+  size_t found = 0;
+  const auto start_time = NowNanos();
+  for (const auto q : queries) {
+    found += fn(q);
+  }
+  const auto time = NowNanos() - start_time;
+  // Keep the lookups from being optimized away:
+  if (found == SIZE_MAX) cerr << "";
+  return static_cast<double>(time) / queries.size();
+}
+
+template <size_t bits_per_item, template <size_t> class TableType>
+double CuckooFilterNanos(uint64_t bytes, const vector<uint64_t>& keys,
+                         const vector<uint64_t>& queries, size_t alt_range = 0) {
+  using Filter = CuckooFilter<uint64_t, bits_per_item, WyHasher<uint64_t>, TableType>;
+  const size_t slots = bytes * CHAR_BIT / bits_per_item;
+  unique_ptr<Filter> filter(new Filter(slots, Exact, alt_range));
+  const size_t count = LOAD * slots;
+  size_t added = 0;
+  for (size_t i = 0; i < count; ++i) added += filter->Add(keys[i]) == Ok;
+  min_keys_added = min(min_keys_added, static_cast<double>(added) / count);
+  if (alt_range == 0) min_filter_load = min(min_filter_load, filter->LoadFactor());
+  return NanosPerQuery(queries, [&filter](uint64_t q) {
+    return filter->Contain(q) == Ok;
+  });
+}
+
+double SimdBlockNanos(uint64_t bytes, const vector<uint64_t>& keys,
+                      const vector<uint64_t>& queries) {
+  SimdBlockFilter<> filter(SimdBlockFilter<>::Bytes{bytes});
+  // As many keys as a 12-bit cuckoo filter of the same size holds:
+  filter.AddAll(keys.data(), LOAD * bytes * CHAR_BIT / 12);
+  return NanosPerQuery(queries, [&filter](uint64_t q) { return filter.Find(q); });
+}
+
+using Table = cuckoohashtable::cuckoo_hashtable<uint64_t, 12, WyHasher<uint64_t>>;
+
+// Returns the ns per find() and per lookup() of a table of about bytes bytes.
+pair<double, double> HashtableNanos(uint64_t bytes, const vector<uint64_t>& keys,
+                                    const vector<uint64_t>& queries,
+                                    size_t alt_range = 0) {
+  // Each slot holds a key and a 32-bit partial key, and each bucket a 16-bit seed:
+  const size_t slot_bytes = sizeof(uint64_t) + sizeof(uint32_t) +
+                            sizeof(uint16_t) / Table::slot_per_bucket();
+  const size_t slots = bytes / slot_bytes;
+  Table table(slots, cuckoohashtable::sizing_mode::exact, alt_range);
+  for (size_t i = 0; i < LOAD * slots; ++i) {
+    table.insert(keys[i]);
+  }
+  const double find = NanosPerQuery(queries, [&table](uint64_t q) {
+    return table.find(q).first >= 0;
+  });
+  const double lookup = NanosPerQuery(queries, [&table](uint64_t q) {
+    return table.lookup(q) >= 0;
+  });
+  return make_pair(find, lookup);
+}
+
+// The fraction of LOAD_SLOTS filled when an Add first fails
+double FilterMaxLoad(const vector<uint64_t>& keys, size_t alt_range) {
+  SeededFilterBuilder<uint64_t, 12, WyHasher<uint64_t>> builder(LOAD_SLOTS, Exact,
+                                                                alt_range);
+  size_t added = 0;
+  while (added < keys.size() && builder.Add(keys[added]) == Ok) ++added;
+  return static_cast<double>(added) / LOAD_SLOTS;
+}
+
+// The load factor of a table of LOAD_SLOTS slots when an insert first fails
+double HashtableMaxLoad(const vector<uint64_t>& keys, size_t alt_range) {
+  Table table(LOAD_SLOTS, cuckoohashtable::sizing_mode::exact, alt_range);
+  try {
+    for (const uint64_t key : keys) table.insert(key);
+  } catch (const out_of_range&) {
+  }
+  return table.load_factor();
+}
+
+int main(int argc, char* argv[]) {
+  const uint64_t llc_bytes = LastLevelCacheBytes();
+  uint64_t max_bytes = 4 * llc_bytes;
+  size_t alt_range = 0;
+  if (argc > 3) {
+    cerr << "Usage: " << argv[0] << " [max_bytes] [alt_range]" << endl;
+    return 1;
+  }
+  for (int i = 1; i < argc; ++i) {
+    stringstream input_string(argv[i]);
+    if (i == 1) input_string >> max_bytes;
+    if (i == 2) input_string >> alt_range;
+    if (input_string.fail() || (alt_range & (alt_range - 1)) != 0) {
+      cerr << "Invalid number: " << argv[i];
+      return 2;
+    }
+  }
+
+  // Enough keys for the densest structure at the largest size, the SimdBlockFilter:
+  const vector<uint64_t> keys = GenerateRandom64(max_bytes * CHAR_BIT / 12 + 1);
+  const vector<uint64_t> negatives = GenerateRandom64(QUERY_COUNT);
+
+  cout << "LLC: " << (llc_bytes >> 10) << " KB" << endl;
+  cout << setw(12) << right << "KB" << setw(10) << "Single12" << setw(10) << "Packed13"
+       << setw(11) << "SimdBlock" << setw(10) << "find" << setw(10) << "lookup";
+  if (alt_range > 0) cout << setw(10) << "Single12a" << setw(10) << "lookupa";
+  cout << endl;
+  for (uint64_t bytes = MIN_BYTES; bytes <= max_bytes; bytes *= 2) {
+    // Positive queries come from the keys every structure of this size has inserted:
+    const size_t inserted = LOAD * bytes / (sizeof(uint64_t) + sizeof(uint32_t) + 1);
+    const auto queries = MixIn(&negatives[0], &negatives[QUERY_COUNT], &keys[0],
+                               &keys[inserted], 0.5);
+    const double single = CuckooFilterNanos<12, SingleTable>(bytes, keys, queries);
+    const double packed = CuckooFilterNanos<13, PackedTable>(bytes, keys, queries);
+    const double simd = SimdBlockNanos(bytes, keys, queries);
+    const auto table = HashtableNanos(bytes, keys, queries);
+    cout << fixed << setprecision(2) << setw(12) << (bytes >> 10) << setw(10) << single
+         << setw(10) << packed << setw(11) << simd << setw(10) << table.first
+         << setw(10) << table.second;
+    if (alt_range > 0) {
+      cout << setw(10) << CuckooFilterNanos<12, SingleTable>(bytes, keys, queries, alt_range)
+           << setw(10) << HashtableNanos(bytes, keys, queries, alt_range).second;
+    }
+    cout << endl;
+  }
+  cout << "filters took at least " << setprecision(1) << 100 * min_keys_added
+       << "% of their keys, lowest load " << 100 * min_filter_load << "%" << endl;
+
+  if (alt_range > 0) {
+    const vector<uint64_t> load_keys = GenerateRandom64(LOAD_SLOTS);
+    cout << endl << "max load, " << (LOAD_SLOTS >> 20) << "M slots:" << endl;
+    cout << setw(12) << "alt_range" << setw(10) << "filter" << setw(10) << "table" << endl;
+    for (const size_t range : {size_t(0), alt_range}) {
+      // measured before printing: a full table reports itself on cout
+      const double filter = FilterMaxLoad(load_keys, range);
+      const double table = HashtableMaxLoad(load_keys, range);
+      cout << setw(12) << range << setprecision(3) << setw(10) << filter << setw(10)
+           << table << endl;
+    }
+  }
+}
@@ -0,0 +1,77 @@
+#include "cuckoofilter.h"
+
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using cuckoofilter::CuckooFilter;
+using cuckoofilter::WyHasher;
+
+// Adds count random keys to filter, which must take every one of them, and
+// checks that each is found, also after deleting every other key. Returns
+// whether all went well.
+template <typename Filter>
+bool RoundTrip(const std::string &name, Filter &filter, const size_t count) {
+  std::mt19937_64 random(count);
+  std::vector<uint64_t> keys(count);
+  for (auto &key : keys) key = random();
+
+  size_t failed_adds = 0, missing = 0, missing_after_delete = 0;
+  for (const uint64_t key : keys) {
+    failed_adds += filter.Add(key) != cuckoofilter::Ok;
+  }
+  for (const uint64_t key : keys) {
+    missing += filter.Contain(key) != cuckoofilter::Ok;
+  }
+  for (size_t i = 0; i < count; i += 2) filter.Delete(keys[i]);
+  for (size_t i = 1; i < count; i += 2) {
+    missing_after_delete += filter.Contain(keys[i]) != cuckoofilter::Ok;
+  }
+
+  std::cout << name << ": " << count << " keys, "
+            << 8.0 * filter.SizeInBytes() / count << " bits/key, "
+            << failed_adds << " failed adds, " << missing << " not found, "
+            << missing_after_delete << " not found after deletes\n";
+  return failed_adds == 0 && missing == 0 && missing_after_delete == 0;
+}
+
+int main(int argc, char **argv) {
+  const size_t total_items = 1000000;
+  bool ok = true;
+
+  // Exact sizing leaves no slack: total_items fill 95% of the slots
+  {
+    CuckooFilter<uint64_t, 12, WyHasher<uint64_t>> filter(
+        total_items / 0.95, cuckoofilter::Exact);
+    ok &= RoundTrip("SingleTable, Exact", filter, total_items);
+  }
+  // power of two tables of 2^20 slots, filled to 95%
+  const size_t pow2_items = 0.95 * (1 << 20);
+  {
+    CuckooFilter<uint64_t, 12, WyHasher<uint64_t>> filter(pow2_items);
+    ok &= RoundTrip("SingleTable, PowerOfTwo", filter, pow2_items);
+  }
+  {
+    CuckooFilter<uint64_t, 13, WyHasher<uint64_t>, cuckoofilter::PackedTable>
+        filter(pow2_items);
+    ok &= RoundTrip("PackedTable, PowerOfTwo", filter, pow2_items);
+  }
+  {
+    CuckooFilter<uint64_t, 12, WyHasher<uint64_t>, cuckoofilter::EpochTable>
+        filter(total_items / 0.95, cuckoofilter::Exact);
+    ok &= RoundTrip("EpochTable, Exact", filter, total_items);
+  }
+  // sized for 95% of the tags its blocks hold
+  {
+    CuckooFilter<uint64_t, 12, WyHasher<uint64_t>, cuckoofilter::MortonTable>
+        filter(total_items / 0.95);
+    ok &= RoundTrip("MortonTable", filter, total_items);
+  }
+
+  if (!ok) {
+    std::cout << "round trip failed\n";
+    return 1;
+  }
+  return 0;
+}
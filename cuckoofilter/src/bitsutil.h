@@ -1,6 +1,13 @@
 #ifndef CUCKOO_FILTER_BITS_H_
 #define CUCKOO_FILTER_BITS_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
 namespace cuckoofilter {
 
 // inspired from
@@ -18,6 +25,55 @@ namespace cuckoofilter {
   (((x)-0x0001000100010001ULL) & (~(x)) & 0x8000800080008000ULL)
 #define hasvalue16(x, n) (haszero16((x) ^ (0x0001000100010001ULL * (n))))
 
+#define haszero32(x) \
+  (((x)-0x0000000100000001ULL) & (~(x)) & 0x8000000080000000ULL)
+#define hasvalue32(x, n) (haszero32((x) ^ (0x0000000100000001ULL * (n))))
+
+// Mask selecting the low `bits` bits of each of the `lanes` lanes of
+// `lane_bits` bits in a 64-bit word, e.g. lanemask(13, 16, 4) for four 13-bit
+// tags spread over 16-bit lanes.
+constexpr uint64_t lanemask(size_t bits, size_t lane_bits, size_t lanes) {
+  return lanes == 0 ? 0
+                    : (((1ULL << bits) - 1) << (lane_bits * (lanes - 1))) |
+                          lanemask(bits, lane_bits, lanes - 1);
+}
+
+// Spreads `lanes` densely packed fields of `bits` bits from the low end of x
+// into lanes of `lane_bits` bits. This is a single pdep with BMI2, and a
+// shift-and-mask loop the compiler unrolls otherwise.
+template <size_t bits, size_t lane_bits, size_t lanes>
+inline uint64_t spreadfields(uint64_t x) {
+  static_assert(bits <= lane_bits && lane_bits * lanes <= 64,
+                "fields do not fit in a 64-bit word");
+#ifdef __BMI2__
+  return _pdep_u64(x, lanemask(bits, lane_bits, lanes));
+#else
+  uint64_t r = 0;
+  for (size_t k = 0; k < lanes; k++) {
+    r |= ((x >> (k * bits)) & ((1ULL << bits) - 1)) << (k * lane_bits);
+  }
+  return r;
+#endif
+}
+
+// The position of the k-th (from 0) set bit of x, which must have more than k
+// set bits. A pdep and a tzcnt with BMI2, a loop clearing the lowest set bit
+// otherwise.
+inline size_t selectword(uint64_t x, size_t k) {
+#ifdef __BMI2__
+  return _tzcnt_u64(_pdep_u64(1ULL << k, x));
+#else
+  for (; k > 0; k--) x &= x - 1;
+  return __builtin_ctzll(x);
+#endif
+}
+
+// maps a 32-bit hash onto [0, n) with a multiply-shift instead of a modulo
+// (Lemire's "fastrange"), n must not exceed 2^32
+inline uint32_t fastrange32(uint32_t hash, uint64_t n) {
+  return static_cast<uint32_t>((static_cast<uint64_t>(hash) * n) >> 32);
+}
+
 inline uint64_t upperpower2(uint64_t x) {
   x--;
   x |= x >> 1;
@@ -0,0 +1,138 @@
+#ifndef CUCKOO_FILTER_CERTIFIER_H_
+#define CUCKOO_FILTER_CERTIFIER_H_
+
+#include <stddef.h>
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+#include "cuckoofilter.h"
+#include "threadpool.h"
+
+namespace cuckoofilter {
+
+// CertifyFilter checks R and S in chunks of this many items, which the pool's
+// threads take in turn
+const size_t kCertifyChunk = 1 << 16;
+
+// CertifyReport lists at most this many offending items of each kind; the
+// counts are always exact
+const size_t kMaxReportedOffenders = 1 << 10;
+
+// an item the filter answers wrongly, and the two buckets it is looked up in
+template <typename ItemType>
+struct CertifyOffender {
+  ItemType item;
+  size_t i1;
+  size_t i2;
+};
+
+// The outcome of certifying a filter against the set R it must contain and a
+// disjoint set S it must reject.
+template <typename ItemType>
+struct CertifyReport {
+  size_t positives_checked;
+  size_t negatives_checked;
+  size_t false_negatives;
+  size_t false_positives;
+  // the first offenders in R and S order, at most kMaxReportedOffenders each.
+  // False positives can be fed to SeededFilterBuilder::IngestFalsePositives.
+  std::vector<CertifyOffender<ItemType>> false_negative_items;
+  std::vector<CertifyOffender<ItemType>> false_positive_items;
+
+  bool Passed() const { return false_negatives == 0 && false_positives == 0; }
+};
+
+// Certifies filter against R (no false negatives allowed) and S (no false
+// positives allowed). Both sets are streamed through ContainBatch in chunks,
+// which the threads of pool take in turn; the filter is only read, so it may
+// be shared with other readers meanwhile.
+//
+//   CertifyReport<uint64_t> report =
+//       CertifyFilter(filter, r.data(), r.size(), s.data(), s.size());
+//   if (!report.Passed()) ... report.false_positive_items ...
+template <typename FilterType, typename ItemType>
+CertifyReport<ItemType> CertifyFilter(
+    const FilterType &filter, const ItemType *r, const size_t r_count,
+    const ItemType *s, const size_t s_count,
+    ThreadPool &pool = ThreadPool::Default()) {
+  // chunk c covers R for c < r_chunks, then S
+  const size_t r_chunks = (r_count + kCertifyChunk - 1) / kCertifyChunk;
+  const size_t s_chunks = (s_count + kCertifyChunk - 1) / kCertifyChunk;
+  const size_t num_chunks = r_chunks + s_chunks;
+
+  // an offender found at position pos of its set
+  struct Found {
+    size_t pos;
+    CertifyOffender<ItemType> offender;
+  };
+  // keeps the kMaxReportedOffenders earliest of found, which is sorted by
+  // position from first on
+  auto keep_first = [](std::vector<Found> &found, const size_t first) {
+    std::inplace_merge(
+        found.begin(), found.begin() + first, found.end(),
+        [](const Found &x, const Found &y) { return x.pos < y.pos; });
+    if (found.size() > kMaxReportedOffenders) {
+      found.resize(kMaxReportedOffenders);
+    }
+  };
+  std::mutex mutex;
+  size_t false_negatives = 0, false_positives = 0;
+  // the earliest offenders found so far, so memory stays bounded however
+  // badly the filter is broken
+  std::vector<Found> negatives_found, positives_found;
+
+  pool.ParallelFor(0, num_chunks, 1, [&](const size_t lo, const size_t hi) {
+    std::vector<Status> results(kCertifyChunk);
+    // a task's chunks are in order, so its first offenders come first
+    std::vector<Found> fn, fp;
+    size_t num_fn = 0, num_fp = 0;
+    for (size_t c = lo; c < hi; c++) {
+      const bool in_r = c < r_chunks;
+      const ItemType *const set = in_r ? r : s;
+      const size_t begin = (in_r ? c : c - r_chunks) * kCertifyChunk;
+      const size_t n = std::min(kCertifyChunk, (in_r ? r_count : s_count) - begin);
+      filter.ContainBatch(set + begin, n, results.data());
+      const Status wrong = in_r ? NotFound : Ok;
+      std::vector<Found> &found = in_r ? fn : fp;
+      size_t &num_found = in_r ? num_fn : num_fp;
+      for (size_t k = 0; k < n; k++) {
+        if (results[k] != wrong) continue;
+        if (num_found++ >= kMaxReportedOffenders) continue;
+        Found f;
+        f.pos = begin + k;
+        f.offender.item = set[begin + k];
+        filter.Buckets(f.offender.item, &f.offender.i1, &f.offender.i2);
+        found.push_back(f);
+      }
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    false_negatives += num_fn;
+    false_positives += num_fp;
+    const size_t first_fn = negatives_found.size();
+    negatives_found.insert(negatives_found.end(), fn.begin(), fn.end());
+    keep_first(negatives_found, first_fn);
+    const size_t first_fp = positives_found.size();
+    positives_found.insert(positives_found.end(), fp.begin(), fp.end());
+    keep_first(positives_found, first_fp);
+  });
+
+  // the same offenders however the chunks were spread over threads
+  auto first_offenders = [](const std::vector<Found> &found) {
+    std::vector<CertifyOffender<ItemType>> result;
+    for (const Found &f : found) result.push_back(f.offender);
+    return result;
+  };
+  CertifyReport<ItemType> report;
+  report.positives_checked = r_count;
+  report.negatives_checked = s_count;
+  report.false_negatives = false_negatives;
+  report.false_positives = false_positives;
+  report.false_negative_items = first_offenders(negatives_found);
+  report.false_positive_items = first_offenders(positives_found);
+  return report;
+}
+
+}  // namespace cuckoofilter
+#endif  // CUCKOO_FILTER_CERTIFIER_H_
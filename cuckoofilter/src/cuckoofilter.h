@@ -3,9 +3,13 @@
 
 #include <assert.h>
 #include <algorithm>
+#include <cmath>
+#include <vector>
 
 #include "debug.h"
+#include "epochtable.h"
 #include "hashutil.h"
+#include "mortontable.h"
 #include "packedtable.h"
 #include "printutil.h"
 #include "singletable.h"
@@ -17,22 +21,101 @@ enum Status {
   NotFound = 1,
   NotEnoughSpace = 2,
   NotSupported = 3,
+  IOError = 4,
 };
 
 // maximum number of cuckoo kicks before claiming failure
 const size_t kMaxCuckooCount = 500;
 
+// with a nonzero alt_range, items whose mixed fingerprint has none of these
+// bits set (one in four) still take their alternate bucket from the whole
+// table; the rest stay within their block of alt_range buckets. Without the
+// escapees blocks fill unevenly and the achievable load drops (see the
+// CuckooFilter constructor).
+const uint64_t kAltRangeWideMask = 3ull << 30;
+
+// slots per bucket of the cuckoo_hashtable a seeded filter is exported from:
+// the seeds constructor and CopyInsert only take tables with as many
+const size_t kSeededSlotsPerBucket = 4;
+
+// how many queries ahead ContainBatch prefetches
+const size_t kContainBatchDistance = 16;
+
+// ContainSorted answers at most this many queries per sorted pass, so query
+// positions fit in 32 bits and the scratch space stays bounded
+const size_t kSortedQueryChunk = 1 << 24;
+
+// the new seed and tags of one rehashed bucket, as emitted by
+// SeededFilterBuilder::IngestFalsePositives and applied to a deployed filter
+// with CuckooFilter::ApplyDelta. The old tags are the ones to remove.
+struct BucketDelta {
+  size_t index;
+  uint16_t seed;
+  uint8_t num_tags;
+  uint32_t old_tags[4];
+  uint32_t new_tags[4];
+};
+
+// how a filter turns max_num_keys into a bucket count: PowerOfTwo rounds up
+// to a power of two (indexing with bitmasks), Exact allocates just enough
+// buckets and indexes them with fastrange and a modular alternate index
+enum SizingMode {
+  PowerOfTwo = 0,
+  Exact = 1,
+};
+
+template <typename ItemType, size_t bits_per_item, typename HashFamily,
+          template <size_t> class TableType>
+class SeededFilterBuilder;
+
+// one step of a cuckoo walk: inserts tag into bucket i of table, or kicks
+// out another tag, returned in oldtag with the bucket it was in
+template <typename Table>
+inline bool KickTag(Table *table, const size_t i, const uint32_t tag,
+                    uint32_t &oldtag, size_t &oldindex) {
+  oldindex = i;
+  return table->InsertTagToBucket(i, tag, true, oldtag);
+}
+
+// a MortonTable may kick a tag out of another bucket of the block
+template <size_t bits_per_tag>
+inline bool KickTag(MortonTable<bits_per_tag> *table, const size_t i,
+                    const uint32_t tag, uint32_t &oldtag, size_t &oldindex) {
+  return table->KickTagToBucket(i, tag, oldtag, oldindex);
+}
+
+template <typename ItemType, size_t bits_per_item, typename HashFamily>
+class DiskFilter;
+
 // A cuckoo filter class exposes a Bloomier filter interface,
 // providing methods of Add, Delete, Contain. It takes three
 // template parameters:
 //   ItemType:  the type of item you want to insert
 //   bits_per_item: how many bits each item is hashed into
-//   TableType: the storage of table, SingleTable by default, and
-// PackedTable to enable semi-sorting
+//   TableType: the storage of table, SingleTable by default,
+// PackedTable to enable semi-sorting, EpochTable to let items expire
+// after a number of epochs (see SetEpoch), and MortonTable to pack sparse
+// buckets into cache-line blocks
+//
+// A filter constructed from a size hashes every tag under seed 0 and takes
+// the alternate bucket from the tag, as the original cuckoo filter does, so
+// Add can kick tags between buckets without knowing their items. A seeded
+// filter (exported from a cuckoo_hashtable, or built by SeededFilterBuilder)
+// hashes each bucket under its own seed and takes the alternate bucket from
+// the item; a tag there cannot be moved, so Add only fills free slots.
 template <typename ItemType, size_t bits_per_item,
           typename HashFamily = TwoIndependentMultiplyShift,
           template <size_t> class TableType = SingleTable>
 class CuckooFilter {
+  // fills table_ and seeds_ directly, see seededbuilder.h
+  friend class SeededFilterBuilder<ItemType, bits_per_item, HashFamily,
+                                   TableType>;
+  // writes table_ and seeds_ to a file, and hashes queries against them
+  friend class DiskFilter<ItemType, bits_per_item, HashFamily>;
+
+  // the bits of a tag; tables may keep state of their own above them
+  static const uint32_t kTagMask = (1ULL << bits_per_item) - 1;
+
   // Storage of items
   TableType<bits_per_item> *table_;
 
@@ -51,17 +134,86 @@ class CuckooFilter {
 
   std::vector<uint16_t> seeds_;
 
+  // log2 of the bucket count, rounded up; matches the hashpower of a
+  // cuckoo_hashtable with the same number of buckets
+  size_t hashpower_;
+
+  // whether the bucket count is a power of two (bitmask indexing)
+  bool pow2_buckets_;
+
+  // whether buckets have seeds of their own, so that tags and the alternate
+  // bucket follow from the item (see the class comment)
+  bool seeded_;
+
+  // a query of ContainSorted, with its position in the caller's batch and the
+  // bucket it probes next
+  struct SortedQuery {
+    ItemType item;
+    uint32_t pos;
+    uint32_t bucket;
+  };
+
+  // LSD radix sort of queries by bucket, 11 bits per pass; tmp is scratch
+  // space of the same size. Only the bucket bits above a cache-sized region
+  // of the table are sorted on: within a region the probes hit L2 anyway, so
+  // a table of up to 2^11 regions needs a single pass.
+  void SortByBucket(std::vector<SortedQuery> &queries,
+                    std::vector<SortedQuery> &tmp) const {
+    const size_t kRadixBits = 11;
+    const size_t kRadixMask = (1 << kRadixBits) - 1;
+    const size_t kRegionBytes = 256 << 10;
+    const size_t bucket_bytes =
+        std::max<size_t>(1, table_->SizeInBytes() / table_->NumBuckets());
+    size_t region_bits = 0;
+    while ((bucket_bytes << region_bits) < kRegionBytes &&
+           region_bits < hashpower_) {
+      region_bits++;
+    }
+    tmp.resize(queries.size());
+    for (size_t shift = region_bits; shift < hashpower_; shift += kRadixBits) {
+      size_t offsets[(1 << kRadixBits) + 1] = {0};
+      for (const SortedQuery &q : queries) {
+        offsets[((q.bucket >> shift) & kRadixMask) + 1]++;
+      }
+      for (size_t d = 0; d < kRadixMask + 1; d++) {
+        offsets[d + 1] += offsets[d];
+      }
+      for (const SortedQuery &q : queries) {
+        tmp[offsets[(q.bucket >> shift) & kRadixMask]++] = q;
+      }
+      queries.swap(tmp);
+    }
+  }
+
+  // 0, or the power of two size of the aligned blocks of buckets that most
+  // items' alternate bucket stays within (see kAltRangeWideMask)
+  size_t alt_range_;
+
+  void InitIndexing(const size_t alt_range) {
+    const size_t num_buckets = table_->NumBuckets();
+    for (hashpower_ = 0; (size_t(1) << hashpower_) < num_buckets; hashpower_++)
+      ;
+    pow2_buckets_ = (num_buckets & (num_buckets - 1)) == 0;
+    alt_range_ = std::min(alt_range, num_buckets);
+    if (alt_range_ < 2) alt_range_ = 0;
+    assert((alt_range_ & (alt_range_ - 1)) == 0 &&
+           num_buckets % std::max<size_t>(alt_range_, 1) == 0);
+  }
+
   template <typename K>
   inline uint64_t Hash(const K &key, uint32_t seed = 0) const {
     return hasher_(key, seed);
   }
 
   inline size_t IndexHash(const ItemType &item) const {
-    // table_->num_buckets is always a power of two, so modulo can be replaced
+    // if table_->num_buckets is a power of two, modulo can be replaced
     // with
-    // bitwise-and:
+    // bitwise-and, otherwise use a multiply-shift:
     const uint32_t hash = item >> 32;
-    return hash & (table_->NumBuckets() - 1);
+    if (pow2_buckets_) {
+      return hash & (table_->NumBuckets() - 1);
+    }
+    return fastrange32(hash, table_->NumBuckets());
   }
 
   inline uint32_t TagHash(
@@ -86,11 +238,23 @@ class CuckooFilter {
   inline void GenerateTagHashes(const ItemType &item, size_t *i1, size_t *i2,
                                 uint32_t *tag1, uint32_t *tag2) const {
     *i1 = IndexHash(item);  // original: hash >> 32
+    *tag1 = TagHash(hasher_(item, seeds_.at(*i1)));
+    if (!seeded_) {
+      *i2 = TagAltIndex(*i1, *tag1);
+      *tag2 = *tag1;
+      return;
+    }
     *i2 = AltIndex(*i1, item);
-    const uint64_t hash1 = hasher_(item, seeds_.at(*i1));
-    const uint64_t hash2 = hasher_(item, seeds_.at(*i2));
-    *tag1 = TagHash(hash1);
-    *tag2 = TagHash(hash2);
+    *tag2 = TagHash(hasher_(item, seeds_.at(*i2)));
+  }
+
+  // whether the pending victim is item's tag in one of its buckets
+  inline bool VictimMatches(const size_t i1, const size_t i2,
+                            const uint32_t tag1, const uint32_t tag2) const {
+    if (!victim_.used) return false;
+    const uint32_t tag = victim_.tag & kTagMask;
+    return (victim_.index == i1 && tag == tag1) ||
+           (victim_.index == i2 && tag == tag2);
   }
 
   /*
@@ -107,39 +271,90 @@ class CuckooFilter {
     // index ^ HashUtil::BobHash((const void*) (&tag), 4)) & table_->INDEXMASK;
     // now doing a quick-n-dirty way:
     // 0x5bd1e995 is the hash constant from MurmurHash2
-    const size_t hp = log2(table_->NumBuckets());
-    const size_t fp = (item >> hp) + 1;
+    const size_t fp = (item >> hashpower_) + 1;
+    return AltIndexOfMix(index, fp * 0xc6a4a7935bd1e995);
+  }
+
+  // the alternate bucket of a filter that is not seeded, from the tag alone
+  inline size_t TagAltIndex(const size_t index, const uint32_t tag) const {
+    return AltIndexOfMix(index, tag * 0xc6a4a7935bd1e995);
+  }
+
+  // the other bucket of item, whose tag at index is tag
+  inline size_t OtherIndex(const size_t index, const ItemType &item,
+                           const uint32_t tag) const {
+    return seeded_ ? AltIndex(index, item) : TagAltIndex(index, tag);
+  }
+
+  // the bucket paired with index by a mixed fingerprint; an involution
+  inline size_t AltIndexOfMix(const size_t index, const uint64_t mixed) const {
+    if (alt_range_ != 0 && (mixed & kAltRangeWideMask) != 0) {
+      // vacuum filter style: stay within the aligned block of alt_range_
+      // buckets holding index, i.e. on the same page or two
+      const size_t delta = (mixed >> 32) & (alt_range_ - 1);
+      return index ^ (delta == 0 ? 1 : delta);
+    }
+    if (!pow2_buckets_) {
+      // index + alt index == offset (mod num_buckets) keeps this an
+      // involution for any bucket count
+      const size_t n = table_->NumBuckets();
+      const size_t offset = fastrange32(mixed >> 32, n);
+      return index <= offset ? offset - index : offset + n - index;
+    }
     const size_t hashmask = table_->NumBuckets() - 1;
     // return IndexHash((uint32_t)(index ^ (item * 0x5bd1e995)));
-    return (index ^ (fp * 0xc6a4a7935bd1e995)) & hashmask;
+    return (index ^ mixed) & hashmask;
   }
 
   Status AddImpl(const size_t i, const uint32_t tag);
 
-  // load factor is the fraction of occupancy
-  double LoadFactor() const { return 1.0 * Size() / table_->SizeInTags(); }
-
   double BitsPerItem() const { return 8.0 * table_->SizeInBytes() / Size(); }
 
  public:
-  explicit CuckooFilter(const size_t max_num_keys)
-      : num_items_(0), victim_(), hasher_() {
-    size_t assoc = 4;
-    size_t num_buckets =
-        upperpower2(std::max<uint64_t>(1, max_num_keys / assoc));
-    double frac = (double)max_num_keys / num_buckets / assoc;
-    if (frac > 0.96) {
-      num_buckets <<= 1;
+  // alt_range, if nonzero, is a power of two number of buckets: most
+  // alternate buckets are then picked within the same aligned block of
+  // alt_range buckets instead of anywhere in the table, so that for a table
+  // much larger than the TLB reach both buckets of a lookup or a kick share a
+  // page. From 256 buckets up (1.5KB of 12-bit tags) the achievable load stays
+  // within half a point of the whole-table scheme; 16 buckets drops it to
+  // about 0.62. Exact sizing rounds the bucket count up to a multiple of
+  // alt_range. Tables that gain nothing from a power of two bucket count
+  // (MortonTable) are sized Exact whatever the mode.
+  explicit CuckooFilter(const size_t max_num_keys,
+                        const SizingMode mode = PowerOfTwo,
+                        const size_t alt_range = 0)
+      : num_items_(0), victim_(), hasher_(), seeded_(false) {
+    const double assoc = TableType<bits_per_item>::SizingTagsPerBucket();
+    size_t num_buckets;
+    if (mode == Exact || !TableType<bits_per_item>::PowerOfTwoBuckets()) {
+      num_buckets = std::max<uint64_t>(1, std::ceil(max_num_keys / assoc));
+      if (alt_range > 1) {
+        num_buckets = num_buckets < alt_range
+                          ? upperpower2(num_buckets)
+                          : (num_buckets + alt_range - 1) / alt_range * alt_range;
+      }
+    } else {
+      num_buckets = upperpower2(std::max<uint64_t>(1, max_num_keys / assoc));
+      double frac = (double)max_num_keys / num_buckets / assoc;
+      if (frac > 0.96) {
+        num_buckets <<= 1;
+      }
     }
     victim_.used = false;
+    seeds_.assign(num_buckets, 0);
     table_ = new TableType<bits_per_item>(num_buckets);
+    InitIndexing(alt_range);
   }
 
-  // modified constructor
+  // modified constructor: a filter with the buckets and seeds of an exported
+  // cuckoo_hashtable, to be filled by CopyInsert; not for MortonTable
   explicit CuckooFilter(const size_t max_num_keys,
-                        const std::vector<uint16_t> &seeds)
-      : num_items_(0), victim_(), hasher_() {
-    size_t assoc = 4;
+                        const std::vector<uint16_t> &seeds,
+                        const size_t alt_range = 0)
+      : num_items_(0), victim_(), hasher_(), seeded_(true) {
+    static_assert(TableType<bits_per_item>::SizingTagsPerBucket() ==
+                      kSeededSlotsPerBucket,
+                  "a seeded export needs 4 slots per bucket");
     size_t num_buckets = seeds.size();
     // upperpower2(std::max<uint64_t>(1, max_num_keys / assoc));
     // double frac = (double)max_num_keys / num_buckets / assoc;
@@ -154,6 +369,7 @@ class CuckooFilter {
     // }
     // std::cout << "]\nseeds array size: " << seeds_.size() << "\n";
     table_ = new TableType<bits_per_item>(num_buckets);
+    InitIndexing(alt_range);
   }
 
   ~CuckooFilter() { delete table_; }
@@ -167,9 +383,56 @@ class CuckooFilter {
   // Report if the item is inserted, with false positive rate.
   Status Contain(const ItemType &item) const;
 
+  // Contain() for a large offline batch: results[k] is the answer for
+  // items[k]. Queries are radix sorted by primary bucket and checked in one
+  // sequential sweep of the table; the misses are then sorted by alternate
+  // bucket and checked in a second sweep. This trades random DRAM accesses
+  // for sequential bandwidth, so it only pays off once the table is well out
+  // of cache and the batch is large relative to the number of buckets.
+  void ContainSorted(const ItemType *items, size_t count,
+                     Status *results) const;
+
+  // Contain() for a batch in any order: results[k] is the answer for
+  // items[k]. The buckets and seeds of the query kContainBatchDistance ahead
+  // are prefetched, so the batch keeps that many cache misses in flight
+  // instead of one or two.
+  void ContainBatch(const ItemType *items, size_t count,
+                    Status *results) const;
+
+  // the two buckets item is looked up in, for tools that report where an
+  // item lives, such as CertifyFilter
+  void Buckets(const ItemType &item, size_t *i1, size_t *i2) const {
+    *i1 = IndexHash(item);
+    *i2 = seeded_ ? AltIndex(*i1, item)
+                  : TagAltIndex(*i1, TagHash(hasher_(item, seeds_[*i1])));
+  }
+
   // Delete an key from the filter
   Status Delete(const ItemType &item);
 
+  // Apply rehashed buckets from a SeededFilterBuilder in place. Returns
+  // NotFound, after applying the rest, if an old tag of some bucket was not
+  // there, i.e. the filter did not come from the same builder state.
+  Status ApplyDelta(const std::vector<BucketDelta> &delta);
+
+  // Advance the filter to the given epoch, which never goes back, keeping
+  // items added during the last `window` epochs. Older items are removed
+  // from the table, and from Size(), so Contain no longer matches them and
+  // Add reuses their slots. A pending victim that expires is dropped; one
+  // that does not is inserted again into the room freed, as Delete does.
+  // Only available with TableType = EpochTable.
+  void SetEpoch(const uint32_t epoch, const uint32_t window) {
+    const size_t swept = table_->SetEpoch(
+        epoch, window, victim_.used ? &victim_.tag : nullptr);
+    num_items_ -= swept;
+    if (victim_.used && (victim_.tag == 0 || swept > 0)) {
+      victim_.used = false;
+      if (victim_.tag != 0) {
+        AddImpl(victim_.index, victim_.tag);
+      }
+    }
+  }
+
   /* methods for providing stats  */
   // summary infomation
   std::string Info() const;
@@ -177,6 +440,9 @@ class CuckooFilter {
   // number of current inserted items;
   size_t Size() const { return num_items_; }
 
+  // load factor is the fraction of occupancy
+  double LoadFactor() const { return 1.0 * Size() / table_->SizeInTags(); }
+
   // size of the filter in bytes. TODO: modify to include seeds if used.
   size_t SizeInBytes() const { return table_->SizeInBytes(); }
 };
@@ -185,21 +451,34 @@ template <typename ItemType, size_t bits_per_item, typename HashFamily,
           template <size_t> class TableType>
 Status CuckooFilter<ItemType, bits_per_item, HashFamily, TableType>::Add(
     const ItemType &item) {
-  size_t i;
-  uint32_t tag;
+  size_t i1, i2;
+  uint32_t tag1, tag2;
+  uint32_t oldtag;
 
   if (victim_.used) {
     return NotEnoughSpace;
   }
 
-  GenerateIndexTagHash(item, &i, &tag);
-  return AddImpl(i, tag);
+  // try both candidate buckets (empty or expired slots) before falling back
+  // to kicks. A seeded filter cannot kick: a tag it moved would need the
+  // seed of its new bucket and an alternate bucket from its item.
+  GenerateTagHashes(item, &i1, &i2, &tag1, &tag2);
+  if (table_->InsertTagToBucket(i1, tag1, false, oldtag) ||
+      table_->InsertTagToBucket(i2, tag2, false, oldtag)) {
+    num_items_++;
+    return Ok;
+  }
+  if (seeded_) {
+    return NotEnoughSpace;
+  }
+  return AddImpl(i1, tag1);
 }
 
 template <typename ItemType, size_t bits_per_item, typename HashFamily,
           template <size_t> class TableType>
 Status CuckooFilter<ItemType, bits_per_item, HashFamily, TableType>::AddImpl(
     const size_t i, const uint32_t tag) {
+  assert(!seeded_);
   size_t curindex = i;
   uint32_t curtag = tag;
   uint32_t oldtag;
@@ -207,14 +486,19 @@ Status CuckooFilter<ItemType, bits_per_item, HashFamily, TableType>::AddImpl(
   for (uint32_t count = 0; count < kMaxCuckooCount; count++) {
     bool kickout = count > 0;
     oldtag = 0;
-    if (table_->InsertTagToBucket(curindex, curtag, kickout, oldtag)) {
+    size_t oldindex;
+    if (kickout ? KickTag(table_, curindex, curtag, oldtag, oldindex)
+                : table_->InsertTagToBucket(curindex, curtag, false, oldtag)) {
       num_items_++;
       return Ok;
     }
     if (kickout) {
       curtag = oldtag;
+      curindex = oldindex;
     }
-    curindex = AltIndex(curindex, curtag);
+    // a kicked out tag may carry table state above its bits (EpochTable
+    // hands back its epoch), which only the table reads
+    curindex = TagAltIndex(curindex, curtag & kTagMask);
   }
 
   victim_.index = curindex;
@@ -227,6 +511,9 @@ template <typename ItemType, size_t bits_per_item, typename HashFamily,
           template <size_t> class TableType>
 Status CuckooFilter<ItemType, bits_per_item, HashFamily, TableType>::CopyInsert(
     const uint32_t fp, const size_t index, const size_t slot) {
+  static_assert(
+      TableType<bits_per_item>::SizingTagsPerBucket() == kSeededSlotsPerBucket,
+      "a seeded export needs 4 slots per bucket");
   if (table_->CopyTagToBucket(index, slot, fp)) {
     num_items_++;
     // std::cout << "copied " << fp << " to " << index << "\n";
@@ -244,7 +531,7 @@ Status CuckooFilter<ItemType, bits_per_item, HashFamily, TableType>::Contain(
   uint32_t tag1, tag2;
 
   GenerateTagHashes(key, &i1, &i2, &tag1, &tag2);
-  assert(i1 == AltIndex(i2, key));
+  assert(i1 == OtherIndex(i2, key, tag2));
 
   // std::cout << "lup " << tag1 << ", " << tag2 << ": " << i1 << ", " << i2
   //           << "\n";
@@ -252,7 +539,8 @@ Status CuckooFilter<ItemType, bits_per_item, HashFamily, TableType>::Contain(
   // found = victim_.used && (tag1 == victim_.tag || tag2 == victim_.tag) &&
   //         (i1 == victim_.index || i2 == victim_.index);
 
-  if (table_->FindTagInBuckets(i1, i2, tag1, tag2)) {  // found ||
+  if (table_->FindTagInBuckets(i1, i2, tag1, tag2) ||
+      VictimMatches(i1, i2, tag1, tag2)) {
     return Ok;
   } else { // WARNING: only use for checking false negative's (if not, get spammed D:)
    
@@ -278,24 +566,126 @@ Status CuckooFilter<ItemType, bits_per_item, HashFamily, TableType>::Contain(
     //     std::cout << " ";
 }
 
+template <typename ItemType, size_t bits_per_item, typename HashFamily,
+          template <size_t> class TableType>
+void CuckooFilter<ItemType, bits_per_item, HashFamily, TableType>::ContainSorted(
+    const ItemType *items, const size_t count, Status *results) const {
+  std::vector<SortedQuery> queries, tmp;
+  for (size_t begin = 0; begin < count; begin += kSortedQueryChunk) {
+    const size_t n = std::min(kSortedQueryChunk, count - begin);
+    queries.resize(n);
+    for (size_t k = 0; k < n; k++) {
+      const ItemType &item = items[begin + k];
+      queries[k] = {item, static_cast<uint32_t>(k),
+                    static_cast<uint32_t>(IndexHash(item))};
+    }
+
+    // first probe; the misses are kept, now keyed by their alternate bucket
+    SortByBucket(queries, tmp);
+    size_t misses = 0;
+    for (size_t k = 0; k < n; k++) {
+      SortedQuery q = queries[k];
+      const uint32_t tag = TagHash(hasher_(q.item, seeds_[q.bucket]));
+      if (table_->FindTagInBucket(q.bucket, tag) ||
+          VictimMatches(q.bucket, q.bucket, tag, tag)) {
+        results[begin + q.pos] = Ok;
+      } else {
+        q.bucket = OtherIndex(q.bucket, q.item, tag);
+        queries[misses++] = q;
+      }
+    }
+
+    queries.resize(misses);
+    SortByBucket(queries, tmp);
+    for (const SortedQuery &q : queries) {
+      const uint32_t tag = TagHash(hasher_(q.item, seeds_[q.bucket]));
+      results[begin + q.pos] = table_->FindTagInBucket(q.bucket, tag) ||
+                                       VictimMatches(q.bucket, q.bucket, tag,
+                                                     tag)
+                                   ? Ok
+                                   : NotFound;
+    }
+  }
+}
+
+template <typename ItemType, size_t bits_per_item, typename HashFamily,
+          template <size_t> class TableType>
+void CuckooFilter<ItemType, bits_per_item, HashFamily, TableType>::ContainBatch(
+    const ItemType *items, const size_t count, Status *results) const {
+  // ring[k % kContainBatchDistance] holds the buckets of query k, and its
+  // tag unless the filter is seeded: seeded tags wait for the seeds
+  struct Staged {
+    size_t i1, i2;
+    uint32_t tag;
+  };
+  Staged ring[kContainBatchDistance];
+  auto stage = [this, items, &ring](const size_t k) {
+    Staged &b = ring[k % kContainBatchDistance];
+    b.i1 = IndexHash(items[k]);
+    if (seeded_) {
+      b.i2 = AltIndex(b.i1, items[k]);
+      __builtin_prefetch(&seeds_[b.i1]);
+      __builtin_prefetch(&seeds_[b.i2]);
+    } else {
+      b.tag = TagHash(hasher_(items[k], 0));
+      b.i2 = TagAltIndex(b.i1, b.tag);
+    }
+    table_->PrefetchBucket(b.i1);
+    table_->PrefetchBucket(b.i2);
+  };
+  for (size_t k = 0; k < std::min(count, kContainBatchDistance); k++) {
+    stage(k);
+  }
+  for (size_t k = 0; k < count; k++) {
+    const Staged b = ring[k % kContainBatchDistance];
+    if (k + kContainBatchDistance < count) stage(k + kContainBatchDistance);
+    const uint32_t tag1 =
+        seeded_ ? TagHash(hasher_(items[k], seeds_[b.i1])) : b.tag;
+    const uint32_t tag2 =
+        seeded_ ? TagHash(hasher_(items[k], seeds_[b.i2])) : b.tag;
+    results[k] = table_->FindTagInBuckets(b.i1, b.i2, tag1, tag2) ||
+                         VictimMatches(b.i1, b.i2, tag1, tag2)
+                     ? Ok
+                     : NotFound;
+  }
+}
+
+template <typename ItemType, size_t bits_per_item, typename HashFamily,
+          template <size_t> class TableType>
+Status CuckooFilter<ItemType, bits_per_item, HashFamily, TableType>::ApplyDelta(
+    const std::vector<BucketDelta> &delta) {
+  Status status = Ok;
+  uint32_t oldtag;
+  for (const BucketDelta &d : delta) {
+    for (size_t k = 0; k < d.num_tags; k++) {
+      if (!table_->DeleteTagFromBucket(d.index, d.old_tags[k])) {
+        status = NotFound;
+      }
+    }
+    seeds_[d.index] = d.seed;
+    for (size_t k = 0; k < d.num_tags; k++) {
+      table_->InsertTagToBucket(d.index, d.new_tags[k], false, oldtag);
+    }
+  }
+  return status;
+}
+
 template <typename ItemType, size_t bits_per_item, typename HashFamily,
           template <size_t> class TableType>
 Status CuckooFilter<ItemType, bits_per_item, HashFamily, TableType>::Delete(
     const ItemType &key) {
   size_t i1, i2;
-  uint32_t tag;
+  uint32_t tag1, tag2;
 
-  GenerateIndexTagHash(key, &i1, &tag);
-  i2 = AltIndex(i1, tag);
+  GenerateTagHashes(key, &i1, &i2, &tag1, &tag2);
 
-  if (table_->DeleteTagFromBucket(i1, tag)) {
+  if (table_->DeleteTagFromBucket(i1, tag1)) {
     num_items_--;
     goto TryEliminateVictim;
-  } else if (table_->DeleteTagFromBucket(i2, tag)) {
+  } else if (table_->DeleteTagFromBucket(i2, tag2)) {
     num_items_--;
     goto TryEliminateVictim;
-  } else if (victim_.used && tag == victim_.tag &&
-             (i1 == victim_.index || i2 == victim_.index)) {
+  } else if (VictimMatches(i1, i2, tag1, tag2)) {
     // num_items_--;
     victim_.used = false;
     return Ok;
@@ -0,0 +1,720 @@
+#ifndef CUCKOO_FILTER_DISK_FILTER_H_
+#define CUCKOO_FILTER_DISK_FILTER_H_
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "cuckoofilter.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define CUCKOO_FILTER_IO_URING 1
+#endif
+#endif
+#endif
+
+namespace cuckoofilter {
+
+// the unit a DiskFilter reads: the file holds the table as pages of whole
+// buckets, so a bucket never needs two reads
+const size_t kDiskPageBytes = 4096;
+
+// page reads a DiskFilter keeps in flight by default
+const size_t kDiskQueueDepth = 64;
+
+// DiskFilter::ContainBatch sorts and probes at most this many queries at a
+// time, which bounds its scratch space at 32 bytes per query
+const size_t kDiskBatchChunk = 1 << 20;
+
+// the first page of a DiskFilter file; the seeds follow on the next page,
+// then the table pages
+struct DiskFilterHeader {
+  char magic[8];
+  uint32_t bits_per_item;
+  uint32_t page_bytes;
+  uint64_t num_buckets;
+  uint64_t num_items;
+  uint64_t alt_range;
+  // 1 if the filter was seeded, 0 if its alternate buckets follow from tags
+  uint64_t seeded;
+};
+
+const char kDiskFilterMagic[8] = {'C', 'K', 'F', 'D', 'I', 'S', 'K', '2'};
+
+// reads one page at offset into buf, retrying short reads; false on error or
+// end of file
+inline bool ReadDiskPage(const int fd, const uint64_t offset, char *buf) {
+  size_t done = 0;
+  while (done < kDiskPageBytes) {
+    const ssize_t n =
+        pread(fd, buf + done, kDiskPageBytes - done, offset + done);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    done += n;
+  }
+  return true;
+}
+
+// Reads pages of a file asynchronously. Submit queues a read; Reap starts
+// the queued reads, waits until at least one read has finished and returns
+// up to max finished ones in any order: their cookies, and whether the whole
+// page was read.
+class PageReader {
+ public:
+  virtual ~PageReader() {}
+  virtual void Submit(const uint64_t offset, char *buf,
+                      const size_t cookie) = 0;
+  virtual size_t Reap(size_t *cookies, bool *ok, const size_t max) = 0;
+  virtual std::string Name() const = 0;
+};
+
+// The portable PageReader: a pool of threads blocking in pread, one read
+// each, so as many reads as threads reach the device at once.
+class PreadPageReader : public PageReader {
+  struct Request {
+    uint64_t offset;
+    char *buf;
+    size_t cookie;
+  };
+
+  const int fd_;
+  std::mutex mutex_;
+  std::condition_variable submitted_;
+  std::condition_variable completed_;
+  std::deque<Request> requests_;
+  std::vector<std::pair<size_t, bool>> completions_;
+  bool stop_;
+  std::vector<std::thread> threads_;
+
+  void Work() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+      submitted_.wait(lock, [this] { return stop_ || !requests_.empty(); });
+      if (stop_) return;
+      const Request r = requests_.front();
+      requests_.pop_front();
+      lock.unlock();
+      const bool ok = ReadDiskPage(fd_, r.offset, r.buf);
+      lock.lock();
+      completions_.emplace_back(r.cookie, ok);
+      completed_.notify_one();
+    }
+  }
+
+ public:
+  PreadPageReader(const int fd, const size_t num_threads)
+      : fd_(fd), stop_(false) {
+    for (size_t t = 0; t < num_threads; t++) {
+      threads_.emplace_back(&PreadPageReader::Work, this);
+    }
+  }
+
+  ~PreadPageReader() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    submitted_.notify_all();
+    for (auto &t : threads_) t.join();
+  }
+
+  void Submit(const uint64_t offset, char *buf, const size_t cookie) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      requests_.push_back({offset, buf, cookie});
+    }
+    submitted_.notify_one();
+  }
+
+  size_t Reap(size_t *cookies, bool *ok, const size_t max) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    completed_.wait(lock, [this] { return !completions_.empty(); });
+    const size_t n = std::min(max, completions_.size());
+    for (size_t k = 0; k < n; k++) {
+      cookies[k] = completions_[completions_.size() - 1 - k].first;
+      ok[k] = completions_[completions_.size() - 1 - k].second;
+    }
+    completions_.resize(completions_.size() - n);
+    return n;
+  }
+
+  std::string Name() const {
+    return "pread, " + std::to_string(threads_.size()) + " threads";
+  }
+};
+
+#ifdef CUCKOO_FILTER_IO_URING
+// A PageReader on an io_uring, driven with the raw system calls so there is
+// no liburing dependency: Submit fills a submission queue entry, Reap hands
+// all queued entries to the kernel and waits for completions in the same
+// io_uring_enter call. A single thread keeps every read in flight.
+class UringPageReader : public PageReader {
+  // a read in flight: READV takes its buffer through an iovec, which must
+  // stay put until the read completes
+  struct Slot {
+    struct iovec iov;
+    size_t cookie;
+  };
+
+  const int fd_;
+  int ring_fd_;
+  void *sq_ring_;
+  void *cq_ring_;
+  size_t sq_ring_bytes_;
+  size_t cq_ring_bytes_;
+  struct io_uring_sqe *sqes_;
+  size_t sqes_bytes_;
+  unsigned *sq_head_;
+  unsigned *sq_tail_;
+  unsigned *sq_mask_;
+  unsigned *sq_array_;
+  unsigned *cq_head_;
+  unsigned *cq_tail_;
+  unsigned *cq_mask_;
+  struct io_uring_cqe *cqes_;
+  unsigned to_submit_;
+  std::vector<Slot> slots_;
+  std::vector<size_t> free_slots_;
+  // set once io_uring_enter has failed for good; reads are then failed
+  // rather than queued
+  bool broken_;
+  // slots whose reads failed without reaching the kernel, to be reaped
+  std::vector<size_t> failed_;
+
+  // takes back the entries the kernel has not consumed yet and fails their
+  // reads. Without SQPOLL the kernel only reads the queue in io_uring_enter,
+  // on this thread, so moving the tail back cannot race with it.
+  void Unqueue() {
+    const unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    for (unsigned i = head; i != *sq_tail_; i++) {
+      failed_.push_back(sqes_[sq_array_[i & *sq_mask_]].user_data);
+    }
+    __atomic_store_n(sq_tail_, head, __ATOMIC_RELEASE);
+    to_submit_ = 0;
+  }
+
+  // moves finished reads from the completion queue into cookies and ok
+  size_t Drain(size_t *cookies, bool *ok, const size_t max) {
+    unsigned head = *cq_head_;
+    const unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    size_t n = 0;
+    for (; head != tail && n < max; head++, n++) {
+      const struct io_uring_cqe &cqe = cqes_[head & *cq_mask_];
+      cookies[n] = slots_[cqe.user_data].cookie;
+      ok[n] = cqe.res == static_cast<int>(kDiskPageBytes);
+      free_slots_.push_back(cqe.user_data);
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    return n;
+  }
+
+ public:
+  // Check Ok() after construction: kernels without io_uring, or sandboxes
+  // that forbid it, fail the setup.
+  UringPageReader(const int fd, const size_t entries)
+      : fd_(fd),
+        ring_fd_(-1),
+        sq_ring_(MAP_FAILED),
+        cq_ring_(MAP_FAILED),
+        sqes_(static_cast<struct io_uring_sqe *>(MAP_FAILED)),
+        to_submit_(0),
+        slots_(entries),
+        broken_(false) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    ring_fd_ = syscall(__NR_io_uring_setup, entries, &p);
+    if (ring_fd_ < 0) return;
+    sq_ring_bytes_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_ring_bytes_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+#ifdef IORING_FEAT_SINGLE_MMAP
+    const bool single_mmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+#else
+    const bool single_mmap = false;
+#endif
+    if (single_mmap) {
+      sq_ring_bytes_ = cq_ring_bytes_ =
+          std::max(sq_ring_bytes_, cq_ring_bytes_);
+    }
+    sq_ring_ = mmap(nullptr, sq_ring_bytes_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+    if (sq_ring_ == MAP_FAILED) return;
+    cq_ring_ = single_mmap ? sq_ring_
+                           : mmap(nullptr, cq_ring_bytes_,
+                                  PROT_READ | PROT_WRITE,
+                                  MAP_SHARED | MAP_POPULATE, ring_fd_,
+                                  IORING_OFF_CQ_RING);
+    if (cq_ring_ == MAP_FAILED) return;
+    sqes_bytes_ = p.sq_entries * sizeof(struct io_uring_sqe);
+    sqes_ = static_cast<struct io_uring_sqe *>(
+        mmap(nullptr, sqes_bytes_, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES));
+    char *sq = static_cast<char *>(sq_ring_);
+    char *cq = static_cast<char *>(cq_ring_);
+    sq_head_ = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+    sq_mask_ = reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+    cq_head_ = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+    cq_mask_ = reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<struct io_uring_cqe *>(cq + p.cq_off.cqes);
+    for (size_t s = entries; s > 0; s--) free_slots_.push_back(s - 1);
+  }
+
+  ~UringPageReader() {
+    if (sqes_ != MAP_FAILED) munmap(sqes_, sqes_bytes_);
+    if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_) {
+      munmap(cq_ring_, cq_ring_bytes_);
+    }
+    if (sq_ring_ != MAP_FAILED) munmap(sq_ring_, sq_ring_bytes_);
+    if (ring_fd_ >= 0) close(ring_fd_);
+  }
+
+  bool Ok() const { return ring_fd_ >= 0 && sqes_ != MAP_FAILED; }
+
+  // at most `entries` reads may be in flight
+  void Submit(const uint64_t offset, char *buf, const size_t cookie) {
+    assert(!free_slots_.empty());
+    const size_t s = free_slots_.back();
+    free_slots_.pop_back();
+    slots_[s].iov.iov_base = buf;
+    slots_[s].iov.iov_len = kDiskPageBytes;
+    slots_[s].cookie = cookie;
+    if (broken_) {
+      failed_.push_back(s);
+      return;
+    }
+    // only this thread writes the tail; the kernel reads it at the next
+    // io_uring_enter, after the release store publishes the entry
+    const unsigned tail = *sq_tail_;
+    const unsigned index = tail & *sq_mask_;
+    struct io_uring_sqe *sqe = &sqes_[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = fd_;
+    sqe->off = offset;
+    sqe->addr = reinterpret_cast<uint64_t>(&slots_[s].iov);
+    sqe->len = 1;
+    sqe->user_data = s;
+    sq_array_[index] = index;
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+    to_submit_++;
+  }
+
+  // Once io_uring_enter fails for good, the reads still queued fail at
+  // once, but a read the kernel took may still write into its buffer: it is
+  // only reaped, and its buffer handed back, when its completion arrives.
+  size_t Reap(size_t *cookies, bool *ok, const size_t max) {
+    for (;;) {
+      if (!broken_) {
+        const int r = syscall(__NR_io_uring_enter, ring_fd_, to_submit_, 1,
+                              IORING_ENTER_GETEVENTS, nullptr, 0);
+        if (r >= 0) {
+          to_submit_ -= r;
+        } else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+          broken_ = true;
+          Unqueue();
+        }
+      } else if (failed_.empty() &&
+                 *cq_head_ == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+        // wait for the kernel's reads; a yield also runs the task work
+        // that posts their completions
+        if (syscall(__NR_io_uring_enter, ring_fd_, 0, 1,
+                    IORING_ENTER_GETEVENTS, nullptr, 0) < 0) {
+          sched_yield();
+        }
+      }
+      size_t n = 0;
+      for (; n < max && !failed_.empty(); n++) {
+        const size_t s = failed_.back();
+        failed_.pop_back();
+        cookies[n] = slots_[s].cookie;
+        ok[n] = false;
+        free_slots_.push_back(s);
+      }
+      n += Drain(cookies + n, ok + n, max - n);
+      if (n > 0) return n;
+    }
+  }
+
+  std::string Name() const {
+    return "io_uring, " + std::to_string(slots_.size()) + " entries";
+  }
+};
+#endif  // CUCKOO_FILTER_IO_URING
+
+// The TableType of the index a DiskFilter hashes queries with. It holds no
+// tags, only the geometry of the SingleTable pages in the file, and finds
+// tags in a page read from it.
+template <size_t bits_per_tag>
+class DiskTable {
+  static const size_t kBytesPerBucket =
+      SingleTable<bits_per_tag>::BytesPerBucket();
+
+  size_t num_buckets_;
+
+ public:
+  // SingleTable reads 8-byte words that may run past a bucket
+  static const size_t kBucketsPerPage = (kDiskPageBytes - 8) / kBytesPerBucket;
+
+  static constexpr double SizingTagsPerBucket() {
+    return SingleTable<bits_per_tag>::SizingTagsPerBucket();
+  }
+
+  explicit DiskTable(const size_t num) : num_buckets_(num) {}
+
+  size_t NumBuckets() const { return num_buckets_; }
+
+  size_t NumPages() const {
+    return (num_buckets_ + kBucketsPerPage - 1) / kBucketsPerPage;
+  }
+
+  size_t SizeInBytes() const { return NumPages() * kDiskPageBytes; }
+
+  size_t SizeInTags() const { return 4 * num_buckets_; }
+
+  static size_t Page(const size_t i) { return i / kBucketsPerPage; }
+
+  // whether bucket i, which is on page, holds tag
+  static bool FindTagInPage(const char *page, const size_t i,
+                            const uint32_t tag) {
+    return SingleTable<bits_per_tag>::FindTagAt(
+        page + (i % kBucketsPerPage) * kBytesPerBucket, tag);
+  }
+
+  // lays buckets [first, first + kBucketsPerPage) of table out as page
+  static void WritePage(const SingleTable<bits_per_tag> &table,
+                        const size_t first, char *page) {
+    memset(page, 0, kDiskPageBytes);
+    size_t n = table.NumBuckets() - first;
+    if (n > kBucketsPerPage) n = kBucketsPerPage;
+    memcpy(page, table.BucketBytes(first), n * kBytesPerBucket);
+  }
+
+  std::string Info() const {
+    std::stringstream ss;
+    ss << "DiskTable with tag size: " << bits_per_tag << " bits \n";
+    ss << "\t\tBuckets per " << kDiskPageBytes << "-byte page: "
+       << kBucketsPerPage << "\n";
+    ss << "\t\tTotal # of rows (buckets): " << num_buckets_ << "\n";
+    ss << "\t\tTotal # of pages: " << NumPages() << "\n";
+    return ss.str();
+  }
+};
+
+// A read-only cuckoo filter that stays in a file, for filters larger than
+// memory. Write saves a CuckooFilter with a SingleTable; Open keeps its seeds
+// in memory (2 bytes per bucket) and reads the tags on demand.
+//
+// The file holds no hasher state, so HashFamily must be stateless, like
+// WyHasher or CityHasher: Open hashes with a fresh one, which has to agree
+// with the filter's. A randomly seeded family would not.
+//
+// Looking items up through mmap instead would take a page fault per probe,
+// and a thread waits out each fault before its next probe. ContainBatch
+// instead works out every page the batch needs, reads each of them once
+// however many probes land on it, keeps queue_depth reads in flight through
+// an io_uring (or a pool of pread threads where io_uring is unavailable), and
+// answers queries in whatever order their pages arrive. Its throughput thus
+// follows the device's queue depth rather than its latency.
+//
+//   CuckooFilter<uint64_t, 12, WyHasher<uint64_t>> filter(n);
+//   ... filter.Add(...) ...
+//   DiskFilter<uint64_t, 12>::Write(filter, "/data/revoked.ckf");
+//   auto disk = DiskFilter<uint64_t, 12>::Open("/data/revoked.ckf");
+//   disk->ContainBatch(items, count, results);
+template <typename ItemType, size_t bits_per_item,
+          typename HashFamily = WyHasher<ItemType>>
+class DiskFilter {
+  static_assert(std::is_empty<HashFamily>::value,
+                "DiskFilter does not save hasher state");
+
+  typedef CuckooFilter<ItemType, bits_per_item, HashFamily, DiskTable> Index;
+  typedef DiskTable<bits_per_item> Table;
+
+  // a bucket a query probes
+  struct Probe {
+    uint64_t bucket;
+    uint32_t query;
+    uint32_t tag;
+  };
+
+  int fd_;
+  size_t num_items_;
+  uint64_t pages_offset_;
+  // the seeds and indexing of the filter, with a DiskTable for a table
+  std::unique_ptr<Index> index_;
+  size_t queue_depth_;
+  std::unique_ptr<PageReader> reader_;
+  // queue_depth_ page buffers, aligned for O_DIRECT
+  char *buffers_;
+  // batches share the reader and buffers, so they run one at a time
+  mutable std::mutex batch_mutex_;
+
+  DiskFilter() : fd_(-1), num_items_(0), pages_offset_(0), buffers_(nullptr) {}
+
+  static uint64_t RoundToPage(const uint64_t bytes) {
+    return (bytes + kDiskPageBytes - 1) / kDiskPageBytes * kDiskPageBytes;
+  }
+
+  // probes queries [begin, begin + count); done(k, status) is called once
+  // for each query k as soon as it is answered
+  template <typename Callback>
+  void ContainChunk(const ItemType *items, const size_t begin,
+                    const size_t count, Callback &done) const;
+
+ public:
+  // Writes filter to path. Returns NotSupported if the filter holds a victim,
+  // which the file has no place for (an Add that left one would be lost), and
+  // IOError if the file cannot be written.
+  static Status Write(const CuckooFilter<ItemType, bits_per_item, HashFamily,
+                                         SingleTable> &filter,
+                      const std::string &path) {
+    if (filter.victim_.used) return NotSupported;
+    const size_t num_buckets = filter.table_->NumBuckets();
+    std::vector<char> page(kDiskPageBytes, 0);
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    DiskFilterHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kDiskFilterMagic, sizeof(header.magic));
+    header.bits_per_item = bits_per_item;
+    header.page_bytes = kDiskPageBytes;
+    header.num_buckets = num_buckets;
+    header.num_items = filter.Size();
+    header.alt_range = filter.alt_range_;
+    header.seeded = filter.seeded_;
+    memcpy(page.data(), &header, sizeof(header));
+    out.write(page.data(), kDiskPageBytes);
+    const uint64_t seed_bytes = num_buckets * sizeof(uint16_t);
+    out.write(reinterpret_cast<const char *>(filter.seeds_.data()),
+              seed_bytes);
+    memset(page.data(), 0, kDiskPageBytes);
+    out.write(page.data(), RoundToPage(seed_bytes) - seed_bytes);
+    for (size_t first = 0; first < num_buckets;
+         first += Table::kBucketsPerPage) {
+      Table::WritePage(*filter.table_, first, page.data());
+      out.write(page.data(), kDiskPageBytes);
+    }
+    out.close();
+    return out.fail() ? IOError : Ok;
+  }
+
+  // Opens a file written by Write, or returns nullptr if it cannot be read
+  // or holds a filter of another tag width. Batches keep queue_depth reads
+  // in flight. direct_io opens the file with O_DIRECT, bypassing the page
+  // cache, where the file system supports it. use_io_uring = false, or a
+  // kernel without io_uring, reads with queue_depth pread threads instead.
+  static std::unique_ptr<DiskFilter> Open(
+      const std::string &path, const size_t queue_depth = kDiskQueueDepth,
+      const bool direct_io = false, const bool use_io_uring = true) {
+    std::unique_ptr<DiskFilter> f(new DiskFilter());
+    if (direct_io) f->fd_ = open(path.c_str(), O_RDONLY | O_DIRECT);
+    if (f->fd_ < 0) f->fd_ = open(path.c_str(), O_RDONLY);
+    f->queue_depth_ = std::max<size_t>(1, queue_depth);
+    if (f->fd_ < 0 ||
+        posix_memalign(reinterpret_cast<void **>(&f->buffers_),
+                       kDiskPageBytes,
+                       f->queue_depth_ * kDiskPageBytes) != 0) {
+      return nullptr;
+    }
+    DiskFilterHeader header;
+    if (!ReadDiskPage(f->fd_, 0, f->buffers_)) return nullptr;
+    memcpy(&header, f->buffers_, sizeof(header));
+    if (memcmp(header.magic, kDiskFilterMagic, sizeof(header.magic)) != 0 ||
+        header.bits_per_item != bits_per_item ||
+        header.page_bytes != kDiskPageBytes || header.num_buckets == 0) {
+      return nullptr;
+    }
+    std::vector<uint16_t> seeds(header.num_buckets);
+    const uint64_t seed_bytes = header.num_buckets * sizeof(uint16_t);
+    for (uint64_t done = 0; done < seed_bytes; done += kDiskPageBytes) {
+      if (!ReadDiskPage(f->fd_, kDiskPageBytes + done, f->buffers_)) {
+        return nullptr;
+      }
+      memcpy(reinterpret_cast<char *>(seeds.data()) + done, f->buffers_,
+             std::min<uint64_t>(kDiskPageBytes, seed_bytes - done));
+    }
+    f->num_items_ = header.num_items;
+    f->pages_offset_ = kDiskPageBytes + RoundToPage(seed_bytes);
+    f->index_.reset(new Index(header.num_items, seeds, header.alt_range));
+    f->index_->seeded_ = header.seeded != 0;
+#ifdef CUCKOO_FILTER_IO_URING
+    if (use_io_uring) {
+      UringPageReader *uring = new UringPageReader(f->fd_, f->queue_depth_);
+      f->reader_.reset(uring);
+      if (!uring->Ok()) f->reader_.reset();
+    }
+#endif
+    if (!f->reader_) {
+      f->reader_.reset(new PreadPageReader(f->fd_, f->queue_depth_));
+    }
+    return f;
+  }
+
+  ~DiskFilter() {
+    reader_.reset();
+    free(buffers_);
+    if (fd_ >= 0) close(fd_);
+  }
+
+  // Report if the item is inserted, with false positive rate. Reads the two
+  // pages of the item one after the other; use ContainBatch for many items.
+  // Safe to call from several threads, also during a batch.
+  Status Contain(const ItemType &item) const {
+    size_t i1, i2;
+    uint32_t tag1, tag2;
+    index_->GenerateTagHashes(item, &i1, &i2, &tag1, &tag2);
+    alignas(kDiskPageBytes) char page[kDiskPageBytes];
+    if (!ReadDiskPage(fd_, pages_offset_ + Table::Page(i1) * kDiskPageBytes,
+                      page)) {
+      return IOError;
+    }
+    if (Table::FindTagInPage(page, i1, tag1)) return Ok;
+    if (Table::Page(i2) != Table::Page(i1) &&
+        !ReadDiskPage(fd_, pages_offset_ + Table::Page(i2) * kDiskPageBytes,
+                      page)) {
+      return IOError;
+    }
+    return Table::FindTagInPage(page, i2, tag2) ? Ok : NotFound;
+  }
+
+  // Contain() for a batch: done(k, status) is called once for each items[k],
+  // in the order the answers complete, which is not the order of items. A
+  // query whose page could not be read is answered IOError, unless its other
+  // page holds its tag.
+  template <typename Callback>
+  void ContainAsync(const ItemType *items, const size_t count,
+                    Callback done) const {
+    std::lock_guard<std::mutex> lock(batch_mutex_);
+    for (size_t begin = 0; begin < count; begin += kDiskBatchChunk) {
+      ContainChunk(items, begin, std::min(kDiskBatchChunk, count - begin),
+                   done);
+    }
+  }
+
+  // ContainAsync() into results, where results[k] is the answer for items[k]
+  void ContainBatch(const ItemType *items, const size_t count,
+                    Status *results) const {
+    ContainAsync(items, count, [results](const size_t k, const Status s) {
+      results[k] = s;
+    });
+  }
+
+  size_t Size() const { return num_items_; }
+
+  // size of the table pages in the file, without header and seeds
+  size_t SizeInBytes() const { return index_->table_->SizeInBytes(); }
+
+  std::string Info() const {
+    std::stringstream ss;
+    ss << "DiskFilter Status:\n"
+       << "\t\t" << index_->table_->Info() << "\n"
+       << "\t\tKeys stored: " << Size() << "\n"
+       << "\t\tReads: " << reader_->Name() << "\n"
+       << "\t\tTable pages: " << (SizeInBytes() >> 10) << " KB on disk\n"
+       << "\t\tSeeds: " << (index_->seeds_.size() * sizeof(uint16_t) >> 10)
+       << " KB in memory\n";
+    return ss.str();
+  }
+};
+
+template <typename ItemType, size_t bits_per_item, typename HashFamily>
+template <typename Callback>
+void DiskFilter<ItemType, bits_per_item, HashFamily>::ContainChunk(
+    const ItemType *items, const size_t begin, const size_t count,
+    Callback &done) const {
+  // both probes of every query, grouped by page so each page is read once
+  std::vector<Probe> probes(2 * count);
+  for (size_t k = 0; k < count; k++) {
+    size_t i1, i2;
+    uint32_t tag1, tag2;
+    index_->GenerateTagHashes(items[begin + k], &i1, &i2, &tag1, &tag2);
+    probes[2 * k] = {i1, static_cast<uint32_t>(k), tag1};
+    probes[2 * k + 1] = {i2, static_cast<uint32_t>(k), tag2};
+  }
+  std::sort(probes.begin(), probes.end(), [](const Probe &a, const Probe &b) {
+    return a.bucket < b.bucket;
+  });
+
+  // the probes of query k not answered yet, plus kFailed once a read of one
+  // of its pages failed; 0 once k is answered
+  const uint8_t kFailed = 4;
+  std::vector<uint8_t> pending(count, 2);
+  // in_flight[s] is the range of probes the read into buffer s serves
+  std::vector<std::pair<size_t, size_t>> in_flight(queue_depth_);
+  std::vector<size_t> free_buffers;
+  for (size_t s = queue_depth_; s > 0; s--) free_buffers.push_back(s - 1);
+  std::vector<size_t> cookies(queue_depth_);
+  std::unique_ptr<bool[]> ok(new bool[queue_depth_]);
+
+  size_t next = 0, outstanding = 0;
+  for (;;) {
+    while (!free_buffers.empty() && next < probes.size()) {
+      const size_t page = Table::Page(probes[next].bucket);
+      size_t end = next;
+      bool needed = false;
+      for (; end < probes.size() && Table::Page(probes[end].bucket) == page;
+           end++) {
+        needed |= pending[probes[end].query] != 0;
+      }
+      // skip pages whose queries were all answered by their other page
+      if (needed) {
+        const size_t s = free_buffers.back();
+        free_buffers.pop_back();
+        in_flight[s] = std::make_pair(next, end);
+        reader_->Submit(pages_offset_ + page * kDiskPageBytes,
+                        buffers_ + s * kDiskPageBytes, s);
+        outstanding++;
+      }
+      next = end;
+    }
+    if (outstanding == 0) break;
+    const size_t n = reader_->Reap(cookies.data(), ok.get(), queue_depth_);
+    for (size_t c = 0; c < n; c++) {
+      const size_t s = cookies[c];
+      const char *page = buffers_ + s * kDiskPageBytes;
+      for (size_t p = in_flight[s].first; p < in_flight[s].second; p++) {
+        const Probe &probe = probes[p];
+        uint8_t &state = pending[probe.query];
+        if (state == 0) continue;
+        if (ok[c] && Table::FindTagInPage(page, probe.bucket, probe.tag)) {
+          state = 0;
+          done(begin + probe.query, Ok);
+          continue;
+        }
+        if (!ok[c]) state |= kFailed;
+        if ((--state & ~kFailed) == 0) {
+          done(begin + probe.query, (state & kFailed) ? IOError : NotFound);
+          state = 0;
+        }
+      }
+      free_buffers.push_back(s);
+      outstanding--;
+    }
+  }
+}
+
+}  // namespace cuckoofilter
+#endif  // CUCKOO_FILTER_DISK_FILTER_H_
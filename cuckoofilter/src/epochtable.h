@@ -0,0 +1,239 @@
+#ifndef CUCKOO_FILTER_EPOCH_TABLE_H_
+#define CUCKOO_FILTER_EPOCH_TABLE_H_
+
+#include <assert.h>
+#include <string.h>
+
+#include <iostream>
+#include <sstream>
+
+#include "debug.h"
+#include "printutil.h"
+#include "singletable.h"
+
+namespace cuckoofilter {
+
+// A SingleTable whose slots carry a few extra bits recording the epoch the
+// tag was stored in. The table keeps a window of live epochs
+// [current - window + 1, current]; SetEpoch empties the slots of tags that
+// fall out of it, so aging out entries needs no explicit delete or rebuild.
+//
+// Each slot is laid out as: tag (low bits_per_tag bits) | epoch << bits_per_tag
+//
+// Only the low kEpochBits of an epoch are stored, so a stamp is only
+// unambiguous while it is less than kNumEpochs epochs old. Sweeping on every
+// SetEpoch keeps it so: no tag older than the window stays in the table.
+//
+// A tag kicked out of its slot is handed back with its slot epoch and the
+// kCarried bit set above it, so relocating it keeps its original epoch
+// rather than stamping the current one.
+template <size_t bits_per_tag>
+class EpochTable {
+ public:
+  static const size_t kEpochBits = 4;
+  // epochs are compared modulo 2^kEpochBits
+  static const uint32_t kNumEpochs = 1U << kEpochBits;
+  // marks a tag handed out by a kick as carrying its slot epoch
+  static const uint32_t kCarried = 1U << (bits_per_tag + kEpochBits);
+
+ private:
+  static const size_t kTagsPerBucket = 4;
+  static const uint32_t kTagMask = (1ULL << bits_per_tag) - 1;
+  static const uint32_t kEpochMask = kNumEpochs - 1;
+  static_assert(bits_per_tag + kEpochBits < 32,
+                "a carried tag must fit in 32 bits");
+
+  // storage for the combined (tag, epoch) slots
+  SingleTable<bits_per_tag + kEpochBits> table_;
+
+  // the last epoch passed to SetEpoch, not reduced modulo kNumEpochs
+  uint32_t current_epoch_;
+  uint32_t window_;
+
+  inline uint32_t SlotTag(const uint32_t slot) const { return slot & kTagMask; }
+
+  inline uint32_t SlotEpoch(const uint32_t slot) const {
+    return slot >> bits_per_tag;
+  }
+
+  inline uint32_t MakeSlot(const uint32_t tag) const {
+    return (tag & kTagMask) | ((current_epoch_ & kEpochMask) << bits_per_tag);
+  }
+
+  // epochs since the slot was stamped, assuming it is live at current_epoch_
+  inline uint32_t SlotAge(const uint32_t slot) const {
+    return (current_epoch_ - SlotEpoch(slot)) & kEpochMask;
+  }
+
+  // a slot is live if it holds a tag stamped within the current window
+  inline bool IsLive(const uint32_t slot) const {
+    return SlotTag(slot) != 0 &&
+           SlotAge(slot) < window_;
+  }
+
+ public:
+  // tags per bucket, which CuckooFilter sizes its bucket count by
+  static constexpr double SizingTagsPerBucket() { return kTagsPerBucket; }
+
+  // whether PowerOfTwo sizing may round the bucket count up to a power of two
+  static constexpr bool PowerOfTwoBuckets() { return true; }
+
+  explicit EpochTable(const size_t num)
+      : table_(num), current_epoch_(0), window_(kNumEpochs) {}
+
+  size_t NumBuckets() const { return table_.NumBuckets(); }
+
+  size_t SizeInBytes() const { return table_.SizeInBytes(); }
+
+  size_t SizeInTags() const { return table_.SizeInTags(); }
+
+  void PrefetchBucket(const size_t i) const { table_.PrefetchBucket(i); }
+
+  uint32_t CurrentEpoch() const { return current_epoch_; }
+
+  uint32_t EpochWindow() const { return window_; }
+
+  // Moves the table to the given epoch, which never goes back, and keeps
+  // tags from the last `window` epochs, the current one included. The slots
+  // of tags that fall out of the window are emptied, which takes a scan of
+  // the table unless the epoch stays and the window does not shrink. If
+  // carried points to a tag handed out by a kick and not yet stored again,
+  // it is aged the same way and set to 0 once expired. Returns the number of
+  // slots emptied.
+  size_t SetEpoch(const uint32_t epoch, const uint32_t window,
+                  uint32_t *carried = nullptr) {
+    assert(window >= 1 && window <= kNumEpochs);
+    assert(epoch >= current_epoch_);
+    const uint64_t advance = epoch - current_epoch_;
+    size_t swept = 0;
+    if (advance > 0 || window < window_) {
+      for (size_t i = 0; i < NumBuckets(); i++) {
+        for (size_t j = 0; j < kTagsPerBucket; j++) {
+          const uint32_t slot = table_.ReadTag(i, j);
+          if (slot != 0 && advance + SlotAge(slot) >= window) {
+            table_.WriteTag(i, j, 0);
+            swept++;
+          }
+        }
+      }
+      if (carried != nullptr && (*carried & kCarried) &&
+          advance + SlotAge(*carried & ~kCarried) >= window) {
+        *carried = 0;
+      }
+    }
+    current_epoch_ = epoch;
+    window_ = window;
+    return swept;
+  }
+
+  std::string Info() const {
+    std::stringstream ss;
+    ss << "EpochHashtable with tag size: " << bits_per_tag << " bits";
+    ss << "\t" << kEpochBits << " epoch bits per tag\n";
+    ss << "\t\tAssociativity: " << kTagsPerBucket << "\n";
+    ss << "\t\tTotal # of rows (buckets): " << NumBuckets() << "\n";
+    ss << "\t\tTotal # slots: " << SizeInTags() << "\n";
+    ss << "\t\tCurrent epoch: " << current_epoch_ << ", window: " << window_
+       << "\n";
+    return ss.str();
+  }
+
+  void PrintBucket(const size_t i) const {
+    std::cout << "Bucket " << i << ": [ ";
+    for (size_t j = 0; j < kTagsPerBucket; j++) {
+      if (ReadTag(i, j) != 0)
+        std::cout << ReadTag(i, j) << "@" << SlotEpoch(table_.ReadTag(i, j));
+      else
+        std::cout << " ";
+      if (j < kTagsPerBucket - 1)
+        std::cout << ", ";
+    }
+    std::cout << "]\t";
+  }
+
+  // read tag from pos(i,j), expired tags read as empty
+  inline uint32_t ReadTag(const size_t i, const size_t j) const {
+    const uint32_t slot = table_.ReadTag(i, j);
+    return IsLive(slot) ? SlotTag(slot) : 0;
+  }
+
+  // write tag to pos(i,j), stamped with the current epoch unless it carries
+  // its own from a kick
+  inline void WriteTag(const size_t i, const size_t j, const uint32_t t) {
+    if (t & kCarried) {
+      table_.WriteTag(i, j, t & ~kCarried);
+    } else {
+      table_.WriteTag(i, j, t == 0 ? 0 : MakeSlot(t));
+    }
+  }
+
+  inline bool FindTagInBuckets(const size_t i1, const size_t i2,
+                               const uint32_t tag1, const uint32_t tag2) const {
+    return FindTagInBucket(i1, tag1) || FindTagInBucket(i2, tag2);
+  }
+
+  // the epoch is only checked once the tag itself matches, so a negative
+  // lookup costs the same as in SingleTable
+  inline bool FindTagInBucket(const size_t i, const uint32_t tag) const {
+    for (size_t j = 0; j < kTagsPerBucket; j++) {
+      const uint32_t slot = table_.ReadTag(i, j);
+      if (SlotTag(slot) == tag && IsLive(slot)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  inline bool DeleteTagFromBucket(const size_t i, const uint32_t tag) {
+    for (size_t j = 0; j < kTagsPerBucket; j++) {
+      if (ReadTag(i, j) == tag) {
+        assert(FindTagInBucket(i, tag) == true);
+        WriteTag(i, j, 0);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // a kicked out tag is handed back as its slot with kCarried set, so that
+  // it keeps its epoch when inserted again; callers strip the bits above
+  // bits_per_tag before hashing it
+  inline bool InsertTagToBucket(const size_t i, const uint32_t tag,
+                                const bool kickout, uint32_t &oldtag) {
+    for (size_t j = 0; j < kTagsPerBucket; j++) {
+      if (ReadTag(i, j) == 0) {
+        WriteTag(i, j, tag);
+        return true;
+      }
+    }
+    if (kickout) {
+      size_t r = rand() % kTagsPerBucket;
+      oldtag = table_.ReadTag(i, r) | kCarried;
+      WriteTag(i, r, tag);
+    }
+    return false;
+  }
+
+  // copies tag into specified index and slot in table
+  inline bool CopyTagToBucket(const size_t i, const size_t j,
+                              const uint32_t tag) {
+    if (ReadTag(i, j) == 0) {
+      WriteTag(i, j, tag);
+      return true;
+    }
+    return false;
+  }
+
+  inline size_t NumTagsInBucket(const size_t i) const {
+    size_t num = 0;
+    for (size_t j = 0; j < kTagsPerBucket; j++) {
+      if (ReadTag(i, j) != 0) {
+        num++;
+      }
+    }
+    return num;
+  }
+};
+
+}  // namespace cuckoofilter
+#endif  // CUCKOO_FILTER_EPOCH_TABLE_H_
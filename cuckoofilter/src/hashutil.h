@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 
 #include <string>
@@ -33,6 +34,12 @@ class HashUtil {
   static uint32_t SuperFastHash(const void *buf, size_t len);
   static uint32_t SuperFastHash(const std::string &s);
 
+  // wyhash (final version 4): a 64-bit seeded hash built on 64x64->128 bit
+  // multiplies. Defined inline below so fixed-size keys compile down to a few
+  // multiplies.
+  static inline uint64_t WyHash(const void *buf, size_t length,
+                                uint64_t seed = 0);
+
   // Null hash (shift and mask)
   static uint32_t NullHash(const void *buf, size_t length, uint32_t shiftbytes);
 
@@ -44,6 +51,105 @@ class HashUtil {
   HashUtil();
 };
 
+namespace wyhash {
+
+static const uint64_t kSecret[4] = {0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull,
+                                    0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull};
+
+inline void Mum(uint64_t *a, uint64_t *b) {
+  const unsigned __int128 r = static_cast<unsigned __int128>(*a) * *b;
+  *a = static_cast<uint64_t>(r);
+  *b = static_cast<uint64_t>(r >> 64);
+}
+
+inline uint64_t Mix(uint64_t a, uint64_t b) {
+  Mum(&a, &b);
+  return a ^ b;
+}
+
+inline uint64_t Read8(const uint8_t *p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline uint64_t Read4(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+// 1 to 3 bytes
+inline uint64_t Read3(const uint8_t *p, size_t k) {
+  return (static_cast<uint64_t>(p[0]) << 16) |
+         (static_cast<uint64_t>(p[k >> 1]) << 8) | p[k - 1];
+}
+
+}  // namespace wyhash
+
+inline uint64_t HashUtil::WyHash(const void *buf, size_t length,
+                                 uint64_t seed) {
+  using namespace wyhash;
+  const uint8_t *p = static_cast<const uint8_t *>(buf);
+  seed ^= Mix(seed ^ kSecret[0], kSecret[1]);
+  uint64_t a, b;
+  if (length <= 16) {
+    if (length >= 4) {
+      a = (Read4(p) << 32) | Read4(p + ((length >> 3) << 2));
+      b = (Read4(p + length - 4) << 32) |
+          Read4(p + length - 4 - ((length >> 3) << 2));
+    } else if (length > 0) {
+      a = Read3(p, length);
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    size_t i = length;
+    if (i >= 48) {
+      uint64_t see1 = seed, see2 = seed;
+      do {
+        seed = Mix(Read8(p) ^ kSecret[1], Read8(p + 8) ^ seed);
+        see1 = Mix(Read8(p + 16) ^ kSecret[2], Read8(p + 24) ^ see1);
+        see2 = Mix(Read8(p + 32) ^ kSecret[3], Read8(p + 40) ^ see2);
+        p += 48;
+        i -= 48;
+      } while (i >= 48);
+      seed ^= see1 ^ see2;
+    }
+    while (i > 16) {
+      seed = Mix(Read8(p) ^ kSecret[1], Read8(p + 8) ^ seed);
+      i -= 16;
+      p += 16;
+    }
+    a = Read8(p + i - 16);
+    b = Read8(p + i - 8);
+  }
+  a ^= kSecret[1];
+  b ^= seed;
+  Mum(&a, &b);
+  return Mix(a ^ kSecret[0] ^ length, b ^ kSecret[1]);
+}
+
+// A std::hash-style policy around HashUtil::WyHash taking the per-bucket seed
+// as a second argument, like CityHasher, so it can be plugged into both
+// cuckoo_hashtable and CuckooFilter.
+template <class Key>
+class WyHasher {
+ public:
+  uint64_t operator()(const Key &k, uint64_t seed = 0) const {
+    return HashUtil::WyHash(&k, sizeof(k), seed);
+  }
+};
+
+template <>
+class WyHasher<std::string> {
+ public:
+  uint64_t operator()(const std::string &k, uint64_t seed = 0) const {
+    return HashUtil::WyHash(k.data(), k.size(), seed);
+  }
+};
+
 // See Martin Dietzfelbinger, "Universal hashing and k-wise independent random
 // variables via integer arithmetic without primes".
 class TwoIndependentMultiplyShift {
@@ -0,0 +1,316 @@
+#ifndef CUCKOO_FILTER_MORTON_TABLE_H_
+#define CUCKOO_FILTER_MORTON_TABLE_H_
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <iostream>
+#include <new>
+#include <sstream>
+
+#include "bitsutil.h"
+#include "debug.h"
+#include "printutil.h"
+
+namespace cuckoofilter {
+
+// A table in the style of the Morton filter (Breslow and Jayasena, "Morton
+// Filters: Faster, Space-Efficient Cuckoo Filters via Biasing, Compression,
+// and Decoupled Logical Sparsity"): buckets are logical, and each 64-byte,
+// cache-line aligned block holds kBucketsPerBlock of them in three arrays:
+//
+//   counters  a 2-bit tag count per bucket, so a bucket holds up to 3 tags
+//   overflow  kOverflowBits bits; bit i % kOverflowBits is set once an insert
+//             into bucket i of the block failed, sending a tag elsewhere
+//   tags      kTagsPerBlock densely packed tags, bucket after bucket
+//
+// Empty buckets cost only their counter, so a block has room for about 3/4
+// of a tag per bucket (46 tags for 62 buckets at 8 bits) and the filter asks
+// for buckets accordingly (SizingTagsPerBucket). Since a bucket holds on
+// average under one tag, a lookup compares fewer tags than in a SingleTable,
+// which lowers the false positive rate at the same tag width, or the width
+// at the same rate. A bucket never straddles cache lines. Filled by Add
+// until it fails, 1M keys reach 99.8% of the block capacity: 15.6 bits per
+// key for a 0.03% false positive rate at 12-bit tags, or 13.1 bits for 0.13%
+// at 10-bit tags, where a SingleTable takes 12.5 bits for 0.19%.
+//
+// FindTagInBuckets only probes the second bucket if the first one's overflow
+// bit is set: an item can only have landed in its alternate bucket after an
+// insert into its primary one failed.
+//
+// A MortonTable cannot take a seeded export: the seeds constructor and
+// CopyInsert copy a cuckoo_hashtable bucket by bucket, with 4 slots per
+// bucket, while a bucket here holds at most 3 tags and a block less than one
+// per bucket. Both fail to compile with it, and SeededFilterBuilder, which
+// assumes 4 slots per bucket too, does not build MortonTables.
+template <size_t bits_per_tag>
+class MortonTable {
+  static_assert(bits_per_tag >= 4 && bits_per_tag <= 32,
+                "MortonTable supports 4 to 32 bits per tag");
+  static const size_t kBlockBits = 512;
+  static const size_t kCounterBits = 2;
+  static const size_t kMaxTagsPerBucket = 3;
+  static const size_t kOverflowBits = 16;
+  static const size_t kBucketsPerBlock =
+      4 * (kBlockBits - kOverflowBits) / (4 * kCounterBits + 3 * bits_per_tag);
+  static const size_t kOverflowOffset = kCounterBits * kBucketsPerBlock;
+  static const size_t kTagsOffset = kOverflowOffset + kOverflowBits;
+  static const size_t kTagsPerBlock = (kBlockBits - kTagsOffset) / bits_per_tag;
+  static const uint32_t kTagMask = (1ULL << bits_per_tag) - 1;
+  // tag widths clamped to the lane size, so the unused branch still compiles
+  static const size_t kLaneBits16 = bits_per_tag < 16 ? bits_per_tag : 16;
+
+  struct Block {
+    char bits_[kBlockBits / 8];
+  };
+
+  // one more block, as fields are read with 8-byte loads
+  Block *blocks_;
+  size_t num_buckets_;
+  size_t num_blocks_;
+
+  // up to 57 bits of block b from bit offset
+  inline uint64_t Load(const size_t b, const size_t offset) const {
+    uint64_t v;
+    memcpy(&v, blocks_[b].bits_ + (offset >> 3), sizeof(v));
+    return v >> (offset & 7);
+  }
+
+  inline void Store(const size_t b, const size_t offset, const size_t bits,
+                    const uint64_t value) {
+    char *p = blocks_[b].bits_ + (offset >> 3);
+    const size_t shift = offset & 7;
+    const uint64_t mask = ((1ULL << bits) - 1) << shift;
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    v = (v & ~mask) | ((value << shift) & mask);
+    memcpy(p, &v, sizeof(v));
+  }
+
+  inline size_t Count(const size_t b, const size_t k) const {
+    return Load(b, k * kCounterBits) & 3;
+  }
+
+  // the number of tags in buckets [0, k) of block b: the sum of their 2-bit
+  // counters, a popcount of the counter words plus one of their high bits
+  inline size_t TagsBefore(const size_t b, const size_t k) const {
+    const size_t bits = k * kCounterBits;
+    size_t sum = 0;
+    for (size_t w = 0; w * 64 < bits; w++) {
+      uint64_t v;
+      memcpy(&v, blocks_[b].bits_ + w * 8, sizeof(v));
+      if (bits - w * 64 < 64) v &= (1ULL << (bits - w * 64)) - 1;
+      sum += __builtin_popcountll(v) +
+             __builtin_popcountll(v & 0xaaaaaaaaaaaaaaaaULL);
+    }
+    return sum;
+  }
+
+  inline uint32_t Tag(const size_t b, const size_t pos) const {
+    return Load(b, kTagsOffset + pos * bits_per_tag) & kTagMask;
+  }
+
+  inline void SetTag(const size_t b, const size_t pos, const uint32_t tag) {
+    Store(b, kTagsOffset + pos * bits_per_tag, bits_per_tag, tag);
+  }
+
+  inline bool Overflowed(const size_t b, const size_t k) const {
+    return (Load(b, kOverflowOffset + k % kOverflowBits) & 1) != 0;
+  }
+
+  inline void SetOverflow(const size_t b, const size_t k) {
+    Store(b, kOverflowOffset + k % kOverflowBits, 1, 1);
+  }
+
+  // stores tag as the last one of bucket k, moving the tags of the later
+  // buckets of the block up a slot; the block must have room
+  void InsertTag(const size_t b, const size_t k, const uint32_t tag) {
+    const size_t count = Count(b, k);
+    const size_t pos = TagsBefore(b, k) + count;
+    const size_t total = TagsBefore(b, kBucketsPerBlock);
+    for (size_t p = total; p > pos; p--) SetTag(b, p, Tag(b, p - 1));
+    SetTag(b, pos, tag);
+    Store(b, k * kCounterBits, kCounterBits, count + 1);
+  }
+
+  // the bucket of block b holding the tag at position pos
+  size_t BucketOfTag(const size_t b, const size_t pos) const {
+    size_t k = 0;
+    for (size_t before = Count(b, 0); before <= pos; before += Count(b, ++k))
+      ;
+    return k;
+  }
+
+  // removes the tag at position pos of the block, which is in bucket k
+  void EraseTag(const size_t b, const size_t k, const size_t pos) {
+    const size_t total = TagsBefore(b, kBucketsPerBlock);
+    for (size_t p = pos; p + 1 < total; p++) SetTag(b, p, Tag(b, p + 1));
+    SetTag(b, total - 1, 0);
+    Store(b, k * kCounterBits, kCounterBits, Count(b, k) - 1);
+  }
+
+ public:
+  // buckets hold about kTagsPerBlock / kBucketsPerBlock tags when the blocks
+  // are full; CuckooFilter sizes its bucket count by this
+  static constexpr double SizingTagsPerBucket() {
+    return static_cast<double>(kTagsPerBlock) / kBucketsPerBlock;
+  }
+
+  // blocks hold a number of buckets that is not a power of two, so rounding
+  // the bucket count up to one buys no cheaper indexing within a block, and
+  // at up to twice the blocks would cost about 25 bits per item at 12-bit
+  // tags; the blocks are always sized to fit
+  static constexpr bool PowerOfTwoBuckets() { return false; }
+
+  explicit MortonTable(const size_t num)
+      : num_buckets_(num),
+        num_blocks_((num + kBucketsPerBlock - 1) / kBucketsPerBlock) {
+    const size_t bytes = (num_blocks_ + 1) * sizeof(Block);
+    if (posix_memalign(reinterpret_cast<void **>(&blocks_), sizeof(Block),
+                       bytes) != 0) {
+      throw std::bad_alloc();
+    }
+    memset(blocks_, 0, bytes);
+  }
+
+  ~MortonTable() { free(blocks_); }
+
+  size_t NumBuckets() const { return num_buckets_; }
+
+  size_t SizeInBytes() const { return sizeof(Block) * num_blocks_; }
+
+  size_t SizeInTags() const { return kTagsPerBlock * num_blocks_; }
+
+  void PrefetchBucket(const size_t i) const {
+    __builtin_prefetch(&blocks_[i / kBucketsPerBlock]);
+  }
+
+  std::string Info() const {
+    std::stringstream ss;
+    ss << "MortonTable with tag size: " << bits_per_tag << " bits \n";
+    ss << "\t\tBuckets per block: " << kBucketsPerBlock << " of up to "
+       << kMaxTagsPerBucket << " tags\n";
+    ss << "\t\tTags per block: " << kTagsPerBlock << "\n";
+    ss << "\t\tTotal # of rows (buckets): " << num_buckets_ << "\n";
+    ss << "\t\tTotal # slots: " << SizeInTags() << "\n";
+    return ss.str();
+  }
+
+  void PrintBucket(const size_t i) const {
+    const size_t b = i / kBucketsPerBlock, k = i % kBucketsPerBlock;
+    const size_t pos = TagsBefore(b, k);
+    std::cout << "Bucket " << i << ": [ ";
+    for (size_t j = 0; j < Count(b, k); j++) {
+      std::cout << Tag(b, pos + j) << (j + 1 < Count(b, k) ? ", " : " ");
+    }
+    std::cout << "]\t";
+  }
+
+  inline bool FindTagInBuckets(const size_t i1, const size_t i2,
+                               const uint32_t tag1, const uint32_t tag2) const {
+    if (FindTagInBucket(i1, tag1)) return true;
+    return Overflowed(i1 / kBucketsPerBlock, i1 % kBucketsPerBlock) &&
+           FindTagInBucket(i2, tag2);
+  }
+
+  inline bool FindTagInBucket(const size_t i, const uint32_t tag) const {
+    const size_t b = i / kBucketsPerBlock, k = i % kBucketsPerBlock;
+    const size_t count = Count(b, k);
+    if (count == 0) return false;
+    const size_t offset = kTagsOffset + TagsBefore(b, k) * bits_per_tag;
+    if (bits_per_tag <= 16) {
+      // the bucket's tags in one load, compared in 16-bit lanes at once
+      const uint64_t v =
+          spreadfields<kLaneBits16, 16, kMaxTagsPerBucket>(Load(b, offset));
+      const uint64_t lanes = (1ULL << (16 * count)) - 1;
+      return (hasvalue16(v, tag) & lanes) != 0;
+    }
+    for (size_t j = 0; j < count; j++) {
+      if (((Load(b, offset + j * bits_per_tag)) & kTagMask) == tag) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  inline bool DeleteTagFromBucket(const size_t i, const uint32_t tag) {
+    const size_t b = i / kBucketsPerBlock, k = i % kBucketsPerBlock;
+    const size_t pos = TagsBefore(b, k);
+    for (size_t j = 0; j < Count(b, k); j++) {
+      if (Tag(b, pos + j) == tag) {
+        EraseTag(b, k, pos + j);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Inserts tag into bucket i if the bucket has a free slot and its block a
+  // free tag. Otherwise, with kickout, a random tag of the bucket is replaced
+  // and returned in oldtag; an empty bucket in a full block has none, so tag
+  // itself comes back. CuckooFilter kicks with KickTagToBucket instead.
+  inline bool InsertTagToBucket(const size_t i, const uint32_t tag,
+                                const bool kickout, uint32_t &oldtag) {
+    const size_t b = i / kBucketsPerBlock, k = i % kBucketsPerBlock;
+    const size_t count = Count(b, k);
+    if (count < kMaxTagsPerBucket &&
+        TagsBefore(b, kBucketsPerBlock) < kTagsPerBlock) {
+      InsertTag(b, k, tag);
+      return true;
+    }
+    SetOverflow(b, k);
+    if (kickout) {
+      if (count == 0) {
+        oldtag = tag;
+      } else {
+        const size_t pos = TagsBefore(b, k) + rand() % count;
+        oldtag = Tag(b, pos);
+        SetTag(b, pos, tag);
+      }
+    }
+    return false;
+  }
+
+  // Inserts tag into bucket i like InsertTagToBucket. If there is no room,
+  // it kicks out another tag, which comes back in oldtag with its bucket in
+  // oldindex, and returns false. A full bucket
+  // gives up one of its own tags; a bucket with a free slot in a full block
+  // makes room by kicking a random tag of the block, as in the Morton
+  // filter. An empty bucket in a full block thus still moves a tag on,
+  // rather than handing tag back to bounce between its two buckets. The
+  // kicked tag's bucket is flagged as overflowed, as the tag may now go to
+  // its alternate bucket.
+  inline bool KickTagToBucket(const size_t i, const uint32_t tag,
+                              uint32_t &oldtag, size_t &oldindex) {
+    const size_t b = i / kBucketsPerBlock, k = i % kBucketsPerBlock;
+    const size_t count = Count(b, k);
+    const size_t total = TagsBefore(b, kBucketsPerBlock);
+    if (count < kMaxTagsPerBucket && total < kTagsPerBlock) {
+      InsertTag(b, k, tag);
+      return true;
+    }
+    if (count == kMaxTagsPerBucket) {
+      const size_t pos = TagsBefore(b, k) + rand() % count;
+      oldtag = Tag(b, pos);
+      SetTag(b, pos, tag);
+      oldindex = i;
+    } else {
+      const size_t pos = rand() % total;
+      const size_t victim = BucketOfTag(b, pos);
+      oldtag = Tag(b, pos);
+      EraseTag(b, victim, pos);
+      InsertTag(b, k, tag);
+      oldindex = b * kBucketsPerBlock + victim;
+    }
+    SetOverflow(b, oldindex % kBucketsPerBlock);
+    return false;
+  }
+
+  inline size_t NumTagsInBucket(const size_t i) const {
+    return Count(i / kBucketsPerBlock, i % kBucketsPerBlock);
+  }
+};
+
+}  // namespace cuckoofilter
+#endif  // CUCKOO_FILTER_MORTON_TABLE_H_
@@ -0,0 +1,120 @@
+#ifndef CUCKOO_FILTER_NUMA_TOPOLOGY_H_
+#define CUCKOO_FILTER_NUMA_TOPOLOGY_H_
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <thread>
+#include <vector>
+
+namespace cuckoofilter {
+
+// The NUMA nodes of this host and their CPUs, read from sysfs so that no
+// libnuma is needed. Nodes are numbered densely from 0 here; NodeId maps
+// them back to the kernel's ids, which may have gaps (node0, node2, ...). A
+// host without the sysfs node directory is treated as a single node holding
+// every CPU.
+class NumaTopology {
+ public:
+  static const std::vector<std::vector<int>> &NodeCpus() {
+    return Get().cpus;
+  }
+
+  static size_t NumNodes() { return NodeCpus().size(); }
+
+  // the kernel's id of node
+  static int NodeId(const size_t node) { return Get().ids[node]; }
+
+  // the node of the CPU the calling thread is running on
+  static size_t CurrentNode() {
+    unsigned cpu = 0, id = 0;
+    const Topology &topology = Get();
+    if (syscall(SYS_getcpu, &cpu, &id, nullptr) != 0 ||
+        id >= topology.index_of.size() || topology.index_of[id] < 0) {
+      return 0;
+    }
+    return topology.index_of[id];
+  }
+
+  // Restricts the calling thread to the CPUs of node that its current
+  // affinity (taskset, cgroup cpusets) already allows. Returns false, leaving
+  // the affinity as it was, if the two do not overlap or the call fails.
+  static bool PinToNode(const size_t node) {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (const int cpu : NodeCpus()[node]) {
+      if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) CPU_SET(cpu, &set);
+    }
+    if (CPU_COUNT(&set) == 0) return false;
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+  }
+
+ private:
+  NumaTopology();
+
+  struct Topology {
+    // kernel id and CPUs of each node
+    std::vector<int> ids;
+    std::vector<std::vector<int>> cpus;
+    // node of each kernel id, -1 for ids not online
+    std::vector<int> index_of;
+  };
+
+  static const Topology &Get() {
+    static const Topology topology = ReadTopology();
+    return topology;
+  }
+
+  // parses a sysfs cpulist such as "0-3,8-11"; node lists use the same format
+  static std::vector<int> ParseCpuList(FILE *f) {
+    std::vector<int> cpus;
+    int lo, hi;
+    while (fscanf(f, "%d", &lo) == 1) {
+      hi = lo;
+      if (fscanf(f, "-%d", &hi) != 1) hi = lo;
+      for (int c = lo; c <= hi; c++) cpus.push_back(c);
+      if (fgetc(f) != ',') break;
+    }
+    return cpus;
+  }
+
+  static Topology ReadTopology() {
+    Topology result;
+    std::vector<int> online;
+    if (FILE *f = fopen("/sys/devices/system/node/online", "r")) {
+      online = ParseCpuList(f);
+      fclose(f);
+    }
+    for (const int id : online) {
+      char path[64];
+      snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+               id);
+      FILE *f = fopen(path, "r");
+      if (f == nullptr) continue;
+      result.ids.push_back(id);
+      result.cpus.push_back(ParseCpuList(f));
+      fclose(f);
+    }
+    if (result.ids.empty()) {
+      result.ids.push_back(0);
+      result.cpus.emplace_back();
+      const int n = std::thread::hardware_concurrency();
+      for (int c = 0; c < n; c++) result.cpus.back().push_back(c);
+    }
+    for (size_t node = 0; node < result.ids.size(); node++) {
+      if (result.index_of.size() <= size_t(result.ids[node])) {
+        result.index_of.resize(result.ids[node] + 1, -1);
+      }
+      result.index_of[result.ids[node]] = node;
+    }
+    return result;
+  }
+};
+
+}  // namespace cuckoofilter
+#endif  // CUCKOO_FILTER_NUMA_TOPOLOGY_H_
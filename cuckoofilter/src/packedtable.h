@@ -4,6 +4,10 @@
 #include <sstream>
 #include <utility>
 
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
 #include "debug.h"
 #include "permencoding.h"
 #include "printutil.h"
@@ -22,9 +26,14 @@ class PackedTable {
   size_t len_;
   size_t num_buckets_;
   char *buckets_;
-  PermEncoding perm_;
 
  public:
+  // tags per bucket, which CuckooFilter sizes its bucket count by
+  static constexpr double SizingTagsPerBucket() { return 4; }
+
+  // whether PowerOfTwo sizing may round the bucket count up to a power of two
+  static constexpr bool PowerOfTwoBuckets() { return true; }
+
   explicit PackedTable(size_t num) : num_buckets_(num) {
     // NOTE(binfan): use 7 extra bytes to avoid overrun as we
     // always read a uint64
@@ -45,6 +54,10 @@ class PackedTable {
     return 4 * num_buckets_; 
   }
 
+  void PrefetchBucket(const size_t i) const {
+    __builtin_prefetch(buckets_ + kBytesPerBucket * i);
+  }
+
   size_t SizeInBytes() const { 
     return len_; 
   }
@@ -82,7 +95,7 @@ class PackedTable {
       lowbits[j] = tags[j] & 0x0f;
       dirbits[j] = (tags[j] & kDirBitsMask) >> 4;
     }
-    uint16_t codeword = perm_.encode(lowbits);
+    uint16_t codeword = PermEncoding::encode(lowbits);
     std::cout << "\tcodeword  ="
               << PrintUtil::bytes_to_hex((char *)&codeword, 2) << std::endl;
     for (size_t j = 0; j < 4; j++) {
@@ -112,6 +125,13 @@ class PackedTable {
     SortPair(tags[1], tags[2]);
   }
 
+  // loads the bits of bucket i, shifted so that the codeword is in the low
+  // 12 bits, followed by the dir bits of tag 0, 1, 2 and 3
+  inline uint64_t LoadBucket(const size_t i) const {
+    const size_t pos = kBitsPerBucket * i;
+    return *((uint64_t *)(buckets_ + (pos >> 3))) >> (pos & 7);
+  }
+
   /* read and decode the bucket i, pass the 4 decoded tags to the 2nd arg
    * bucket bits = 12 codeword bits + dir bits of tag1 + dir bits of tag2 ...
    */
@@ -119,86 +139,14 @@ class PackedTable {
     DPRINTF(DEBUG_TABLE, "PackedTable::ReadBucket %zu \n", i);
     DPRINTF(DEBUG_TABLE, "kdirbitsMask=%x\n", kDirBitsMask);
 
-    const char *p;  // =  buckets_ + ((kBitsPerBucket * i) >> 3);
-    uint16_t codeword;
-    uint8_t lowbits[4];
-
-    if (bits_per_tag == 5) {
-      // 1 dirbits per tag, 16 bits per bucket
-      p = buckets_ + (i * 2);
-      uint16_t bucketbits = *((uint16_t *)p);
-      codeword = bucketbits & 0x0fff;
-      tags[0] = ((bucketbits >> 8) & kDirBitsMask);
-      tags[1] = ((bucketbits >> 9) & kDirBitsMask);
-      tags[2] = ((bucketbits >> 10) & kDirBitsMask);
-      tags[3] = ((bucketbits >> 11) & kDirBitsMask);
-    } else if (bits_per_tag == 6) {
-      // 2 dirbits per tag, 20 bits per bucket
-      p = buckets_ + ((20 * i) >> 3);
-      uint32_t bucketbits = *((uint32_t *)p);
-      codeword = (*((uint16_t *)p) >> ((i & 1) << 2)) & 0x0fff;
-      tags[0] = (bucketbits >> (8 + ((i & 1) << 2))) & kDirBitsMask;
-      tags[1] = (bucketbits >> (10 + ((i & 1) << 2))) & kDirBitsMask;
-      tags[2] = (bucketbits >> (12 + ((i & 1) << 2))) & kDirBitsMask;
-      tags[3] = (bucketbits >> (14 + ((i & 1) << 2))) & kDirBitsMask;
-    } else if (bits_per_tag == 7) {
-      // 3 dirbits per tag, 24 bits per bucket
-      p = buckets_ + (i << 1) + i;
-      uint32_t bucketbits = *((uint32_t *)p);
-      codeword = *((uint16_t *)p) & 0x0fff;
-      tags[0] = (bucketbits >> 8) & kDirBitsMask;
-      tags[1] = (bucketbits >> 11) & kDirBitsMask;
-      tags[2] = (bucketbits >> 14) & kDirBitsMask;
-      tags[3] = (bucketbits >> 17) & kDirBitsMask;
-    } else if (bits_per_tag == 8) {
-      // 4 dirbits per tag, 28 bits per bucket
-      p = buckets_ + ((28 * i) >> 3);
-      uint32_t bucketbits = *((uint32_t *)p);
-      codeword = (*((uint16_t *)p) >> ((i & 1) << 2)) & 0x0fff;
-      tags[0] = (bucketbits >> (8 + ((i & 1) << 2))) & kDirBitsMask;
-      tags[1] = (bucketbits >> (12 + ((i & 1) << 2))) & kDirBitsMask;
-      tags[2] = (bucketbits >> (16 + ((i & 1) << 2))) & kDirBitsMask;
-      tags[3] = (bucketbits >> (20 + ((i & 1) << 2))) & kDirBitsMask;
-    } else if (bits_per_tag == 9) {
-      // 5 dirbits per tag, 32 bits per bucket
-      p = buckets_ + (i * 4);
-      uint32_t bucketbits = *((uint32_t *)p);
-      codeword = *((uint16_t *)p) & 0x0fff;
-      tags[0] = (bucketbits >> 8) & kDirBitsMask;
-      tags[1] = (bucketbits >> 13) & kDirBitsMask;
-      tags[2] = (bucketbits >> 18) & kDirBitsMask;
-      tags[3] = (bucketbits >> 23) & kDirBitsMask;
-    } else if (bits_per_tag == 13) {
-      // 9 dirbits per tag,  48 bits per bucket
-      p = buckets_ + (i * 6);
-      uint64_t bucketbits = *((uint64_t *)p);
-      codeword = *((uint16_t *)p) & 0x0fff;
-      tags[0] = (bucketbits >> 8) & kDirBitsMask;
-      tags[1] = (bucketbits >> 17) & kDirBitsMask;
-      tags[2] = (bucketbits >> 26) & kDirBitsMask;
-      tags[3] = (bucketbits >> 35) & kDirBitsMask;
-    } else if (bits_per_tag == 17) {
-      // 13 dirbits per tag, 64 bits per bucket
-      p = buckets_ + (i << 3);
-      uint64_t bucketbits = *((uint64_t *)p);
-      codeword = *((uint16_t *)p) & 0x0fff;
-      tags[0] = (bucketbits >> 8) & kDirBitsMask;
-      tags[1] = (bucketbits >> 21) & kDirBitsMask;
-      tags[2] = (bucketbits >> 34) & kDirBitsMask;
-      tags[3] = (bucketbits >> 47) & kDirBitsMask;
-    }
+    const uint64_t bucketbits = LoadBucket(i);
 
     /* codeword is the lowest 12 bits in the bucket */
-    uint16_t v = perm_.dec_table[codeword];
-    lowbits[0] = (v & 0x000f);
-    lowbits[2] = ((v >> 4) & 0x000f);
-    lowbits[1] = ((v >> 8) & 0x000f);
-    lowbits[3] = ((v >> 12) & 0x000f);
-
-    tags[0] |= lowbits[0];
-    tags[1] |= lowbits[1];
-    tags[2] |= lowbits[2];
-    tags[3] |= lowbits[3];
+    const uint16_t v = PermEncoding::dec_table(bucketbits & 0x0fff);
+    for (size_t j = 0; j < 4; j++) {
+      tags[j] = ((bucketbits >> (8 + j * kDirBitsPerTag)) & kDirBitsMask) |
+                ((v >> (j << 2)) & 0x000f);
+    }
 
     if (debug_level & DEBUG_TABLE) {
       PrintTags(tags);
@@ -237,7 +185,7 @@ class PackedTable {
 
     // note that :  tags[j] = lowbits[j] | highbits[j]
 
-    uint16_t codeword = perm_.encode(lowbits);
+    uint16_t codeword = PermEncoding::encode(lowbits);
     DPRINTF(DEBUG_TABLE, "codeword=%s\n",
             PrintUtil::bytes_to_hex((char *)&codeword, 2).c_str());
 
@@ -307,47 +255,51 @@ class PackedTable {
     DPRINTF(DEBUG_TABLE, "PackedTable::WriteBucket done\n");
   }
 
-  bool FindTagInBuckets(const size_t i1, const size_t i2,
-                        const uint32_t tag) const {
-    //            DPRINTF(DEBUG_TABLE, "PackedTable::FindTagInBucket %zu\n", i);
+#ifdef __AVX2__
+  // decodes the 4 tags of bucket i into 64-bit lanes and compares all of them
+  // against tag at once
+  inline __m256i MatchBucket(const size_t i, const uint32_t tag) const {
+    const uint64_t bucketbits = LoadBucket(i);
+    const __m256i dirshift =
+        _mm256_setr_epi64x(8, 8 + kDirBitsPerTag, 8 + 2 * kDirBitsPerTag,
+                           8 + 3 * kDirBitsPerTag);
+    const __m256i lowshift = _mm256_setr_epi64x(0, 4, 8, 12);
+    const __m256i dir =
+        _mm256_and_si256(_mm256_srlv_epi64(_mm256_set1_epi64x(bucketbits),
+                                           dirshift),
+                         _mm256_set1_epi64x(kDirBitsMask));
+    const __m256i low = _mm256_and_si256(
+        _mm256_srlv_epi64(
+            _mm256_set1_epi64x(PermEncoding::dec_table(bucketbits & 0x0fff)),
+            lowshift),
+        _mm256_set1_epi64x(0x0f));
+    return _mm256_cmpeq_epi64(_mm256_or_si256(dir, low),
+                              _mm256_set1_epi64x(tag));
+  }
+#endif
+
+  // decodes both candidate buckets together and compares their 8 tags
+  // against the tag of each bucket, without branching on bits_per_tag
+  bool FindTagInBuckets(const size_t i1, const size_t i2, const uint32_t tag1,
+                        const uint32_t tag2) const {
+#ifdef __AVX2__
+    const __m256i m =
+        _mm256_or_si256(MatchBucket(i1, tag1), MatchBucket(i2, tag2));
+    return !_mm256_testz_si256(m, m);
+#else
     uint32_t tags1[4];
     uint32_t tags2[4];
+    ReadBucket(i1, tags1);
+    ReadBucket(i2, tags2);
+    return (tags1[0] == tag1) || (tags1[1] == tag1) || (tags1[2] == tag1) ||
+           (tags1[3] == tag1) || (tags2[0] == tag2) || (tags2[1] == tag2) ||
+           (tags2[2] == tag2) || (tags2[3] == tag2);
+#endif
+  }
 
-    // disable for now
-    // _mm_prefetch( buckets_ + (i1 * kBitsPerBucket) / 8,  _MM_HINT_NTA);
-    // _mm_prefetch( buckets_ + (i2 * kBitsPerBucket) / 8,  _MM_HINT_NTA);
-
-    // ReadBucket(i1, tags1);
-    // ReadBucket(i2, tags2);
-
-    uint16_t v;
-    uint64_t bucketbits1 = *((uint64_t *)(buckets_ + kBitsPerBucket * i1 / 8));
-    uint64_t bucketbits2 = *((uint64_t *)(buckets_ + kBitsPerBucket * i2 / 8));
-
-    tags1[0] = (bucketbits1 >> 8) & kDirBitsMask;
-    tags1[1] = (bucketbits1 >> 17) & kDirBitsMask;
-    tags1[2] = (bucketbits1 >> 26) & kDirBitsMask;
-    tags1[3] = (bucketbits1 >> 35) & kDirBitsMask;
-    v = perm_.dec_table[(bucketbits1)&0x0fff];
-    // the order 0 2 1 3 is not a bug
-    tags1[0] |= (v & 0x000f);
-    tags1[2] |= ((v >> 4) & 0x000f);
-    tags1[1] |= ((v >> 8) & 0x000f);
-    tags1[3] |= ((v >> 12) & 0x000f);
-
-    tags2[0] = (bucketbits2 >> 8) & kDirBitsMask;
-    tags2[1] = (bucketbits2 >> 17) & kDirBitsMask;
-    tags2[2] = (bucketbits2 >> 26) & kDirBitsMask;
-    tags2[3] = (bucketbits2 >> 35) & kDirBitsMask;
-    v = perm_.dec_table[(bucketbits2)&0x0fff];
-    tags2[0] |= (v & 0x000f);
-    tags2[2] |= ((v >> 4) & 0x000f);
-    tags2[1] |= ((v >> 8) & 0x000f);
-    tags2[3] |= ((v >> 12) & 0x000f);
-
-    return (tags1[0] == tag) || (tags1[1] == tag) || (tags1[2] == tag) ||
-           (tags1[3] == tag) || (tags2[0] == tag) || (tags2[1] == tag) ||
-           (tags2[2] == tag) || (tags2[3] == tag);
+  bool FindTagInBuckets(const size_t i1, const size_t i2,
+                        const uint32_t tag) const {
+    return FindTagInBuckets(i1, i2, tag, tag);
   }
 
   bool FindTagInBucket(const size_t i, const uint32_t tag) const {
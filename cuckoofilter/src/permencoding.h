@@ -12,76 +12,155 @@
 
 namespace cuckoofilter {
 
-class PermEncoding {
-  /* unpack one 2-byte number to four 4-bit numbers */
-  // inline void unpack(const uint16_t in, const uint8_t out[4]) const {
-  //     (*(uint16_t *)out)      = in & 0x0f0f;
-  //     (*(uint16_t *)(out +2)) = (in >> 4) & 0x0f0f;
-  // }
-
-  inline void unpack(uint16_t in, uint8_t out[4]) const {
-    out[0] = (in & 0x000f);
-    out[2] = ((in >> 4) & 0x000f);
-    out[1] = ((in >> 8) & 0x000f);
-    out[3] = ((in >> 12) & 0x000f);
-  }
+// Compile-time helpers for the permutation tables. A bucket of 4 tags stores
+// the 4 low bits of each tag as the rank (the codeword, < 3876) of the sorted
+// sequence of 4 nibbles among all non-decreasing sequences of 4 nibbles, in
+// lexicographic order.
+namespace permencoding {
 
-  /* pack four 4-bit numbers to one 2-byte number */
-  inline uint16_t pack(const uint8_t in[4]) const {
-    uint16_t in1 = *((uint16_t *)(in)) & 0x0f0f;
-    uint16_t in2 = *((uint16_t *)(in + 2)) << 4;
-    return in1 | in2;
-  }
+template <size_t... Is>
+struct IndexSeq {};
 
- public:
-  PermEncoding() {
-    uint8_t dst[4];
-    uint16_t idx = 0;
-    memset(dec_table, 0, sizeof(dec_table));
-    memset(enc_table, 0, sizeof(enc_table));
-    gen_tables(0, 0, dst, idx);
-  }
+template <class A, class B>
+struct ConcatSeq;
+
+template <size_t... A, size_t... B>
+struct ConcatSeq<IndexSeq<A...>, IndexSeq<B...>> {
+  using type = IndexSeq<A..., (sizeof...(A) + B)...>;
+};
+
+// IndexSeq<0, ..., N - 1>, built with logarithmic template depth
+template <size_t N>
+struct MakeIndexSeq {
+  using type = typename ConcatSeq<typename MakeIndexSeq<N / 2>::type,
+                                  typename MakeIndexSeq<N - N / 2>::type>::type;
+};
+
+template <>
+struct MakeIndexSeq<0> {
+  using type = IndexSeq<>;
+};
+
+template <>
+struct MakeIndexSeq<1> {
+  using type = IndexSeq<0>;
+};
+
+constexpr size_t Binom(size_t n, size_t k) {
+  return k == 0 ? 1 : Binom(n - 1, k - 1) * n / k;
+}
+
+// number of non-decreasing sequences of len nibbles, all >= v
+constexpr size_t NumSorted(size_t len, size_t v) {
+  return Binom(15 - v + len, len);
+}
+
+// number of such sequences whose first nibble is < v
+constexpr size_t RankPrefix(size_t len, size_t v) {
+  return v == 0 ? 0 : RankPrefix(len, v - 1) + NumSorted(len - 1, v - 1);
+}
+
+// first nibble (>= v) of the sequence of len nibbles with rank r
+constexpr size_t FirstNibble(size_t len, size_t v, size_t r) {
+  return r < NumSorted(len - 1, v)
+             ? v
+             : FirstNibble(len, v + 1, r - NumSorted(len - 1, v));
+}
+
+// rank of the remaining len - 1 nibbles once the first one is fixed
+constexpr size_t RestRank(size_t len, size_t v, size_t r) {
+  return r < NumSorted(len - 1, v)
+             ? r
+             : RestRank(len, v + 1, r - NumSorted(len - 1, v));
+}
+
+// nibble j of the decoded word is the low 4 bits of tag j
+constexpr uint16_t PackNibbles(size_t a, size_t b, size_t c, size_t d) {
+  return static_cast<uint16_t>(a | (b << 4) | (c << 8) | (d << 12));
+}
+
+constexpr uint16_t Decode3(size_t d0, size_t d1, size_t d2, size_t r) {
+  return PackNibbles(d0, d1, d2, d2 + r);
+}
+
+constexpr uint16_t Decode2(size_t d0, size_t d1, size_t r) {
+  return Decode3(d0, d1, FirstNibble(2, d1, r), RestRank(2, d1, r));
+}
 
-  ~PermEncoding() {}
+constexpr uint16_t Decode1(size_t d0, size_t r) {
+  return Decode2(d0, FirstNibble(3, d0, r), RestRank(3, d0, r));
+}
 
+constexpr uint16_t Decode(size_t r) {
+  return Decode1(FirstNibble(4, 0, r), RestRank(4, 0, r));
+}
+
+template <class Seq>
+struct DecTable;
+
+template <size_t... Is>
+struct DecTable<IndexSeq<Is...>> {
+  static constexpr uint16_t table[sizeof...(Is)] = {Decode(Is)...};
+};
+
+template <size_t... Is>
+constexpr uint16_t DecTable<IndexSeq<Is...>>::table[sizeof...(Is)];
+
+// RankPrefix(len, v) for v = 0..15, one row per sequence length 2..4
+template <class Seq>
+struct RankTable;
+
+template <size_t... Is>
+struct RankTable<IndexSeq<Is...>> {
+  static constexpr uint16_t table[3][sizeof...(Is)] = {
+      {RankPrefix(2, Is)...}, {RankPrefix(3, Is)...}, {RankPrefix(4, Is)...}};
+};
+
+template <size_t... Is>
+constexpr uint16_t RankTable<IndexSeq<Is...>>::table[3][sizeof...(Is)];
+
+}  // namespace permencoding
+
+// Both tables are constexpr data shared by every PackedTable: the decode table
+// takes 7.6KB, and encoding is computed from a 96-byte rank table instead of
+// the former 128KB enc_table.
+class PermEncoding {
+  using Dec = permencoding::DecTable<permencoding::MakeIndexSeq<3876>::type>;
+  using Rank = permencoding::RankTable<permencoding::MakeIndexSeq<16>::type>;
+
+  PermEncoding();
+
+ public:
   static const size_t N_ENTS = 3876;
 
-  uint16_t dec_table[N_ENTS];
-  uint16_t enc_table[1 << 16];
+  // the low 4 bits of the 4 tags of codeword, tag j in nibble j
+  static inline uint16_t dec_table(const uint16_t codeword) {
+    return Dec::table[codeword];
+  }
 
-  inline void decode(const uint16_t codeword, uint8_t lowbits[4]) const {
-    unpack(dec_table[codeword], lowbits);
+  static inline void decode(const uint16_t codeword, uint8_t lowbits[4]) {
+    const uint16_t v = dec_table(codeword);
+    lowbits[0] = (v & 0x000f);
+    lowbits[1] = ((v >> 4) & 0x000f);
+    lowbits[2] = ((v >> 8) & 0x000f);
+    lowbits[3] = ((v >> 12) & 0x000f);
   }
 
-  inline uint16_t encode(const uint8_t lowbits[4]) const {
+  // lowbits must be sorted in increasing order
+  static inline uint16_t encode(const uint8_t lowbits[4]) {
+    const uint16_t codeword =
+        Rank::table[2][lowbits[0]] +
+        (Rank::table[1][lowbits[1]] - Rank::table[1][lowbits[0]]) +
+        (Rank::table[0][lowbits[2]] - Rank::table[0][lowbits[1]]) +
+        (lowbits[3] - lowbits[2]);
     if (DEBUG_ENCODE & debug_level) {
       printf("Perm.encode\n");
       for (int i = 0; i < 4; i++) {
         printf("encode lowbits[%d]=%x\n", i, lowbits[i]);
       }
-      printf("pack(lowbits) = %x\n", pack(lowbits));
-      printf("enc_table[%x]=%x\n", pack(lowbits), enc_table[pack(lowbits)]);
-    }
-
-    return enc_table[pack(lowbits)];
-  }
-
-  void gen_tables(int base, int k, uint8_t dst[4], uint16_t &idx) {
-    for (int i = base; i < 16; i++) {
-      /* for fast comparison in binary_search in little-endian machine */
-      dst[k] = i;
-      if (k + 1 < 4) {
-        gen_tables(i, k + 1, dst, idx);
-      } else {
-        dec_table[idx] = pack(dst);
-        enc_table[pack(dst)] = idx;
-        if (DEBUG_ENCODE & debug_level) {
-          printf("enc_table[%04x]=%04x\t%x %x %x %x\n", pack(dst), idx, dst[0],
-                 dst[1], dst[2], dst[3]);
-        }
-        idx++;
-      }
+      printf("codeword=%x\n", codeword);
     }
+    return codeword;
   }
 };
 }  // namespace cuckoofilter
@@ -0,0 +1,569 @@
+#ifndef CUCKOO_FILTER_QUOTIENT_FILTER_H_
+#define CUCKOO_FILTER_QUOTIENT_FILTER_H_
+
+#include <assert.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "bitsutil.h"
+#include "cuckoofilter.h"
+#include "hashutil.h"
+
+namespace cuckoofilter {
+
+// a QuotientFilter takes at most this fraction of its home slots
+const double kQuotientFilterMaxLoad = 0.95;
+
+// QuotientFilter keeps its metadata in blocks of this many slots, one 64-bit
+// word of each bitmap
+const size_t kQuotientBlock = 64;
+
+// A counting quotient filter (Bender et al., "Don't thrash: how to cache your
+// hash on flash"; Pandey et al., "A general-purpose counting filter"), for
+// sets that are maintained by deletes and merges rather than built once.
+//
+// An item hashes to a fingerprint of QuotientBits() + RemainderBits() bits.
+// The quotient names the item's home slot and the remainder is what gets
+// stored. The remainders of one quotient form a sorted run, and runs are kept
+// in quotient order, shifted right of their home slot where earlier runs
+// spill over. The slots thus hold every fingerprint in sorted order, so:
+//
+//  - Delete removes one copy of the item's own fingerprint; there is no
+//    alternate bucket, so a delete never depends on where an insert went.
+//    Adding an item k times stores its fingerprint k times, and Count returns
+//    how many copies there are.
+//  - AddAll and Merge stream two sorted lists into fresh arrays, appending
+//    every fingerprint with no shifting, and Resize streams one. A filter of
+//    any size merges into any other: the fingerprints are prefixes of one
+//    hash, so the wider are cut to the narrower width, keeping their order.
+//    Growing the slots moves fingerprint bits from the remainder to the
+//    quotient, each doubling the false positive rate, so a filter meant to
+//    grow is best given bits to spare.
+//
+// Besides the remainders, each slot has two bits: occupieds_ marks quotients
+// that have a run, runends_ marks the slots that end one. The i-th occupied
+// quotient owns the i-th run end, and open_ records, per block of 64 slots,
+// how many runs of earlier quotients end in or after the block. A run is thus
+// found with a popcount and a select (pdep with BMI2) over 64-bit words, and
+// empty slots with one select per run rather than a walk over the cluster.
+//
+// Merged filters must hash with equal HashFamily instances; the default
+// WyHasher is stateless, so any two filters of the same type qualify.
+//
+//   QuotientFilter<uint64_t, 16> archive(expected_keys);
+//   archive.AddAll(revoked.data(), revoked.size());
+//   // daily, one sequential pass instead of updates.size() random inserts:
+//   archive.AddAll(updates.data(), updates.size());
+template <typename ItemType, size_t bits_per_item,
+          typename HashFamily = WyHasher<ItemType>>
+class QuotientFilter {
+  static_assert(bits_per_item >= 2 && bits_per_item <= 32,
+                "remainders must be 2 to 32 bits wide");
+  // remainders are stored one per element of the smallest type holding them
+  using Remainder = typename std::conditional<
+      bits_per_item <= 8, uint8_t,
+      typename std::conditional<bits_per_item <= 16, uint16_t,
+                                uint32_t>::type>::type;
+
+  size_t quotient_bits_;
+  size_t remainder_bits_;
+  // home slots; runs near the end spill into the rest of the arrays
+  size_t num_slots_;
+  size_t total_slots_;
+  size_t num_items_;
+  std::vector<uint64_t> occupieds_;
+  std::vector<uint64_t> runends_;
+  std::vector<uint16_t> open_;
+  std::vector<Remainder> remainders_;
+  HashFamily hasher_;
+
+  QuotientFilter(const size_t quotient_bits, const size_t remainder_bits,
+                 const HashFamily &hasher)
+      : hasher_(hasher) {
+    Allocate(quotient_bits, remainder_bits);
+  }
+
+  void Allocate(const size_t quotient_bits, const size_t remainder_bits) {
+    assert(remainder_bits >= 1 && remainder_bits <= bits_per_item &&
+           quotient_bits + remainder_bits <= 64);
+    quotient_bits_ = quotient_bits;
+    remainder_bits_ = remainder_bits;
+    num_slots_ = 1ULL << quotient_bits;
+    // the run of the last quotient starts about a cluster length past it
+    const size_t spill = std::max<size_t>(
+        kQuotientBlock, 10 * std::sqrt(static_cast<double>(num_slots_)));
+    total_slots_ = (num_slots_ + spill + kQuotientBlock - 1) / kQuotientBlock *
+                   kQuotientBlock;
+    num_items_ = 0;
+    occupieds_.assign(total_slots_ / kQuotientBlock, 0);
+    runends_.assign(total_slots_ / kQuotientBlock, 0);
+    open_.assign(total_slots_ / kQuotientBlock, 0);
+    remainders_.assign(total_slots_, 0);
+  }
+
+  static uint64_t LowBits(const size_t n) {
+    return n == 64 ? ~0ULL : (1ULL << n) - 1;
+  }
+
+  static bool Bit(const std::vector<uint64_t> &bits, const size_t i) {
+    return (bits[i / kQuotientBlock] >> (i % kQuotientBlock)) & 1;
+  }
+
+  static void SetBit(std::vector<uint64_t> &bits, const size_t i) {
+    bits[i / kQuotientBlock] |= 1ULL << (i % kQuotientBlock);
+  }
+
+  static void ClearBit(std::vector<uint64_t> &bits, const size_t i) {
+    bits[i / kQuotientBlock] &= ~(1ULL << (i % kQuotientBlock));
+  }
+
+  // moves bits [from, to) to [from + 1, to], a word at a time
+  static void ShiftBitsUp(std::vector<uint64_t> &bits, const size_t from,
+                          const size_t to) {
+    if (from >= to) return;
+    for (size_t w = to / kQuotientBlock + 1; w-- > from / kQuotientBlock;) {
+      const size_t base = w * kQuotientBlock;
+      const size_t lo = std::max(from + 1, base) - base;
+      const size_t hi = std::min(to, base + kQuotientBlock - 1) - base;
+      const uint64_t mask = LowBits(hi + 1) & ~LowBits(lo);
+      const uint64_t carry =
+          w > from / kQuotientBlock ? bits[w - 1] >> (kQuotientBlock - 1) : 0;
+      bits[w] = (bits[w] & ~mask) | (((bits[w] << 1) | carry) & mask);
+    }
+    ClearBit(bits, from);
+  }
+
+  // moves bits (from, to] to [from, to), a word at a time
+  static void ShiftBitsDown(std::vector<uint64_t> &bits, const size_t from,
+                            const size_t to) {
+    if (from >= to) return;
+    for (size_t w = from / kQuotientBlock; w <= (to - 1) / kQuotientBlock;
+         w++) {
+      const size_t base = w * kQuotientBlock;
+      const size_t lo = std::max(from, base) - base;
+      const size_t hi = std::min(to - 1, base + kQuotientBlock - 1) - base;
+      const uint64_t mask = LowBits(hi + 1) & ~LowBits(lo);
+      const uint64_t carry = w + 1 < bits.size() ? bits[w + 1] << 63 : 0;
+      bits[w] = (bits[w] & ~mask) | (((bits[w] >> 1) | carry) & mask);
+    }
+    ClearBit(bits, to);
+  }
+
+  // the slot of the k-th (from 1) run end at or after block b
+  size_t SelectRunEnd(size_t b, size_t k) const {
+    for (;; b++) {
+      const size_t n = __builtin_popcountll(runends_[b]);
+      if (k <= n) return b * kQuotientBlock + selectword(runends_[b], k - 1);
+      k -= n;
+    }
+  }
+
+  // the number of runs of quotients below x (or up to x, if inclusive) that
+  // end in x's block or later
+  size_t RunsFromBlock(const size_t x, const bool inclusive) const {
+    const size_t b = x / kQuotientBlock;
+    const uint64_t below = LowBits(x % kQuotientBlock + inclusive);
+    return open_[b] + __builtin_popcountll(occupieds_[b] & below);
+  }
+
+  // the slot after the runs of all quotients below x (or up to x): the start
+  // of x's run is the larger of this and x
+  size_t EndOfRunsBefore(const size_t x, const bool inclusive) const {
+    const size_t k = RunsFromBlock(x, inclusive);
+    return k == 0 ? 0 : SelectRunEnd(x / kQuotientBlock, k) + 1;
+  }
+
+  // the first slot at or after i that no run covers, skipping a run at a time
+  size_t FirstEmpty(size_t i) const {
+    while (i < total_slots_) {
+      const size_t end = EndOfRunsBefore(i, true);
+      if (end <= i) return i;
+      i = end;
+    }
+    return total_slots_;
+  }
+
+  // counts a run end that moves onto or off the first slot of a block
+  void AdjustOpen(const size_t lo, const size_t hi, const int delta) {
+    // blocks starting in (lo, hi]
+    for (size_t c = lo / kQuotientBlock + 1; c <= hi / kQuotientBlock; c++) {
+      open_[c] += delta;
+    }
+  }
+
+  void Split(const uint64_t fp, size_t *quotient, Remainder *remainder) const {
+    *quotient = fp >> remainder_bits_;
+    *remainder = fp & LowBits(remainder_bits_);
+  }
+
+  uint64_t Fingerprint(const ItemType &item) const {
+    return hasher_(item) >> (64 - FingerprintBits());
+  }
+
+  // the run of quotient x, which must be occupied, as [*start, *end]
+  void Run(const size_t x, size_t *start, size_t *end) const {
+    *start = std::max(x, EndOfRunsBefore(x, false));
+    *end = SelectRunEnd(x / kQuotientBlock, RunsFromBlock(x, true));
+  }
+
+  Status InsertFingerprint(const uint64_t fp);
+  Status DeleteFingerprint(const uint64_t fp);
+  size_t CountFingerprint(const uint64_t fp) const;
+
+  // Walks the fingerprints of a filter in increasing order, cut to width
+  // bits.
+  class Cursor {
+    const QuotientFilter *filter_;
+    size_t drop_;
+    size_t quotient_;
+    size_t slot_;
+    size_t end_;
+
+    // moves to the run of the first occupied quotient at or after x, which
+    // starts no earlier than next_free
+    void SeekRun(const size_t x, const size_t next_free) {
+      const std::vector<uint64_t> &occupieds = filter_->occupieds_;
+      size_t w = x / kQuotientBlock;
+      uint64_t word = w < occupieds.size()
+                          ? occupieds[w] & ~LowBits(x % kQuotientBlock)
+                          : 0;
+      while (word == 0 && ++w < occupieds.size()) word = occupieds[w];
+      if (word == 0) {
+        slot_ = filter_->total_slots_;
+        return;
+      }
+      quotient_ = w * kQuotientBlock + __builtin_ctzll(word);
+      slot_ = std::max(quotient_, next_free);
+      // the run ends at the first run end from its start
+      size_t e = slot_ / kQuotientBlock;
+      uint64_t ends = filter_->runends_[e] & ~LowBits(slot_ % kQuotientBlock);
+      while (ends == 0) ends = filter_->runends_[++e];
+      end_ = e * kQuotientBlock + __builtin_ctzll(ends);
+    }
+
+   public:
+    Cursor(const QuotientFilter &filter, const size_t width)
+        : filter_(&filter), drop_(filter.FingerprintBits() - width) {
+      if (filter.num_items_ == 0) {
+        slot_ = filter.total_slots_;
+      } else {
+        SeekRun(0, 0);
+      }
+    }
+
+    bool Done() const { return slot_ >= filter_->total_slots_; }
+
+    uint64_t Peek() const {
+      return ((static_cast<uint64_t>(quotient_) << filter_->remainder_bits_) |
+              filter_->remainders_[slot_]) >>
+             drop_;
+    }
+
+    void Next() {
+      if (slot_ < end_) {
+        slot_++;
+      } else {
+        SeekRun(quotient_ + 1, end_ + 1);
+      }
+    }
+  };
+
+  // a sorted vector of fingerprints, read like a Cursor
+  class SortedFingerprints {
+    const std::vector<uint64_t> &fps_;
+    size_t i_;
+
+   public:
+    explicit SortedFingerprints(const std::vector<uint64_t> &fps)
+        : fps_(fps), i_(0) {}
+    bool Done() const { return i_ == fps_.size(); }
+    uint64_t Peek() const { return fps_[i_]; }
+    void Next() { i_++; }
+  };
+
+  // The smallest quotient size, at least quotient_bits, that holds n items
+  size_t QuotientBitsFor(size_t quotient_bits, const size_t n) const {
+    while (n > kQuotientFilterMaxLoad * (1ULL << quotient_bits)) {
+      quotient_bits++;
+    }
+    return quotient_bits;
+  }
+
+  // Replaces the contents with the fingerprints of a and b, merged, which
+  // are width bits wide, in a filter of quotient_bits quotient bits.
+  template <typename SourceA, typename SourceB>
+  Status Rebuild(const size_t width, const size_t quotient_bits, SourceA a,
+                 SourceB b);
+
+ public:
+  // A filter of at least max_num_keys / kQuotientFilterMaxLoad home slots,
+  // rounded up to a power of two, storing bits_per_item-bit remainders.
+  explicit QuotientFilter(const size_t max_num_keys,
+                          const HashFamily &hasher = HashFamily())
+      : hasher_(hasher) {
+    size_t quotient_bits = 6;
+    while (max_num_keys > kQuotientFilterMaxLoad * (1ULL << quotient_bits)) {
+      quotient_bits++;
+    }
+    Allocate(quotient_bits, bits_per_item);
+  }
+
+  // Adds item, or another copy of it. NotEnoughSpace when the filter is at
+  // kQuotientFilterMaxLoad; Resize or Merge into a larger filter then.
+  Status Add(const ItemType &item) {
+    return InsertFingerprint(Fingerprint(item));
+  }
+
+  // Adds count items by sorting their fingerprints and merging them with the
+  // filter's, growing the filter if needed; cheaper than count Adds once
+  // count is a sizable fraction of the filter.
+  Status AddAll(const ItemType *items, const size_t count) {
+    std::vector<uint64_t> fps(count);
+    for (size_t i = 0; i < count; i++) fps[i] = Fingerprint(items[i]);
+    std::sort(fps.begin(), fps.end());
+    return Rebuild(FingerprintBits(),
+                   QuotientBitsFor(quotient_bits_, num_items_ + count),
+                   Cursor(*this, FingerprintBits()), SortedFingerprints(fps));
+  }
+
+  Status Contain(const ItemType &item) const {
+    return CountFingerprint(Fingerprint(item)) > 0 ? Ok : NotFound;
+  }
+
+  // the number of copies of item's fingerprint: at least the number of times
+  // item was added and not deleted
+  size_t Count(const ItemType &item) const {
+    return CountFingerprint(Fingerprint(item));
+  }
+
+  // Removes one copy of item's fingerprint; NotFound if there is none.
+  Status Delete(const ItemType &item) {
+    return DeleteFingerprint(Fingerprint(item));
+  }
+
+  // Adds every fingerprint of other by one sequential pass over both. The
+  // result keeps the narrower of the two fingerprint widths and has as many
+  // quotient bits as the larger filter, more if the items need them.
+  // NotSupported if that leaves no remainder bits.
+  Status Merge(const QuotientFilter &other) {
+    const size_t width = std::min(FingerprintBits(), other.FingerprintBits());
+    return Rebuild(
+        width,
+        QuotientBitsFor(std::max(quotient_bits_, other.quotient_bits_),
+                        num_items_ + other.num_items_),
+        Cursor(*this, width), Cursor(other, width));
+  }
+
+  // Rehouses the fingerprints in 2^quotient_bits home slots, keeping their
+  // width. NotSupported if the remainders would not be 1 to bits_per_item
+  // bits, NotEnoughSpace if the items do not fit.
+  Status Resize(const size_t quotient_bits) {
+    const std::vector<uint64_t> none;
+    return Rebuild(FingerprintBits(), quotient_bits,
+                   Cursor(*this, FingerprintBits()), SortedFingerprints(none));
+  }
+
+  // Calls fn with every fingerprint, in increasing order, copies included.
+  template <typename Fn>
+  void ForEachFingerprint(Fn fn) const {
+    for (Cursor c(*this, FingerprintBits()); !c.Done(); c.Next()) {
+      fn(c.Peek());
+    }
+  }
+
+  size_t QuotientBits() const { return quotient_bits_; }
+  size_t RemainderBits() const { return remainder_bits_; }
+  size_t FingerprintBits() const { return quotient_bits_ + remainder_bits_; }
+
+  size_t Size() const { return num_items_; }
+
+  size_t SizeInBytes() const {
+    return remainders_.size() * sizeof(Remainder) +
+           (occupieds_.size() + runends_.size()) * sizeof(uint64_t) +
+           open_.size() * sizeof(uint16_t);
+  }
+
+  double LoadFactor() const { return 1.0 * Size() / num_slots_; }
+
+  double BitsPerItem() const { return 8.0 * SizeInBytes() / Size(); }
+
+  std::string Info() const;
+};
+
+template <typename ItemType, size_t bits_per_item, typename HashFamily>
+Status QuotientFilter<ItemType, bits_per_item, HashFamily>::InsertFingerprint(
+    const uint64_t fp) {
+  if (num_items_ >= kQuotientFilterMaxLoad * num_slots_) return NotEnoughSpace;
+  size_t x;
+  Remainder remainder;
+  Split(fp, &x, &remainder);
+  const bool occupied = Bit(occupieds_, x);
+  const size_t start = std::max(x, EndOfRunsBefore(x, false));
+  size_t end = start, pos = start;
+  if (occupied) {
+    end = SelectRunEnd(x / kQuotientBlock, RunsFromBlock(x, true));
+    // after the copies already there, to keep the run sorted
+    while (pos <= end && remainders_[pos] <= remainder) pos++;
+  }
+  const size_t empty = FirstEmpty(pos);
+  if (empty >= total_slots_) return NotEnoughSpace;
+
+  // shift [pos, empty) up by one slot
+  for (size_t c = pos / kQuotientBlock + 1; c <= empty / kQuotientBlock;
+       c++) {
+    open_[c] += Bit(runends_, c * kQuotientBlock - 1);
+  }
+  memmove(&remainders_[pos + 1], &remainders_[pos],
+          (empty - pos) * sizeof(Remainder));
+  ShiftBitsUp(runends_, pos, empty);
+  remainders_[pos] = remainder;
+
+  if (!occupied) {
+    SetBit(occupieds_, x);
+    SetBit(runends_, pos);
+    AdjustOpen(x, pos, 1);
+  } else if (pos == end + 1) {
+    ClearBit(runends_, end);
+    SetBit(runends_, pos);
+    AdjustOpen(end, pos, 1);
+  }
+  num_items_++;
+  return Ok;
+}
+
+template <typename ItemType, size_t bits_per_item, typename HashFamily>
+Status QuotientFilter<ItemType, bits_per_item, HashFamily>::DeleteFingerprint(
+    const uint64_t fp) {
+  size_t x;
+  Remainder remainder;
+  Split(fp, &x, &remainder);
+  if (!Bit(occupieds_, x)) return NotFound;
+  size_t start, end;
+  Run(x, &start, &end);
+  size_t pos = start;
+  while (pos <= end && remainders_[pos] < remainder) pos++;
+  if (pos > end || remainders_[pos] != remainder) return NotFound;
+
+  // first give the run its new end, or remove it
+  if (start == end) {
+    ClearBit(occupieds_, x);
+    ClearBit(runends_, end);
+    AdjustOpen(x, end, -1);
+  } else if (pos == end) {
+    ClearBit(runends_, end);
+    SetBit(runends_, end - 1);
+    AdjustOpen(end - 1, end, -1);
+  }
+  // then pull down the rest of the cluster, up to the first empty slot or
+  // run that starts at its home slot; those have no earlier run still open
+  size_t stop = pos + 1;
+  while (stop < total_slots_) {
+    const size_t runs_end = EndOfRunsBefore(stop, false);
+    if (runs_end <= stop) break;
+    stop = runs_end;
+  }
+  for (size_t c = pos / kQuotientBlock + 1; c <= (stop - 1) / kQuotientBlock;
+       c++) {
+    open_[c] -= Bit(runends_, c * kQuotientBlock);
+  }
+  memmove(&remainders_[pos], &remainders_[pos + 1],
+          (stop - pos - 1) * sizeof(Remainder));
+  remainders_[stop - 1] = 0;
+  ShiftBitsDown(runends_, pos, stop - 1);
+  num_items_--;
+  return Ok;
+}
+
+template <typename ItemType, size_t bits_per_item, typename HashFamily>
+size_t QuotientFilter<ItemType, bits_per_item, HashFamily>::CountFingerprint(
+    const uint64_t fp) const {
+  size_t x;
+  Remainder remainder;
+  Split(fp, &x, &remainder);
+  if (!Bit(occupieds_, x)) return 0;
+  size_t start, end;
+  Run(x, &start, &end);
+  size_t count = 0;
+  for (size_t pos = start; pos <= end && remainders_[pos] <= remainder; pos++) {
+    count += remainders_[pos] == remainder;
+  }
+  return count;
+}
+
+template <typename ItemType, size_t bits_per_item, typename HashFamily>
+template <typename SourceA, typename SourceB>
+Status QuotientFilter<ItemType, bits_per_item, HashFamily>::Rebuild(
+    const size_t width, const size_t quotient_bits, SourceA a, SourceB b) {
+  if (quotient_bits >= width || width - quotient_bits > bits_per_item) {
+    return NotSupported;
+  }
+  QuotientFilter result(quotient_bits, width - quotient_bits, hasher_);
+  // fingerprints arrive in order, so each goes right after the previous one
+  // or at its home slot, and ends its quotient's run so far
+  size_t last = 0, last_quotient = 0;
+  for (size_t n = 0; !a.Done() || !b.Done(); n++) {
+    uint64_t fp;
+    if (b.Done() || (!a.Done() && a.Peek() <= b.Peek())) {
+      fp = a.Peek();
+      a.Next();
+    } else {
+      fp = b.Peek();
+      b.Next();
+    }
+    size_t x;
+    Remainder remainder;
+    result.Split(fp, &x, &remainder);
+    size_t pos = x;
+    if (n > 0 && x == last_quotient) {
+      pos = last + 1;
+      ClearBit(result.runends_, last);
+    } else {
+      if (n > 0) pos = std::max(x, last + 1);
+      SetBit(result.occupieds_, x);
+    }
+    if (pos >= result.total_slots_ ||
+        n >= kQuotientFilterMaxLoad * result.num_slots_) {
+      return NotEnoughSpace;
+    }
+    result.remainders_[pos] = remainder;
+    SetBit(result.runends_, pos);
+    last = pos;
+    last_quotient = x;
+    result.num_items_++;
+  }
+  // a run is open at a block start between its quotient's bit and its end
+  size_t open = 0;
+  for (size_t c = 0; c < result.open_.size(); c++) {
+    result.open_[c] = open;
+    open += __builtin_popcountll(result.occupieds_[c]);
+    open -= __builtin_popcountll(result.runends_[c]);
+  }
+  *this = std::move(result);
+  return Ok;
+}
+
+template <typename ItemType, size_t bits_per_item, typename HashFamily>
+std::string QuotientFilter<ItemType, bits_per_item, HashFamily>::Info() const {
+  std::stringstream ss;
+  ss << "QuotientFilter Status:\n"
+     << "\t\tQuotient bits: " << QuotientBits() << "\n"
+     << "\t\tRemainder bits: " << RemainderBits() << "\n"
+     << "\t\tKeys stored: " << Size() << "\n"
+     << "\t\tLoad factor: " << LoadFactor() << "\n"
+     << "\t\tFilter size: " << (SizeInBytes() >> 10) << " KB\n";
+  if (Size() > 0) {
+    ss << "\t\tbit/key:   " << BitsPerItem() << "\n";
+  } else {
+    ss << "\t\tbit/key:   N/A\n";
+  }
+  return ss.str();
+}
+
+}  // namespace cuckoofilter
+#endif  // CUCKOO_FILTER_QUOTIENT_FILTER_H_
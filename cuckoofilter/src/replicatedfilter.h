@@ -0,0 +1,122 @@
+#ifndef CUCKOO_FILTER_REPLICATED_FILTER_H_
+#define CUCKOO_FILTER_REPLICATED_FILTER_H_
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "cuckoofilter.h"
+#include "numatopology.h"
+
+namespace cuckoofilter {
+
+// A read-mostly handle on one filter, replicated once per NUMA node so that
+// every Contain() reads node-local memory. Each replica is built by a thread
+// pinned to its node, so the table and seed arrays are first touched, and
+// thus allocated, there.
+//
+// Publish() swaps in a new set of replicas for all nodes at once: a reader
+// sees either the old filter on every node or the new one, never a mix. Old
+// replicas are freed when the last reader still holding them refreshes.
+//
+// Readers go through a per-thread Reader, which caches the current version
+// and its local replica; the fast path of Contain() is one load of the shared
+// version counter, which is only written by Publish().
+//
+//   ReplicatedFilter<Filter> replicated;
+//   replicated.Publish([&] { return builder.Snapshot(); });
+//   // in each worker thread, after pinning it:
+//   ReplicatedFilter<Filter>::Reader reader(replicated);
+//   if (reader.Contain(key) == Ok) ...
+template <typename FilterType>
+class ReplicatedFilter {
+  // one published filter: replicas[node] lives on node
+  struct Version {
+    uint64_t number;
+    std::vector<std::unique_ptr<const FilterType>> replicas;
+  };
+
+  // read by every Contain(), so kept off the line the mutex writes to
+  alignas(64) std::atomic<uint64_t> version_;
+
+  alignas(64) mutable std::mutex mutex_;
+  std::shared_ptr<const Version> current_;
+
+  std::shared_ptr<const Version> Current() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return current_;
+  }
+
+ public:
+  ReplicatedFilter() : version_(0) {}
+
+  // Builds one replica per node with make_replica, each on a thread pinned to
+  // that node, then publishes them together. make_replica must return equal
+  // filters on every call, e.g. SeededFilterBuilder::Snapshot.
+  void Publish(
+      const std::function<std::unique_ptr<FilterType>()> &make_replica) {
+    std::shared_ptr<Version> next(new Version);
+    next->replicas.resize(NumaTopology::NumNodes());
+    std::vector<std::thread> threads;
+    for (size_t node = 0; node < next->replicas.size(); node++) {
+      threads.emplace_back([&next, &make_replica, node]() {
+        // a replica whose node the affinity excludes is still built, only
+        // its memory may then come from another node
+        NumaTopology::PinToNode(node);
+        next->replicas[node] = make_replica();
+      });
+    }
+    for (auto &t : threads) t.join();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    next->number = version_.load(std::memory_order_relaxed) + 1;
+    current_ = next;
+    version_.store(next->number, std::memory_order_release);
+  }
+
+  size_t NumReplicas() const { return NumaTopology::NumNodes(); }
+
+  class Reader {
+    const ReplicatedFilter &owner_;
+    std::shared_ptr<const Version> version_;
+    // version_->number, or 0 before the first Publish
+    uint64_t seen_;
+    const FilterType *local_;
+    size_t node_;
+
+    void Refresh() {
+      version_ = owner_.Current();
+      seen_ = version_ ? version_->number : 0;
+      node_ = NumaTopology::CurrentNode();
+      local_ = version_ ? version_->replicas[node_].get() : nullptr;
+    }
+
+   public:
+    // the node is taken from the CPU the thread runs on when the Reader is
+    // created or refreshed, so workers should be pinned first
+    explicit Reader(const ReplicatedFilter &owner)
+        : owner_(owner), seen_(0), local_(nullptr), node_(0) {
+      Refresh();
+    }
+
+    // Status of the local replica's Contain; NotFound before any Publish
+    template <typename ItemType>
+    Status Contain(const ItemType &item) {
+      const uint64_t published =
+          owner_.version_.load(std::memory_order_acquire);
+      if (seen_ != published) Refresh();
+      return local_ ? local_->Contain(item) : NotFound;
+    }
+
+    // the replica this reader currently queries, or nullptr
+    const FilterType *Local() const { return local_; }
+
+    size_t Node() const { return node_; }
+  };
+};
+
+}  // namespace cuckoofilter
+#endif  // CUCKOO_FILTER_REPLICATED_FILTER_H_
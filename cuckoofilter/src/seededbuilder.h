@@ -0,0 +1,347 @@
+#ifndef CUCKOO_FILTER_SEEDED_BUILDER_H_
+#define CUCKOO_FILTER_SEEDED_BUILDER_H_
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "cuckoofilter.h"
+
+namespace cuckoofilter {
+
+// Builds a seeded CuckooFilter straight from the keys, for clients that only
+// need the filter. The usual route inserts R into a full-key
+// cuckoo_hashtable, runs its lookup/rehash rounds against S and exports the
+// fingerprints; this builder instead fills the filter it will return and keeps
+// next to it just the 64-bit item of every occupied slot, which is all that is
+// needed to move items during cuckoo kicks and to recompute a bucket's tags
+// when its seed is bumped. Since the filter indexes on the raw 64-bit item,
+// callers with larger keys should build and query with a 64-bit hash of them.
+//
+// Typical use:
+//   SeededFilterBuilder<uint64_t, 12, WyHasher<uint64_t>> builder(r.size());
+//   for (auto x : r) builder.Add(x);
+//   builder.EliminateFalsePositives(s.data(), s.size());
+//   std::unique_ptr<CuckooFilter<uint64_t, 12, WyHasher<uint64_t>>> filter =
+//       builder.Build();
+//
+// To keep adapting a deployed filter to false positives seen in production,
+// keep the builder, deploy Snapshot() instead of Build(), call
+// IndexNegatives(S) once, then feed confirmed false positives to
+// IngestFalsePositives() and ship the deltas it returns to
+// CuckooFilter::ApplyDelta(). Snapshots and deltas only line up if
+// HashFamily is deterministic (WyHasher, CityHasher), not randomly seeded.
+template <typename ItemType, size_t bits_per_item,
+          typename HashFamily = TwoIndependentMultiplyShift,
+          template <size_t> class TableType = SingleTable>
+class SeededFilterBuilder {
+ public:
+  typedef CuckooFilter<ItemType, bits_per_item, HashFamily, TableType> Filter;
+
+ private:
+  static const size_t kSlotsPerBucket = 4;
+
+  std::unique_ptr<Filter> filter_;
+
+  // the items of bucket i are items_[i * kSlotsPerBucket + k] for k below
+  // counts_[i]; their order need not match the slots of the filter's table
+  std::vector<ItemType> items_;
+  std::vector<uint8_t> counts_;
+
+  // number of false positive elimination rounds run so far
+  size_t num_rounds_;
+
+  // buckets IngestFalsePositives left matching a false positive because
+  // their seed could not be bumped any further
+  size_t num_unfixable_;
+
+  // S grouped by bucket: the negatives probing bucket i (as primary or
+  // alternate) are neg_items_[neg_offsets_[i] .. neg_offsets_[i + 1]); empty
+  // until IndexNegatives is called
+  std::vector<size_t> neg_offsets_;
+  std::vector<ItemType> neg_items_;
+
+  // confirmed false positives ingested so far, by bucket
+  std::unordered_map<size_t, std::vector<ItemType>> reported_;
+
+  inline uint32_t Tag(const size_t i, const ItemType &item) const {
+    return filter_->TagHash(filter_->hasher_(item, filter_->seeds_[i]));
+  }
+
+  inline ItemType &Item(const size_t i, const size_t k) {
+    return items_[i * kSlotsPerBucket + k];
+  }
+
+  inline bool BucketHolds(const size_t i, const ItemType &item) const {
+    for (size_t k = 0; k < counts_[i]; k++) {
+      if (items_[i * kSlotsPerBucket + k] == item) return true;
+    }
+    return false;
+  }
+
+  // stores item in a free slot of bucket i
+  void Place(const size_t i, const ItemType &item) {
+    uint32_t oldtag;
+    Item(i, counts_[i]++) = item;
+    filter_->table_->InsertTagToBucket(i, Tag(i, item), false, oldtag);
+    filter_->num_items_++;
+  }
+
+  // puts item in place of the k-th item of bucket i and returns that one
+  ItemType Replace(const size_t i, const size_t k, const ItemType &item) {
+    uint32_t oldtag;
+    const ItemType victim = Item(i, k);
+    filter_->table_->DeleteTagFromBucket(i, Tag(i, victim));
+    filter_->table_->InsertTagToBucket(i, Tag(i, item), false, oldtag);
+    Item(i, k) = item;
+    return victim;
+  }
+
+  // whether some known negative probing bucket i matches one of its tags
+  bool HasFalsePositive(const size_t i) const {
+    auto matches = [this, i](const ItemType &s) {
+      return filter_->table_->FindTagInBucket(i, Tag(i, s)) &&
+             !BucketHolds(i, s);
+    };
+    if (!neg_offsets_.empty()) {
+      for (size_t n = neg_offsets_[i]; n < neg_offsets_[i + 1]; n++) {
+        if (matches(neg_items_[n])) return true;
+      }
+    }
+    const auto it = reported_.find(i);
+    if (it != reported_.end()) {
+      for (const ItemType &s : it->second) {
+        if (matches(s)) return true;
+      }
+    }
+    return false;
+  }
+
+  // recomputes the tags of bucket i under its next seed
+  void Reseed(const size_t i) {
+    uint32_t oldtag;
+    for (size_t k = 0; k < counts_[i]; k++) {
+      filter_->table_->DeleteTagFromBucket(i, Tag(i, Item(i, k)));
+    }
+    filter_->seeds_[i]++;
+    for (size_t k = 0; k < counts_[i]; k++) {
+      filter_->table_->InsertTagToBucket(i, Tag(i, Item(i, k)), false, oldtag);
+    }
+  }
+
+ public:
+  explicit SeededFilterBuilder(const size_t max_num_keys,
+                               const SizingMode mode = PowerOfTwo,
+                               const size_t alt_range = 0)
+      : filter_(new Filter(max_num_keys, mode, alt_range)),
+        num_rounds_(0),
+        num_unfixable_(0) {
+    // the builder rehashes buckets under seeds of their own
+    filter_->seeded_ = true;
+    const size_t num_buckets = filter_->table_->NumBuckets();
+    items_.resize(num_buckets * kSlotsPerBucket);
+    counts_.assign(num_buckets, 0);
+  }
+
+  // Adds an item. Unlike CuckooFilter::Add, kicks move whole items, so every
+  // evicted item goes to its real alternate bucket. If no free slot is found
+  // within kMaxCuckooCount kicks, the kicks are undone and NotEnoughSpace is
+  // returned, leaving the builder unchanged.
+  Status Add(const ItemType &item) {
+    size_t i = filter_->IndexHash(item);
+    const size_t i2 = filter_->AltIndex(i, item);
+    if (counts_[i] < kSlotsPerBucket) {
+      Place(i, item);
+      return Ok;
+    }
+    if (counts_[i2] < kSlotsPerBucket) {
+      Place(i2, item);
+      return Ok;
+    }
+
+    // (bucket, slot) of every kick, to undo them on failure
+    std::vector<std::pair<size_t, size_t>> path;
+    ItemType cur = item;
+    if (rand() & 1) i = i2;
+    for (size_t count = 0; count < kMaxCuckooCount; count++) {
+      const size_t k = rand() % kSlotsPerBucket;
+      path.push_back(std::make_pair(i, k));
+      cur = Replace(i, k, cur);
+      i = filter_->AltIndex(i, cur);
+      if (counts_[i] < kSlotsPerBucket) {
+        Place(i, cur);
+        return Ok;
+      }
+    }
+    while (!path.empty()) {
+      cur = Replace(path.back().first, path.back().second, cur);
+      path.pop_back();
+    }
+    assert(cur == item);
+    return NotEnoughSpace;
+  }
+
+  // Runs lookup rounds of the count negatives against the filter. Every
+  // bucket that gives a false positive in a round gets its seed bumped and its
+  // tags recomputed at the end of the round; rounds repeat until one has no
+  // false positive or max_rounds rounds have rehashed buckets. Negatives that
+  // were in fact added are skipped. Returns the number of false positives
+  // found by the last round (0 on success).
+  size_t EliminateFalsePositives(const ItemType *negatives, const size_t count,
+                                 const size_t max_rounds = 1000) {
+    std::vector<size_t> dirty;
+    std::vector<bool> is_dirty(counts_.size(), false);
+    for (size_t round = 0;; round++) {
+      size_t false_positives = 0;
+      for (size_t n = 0; n < count; n++) {
+        const ItemType &s = negatives[n];
+        size_t i[2];
+        uint32_t tag[2];
+        filter_->GenerateTagHashes(s, &i[0], &i[1], &tag[0], &tag[1]);
+        for (size_t b = 0; b < 2; b++) {
+          if (!filter_->table_->FindTagInBucket(i[b], tag[b]) ||
+              BucketHolds(i[b], s)) {
+            continue;
+          }
+          false_positives++;
+          if (!is_dirty[i[b]] && filter_->seeds_[i[b]] < UINT16_MAX) {
+            is_dirty[i[b]] = true;
+            dirty.push_back(i[b]);
+          }
+        }
+      }
+      if (false_positives == 0 || dirty.empty() || round == max_rounds) {
+        return false_positives;
+      }
+      num_rounds_++;
+      for (const size_t b : dirty) {
+        Reseed(b);
+        is_dirty[b] = false;
+      }
+      dirty.clear();
+    }
+  }
+
+  // Groups the count negatives by the two buckets each one probes, so
+  // IngestFalsePositives can re-verify a rehashed bucket against S without a
+  // full pass. Costs two items of memory per negative.
+  void IndexNegatives(const ItemType *negatives, const size_t count) {
+    const size_t num_buckets = counts_.size();
+    std::vector<size_t> i1(count), i2(count);
+    neg_offsets_.assign(num_buckets + 1, 0);
+    for (size_t n = 0; n < count; n++) {
+      i1[n] = filter_->IndexHash(negatives[n]);
+      i2[n] = filter_->AltIndex(i1[n], negatives[n]);
+      neg_offsets_[i1[n] + 1]++;
+      if (i2[n] != i1[n]) neg_offsets_[i2[n] + 1]++;
+    }
+    for (size_t i = 0; i < num_buckets; i++) {
+      neg_offsets_[i + 1] += neg_offsets_[i];
+    }
+    neg_items_.resize(neg_offsets_[num_buckets]);
+    std::vector<size_t> next(neg_offsets_.begin(), neg_offsets_.end() - 1);
+    for (size_t n = 0; n < count; n++) {
+      neg_items_[next[i1[n]]++] = negatives[n];
+      if (i2[n] != i1[n]) neg_items_[next[i2[n]]++] = negatives[n];
+    }
+  }
+
+  // Takes a batch of keys confirmed to be false positives of the deployed
+  // filter. Each bucket in which one of them matches gets its seed bumped
+  // until neither those keys nor the indexed negatives (IndexNegatives) nor
+  // earlier reported keys match it; no other bucket is touched. Keys that were
+  // in fact added are ignored. Returns the rehashed buckets, to be applied to
+  // deployed copies with CuckooFilter::ApplyDelta. A bucket whose seed reaches
+  // UINT16_MAX is left as it is (see NumUnfixableBuckets): seeds never wrap
+  // around to ones the exporter assumes.
+  std::vector<BucketDelta> IngestFalsePositives(const ItemType *keys,
+                                                const size_t count) {
+    std::vector<size_t> dirty;
+    for (size_t n = 0; n < count; n++) {
+      const ItemType &key = keys[n];
+      size_t i[2];
+      uint32_t tag[2];
+      filter_->GenerateTagHashes(key, &i[0], &i[1], &tag[0], &tag[1]);
+      if (BucketHolds(i[0], key) || BucketHolds(i[1], key)) {
+        continue;
+      }
+      for (size_t b = 0; b < 2; b++) {
+        if (b == 1 && i[1] == i[0]) break;
+        reported_[i[b]].push_back(key);
+        if (filter_->table_->FindTagInBucket(i[b], tag[b])) {
+          dirty.push_back(i[b]);
+        }
+      }
+    }
+    std::sort(dirty.begin(), dirty.end());
+    dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+
+    std::vector<BucketDelta> delta;
+    for (const size_t i : dirty) {
+      if (filter_->seeds_[i] == UINT16_MAX) {
+        num_unfixable_++;
+        continue;
+      }
+      BucketDelta d;
+      d.index = i;
+      d.num_tags = counts_[i];
+      for (size_t k = 0; k < counts_[i]; k++) {
+        d.old_tags[k] = Tag(i, Item(i, k));
+      }
+      do {
+        Reseed(i);
+      } while (filter_->seeds_[i] < UINT16_MAX && HasFalsePositive(i));
+      if (HasFalsePositive(i)) {
+        num_unfixable_++;
+      }
+      d.seed = filter_->seeds_[i];
+      for (size_t k = 0; k < counts_[i]; k++) {
+        d.new_tags[k] = Tag(i, Item(i, k));
+      }
+      delta.push_back(d);
+    }
+    return delta;
+  }
+
+  // A copy of the filter built so far, leaving the builder usable.
+  std::unique_ptr<Filter> Snapshot() const {
+    std::unique_ptr<Filter> copy(
+        new Filter(Size(), filter_->seeds_, filter_->alt_range_));
+    uint32_t oldtag;
+    for (size_t i = 0; i < counts_.size(); i++) {
+      for (size_t k = 0; k < counts_[i]; k++) {
+        copy->table_->InsertTagToBucket(
+            i, Tag(i, items_[i * kSlotsPerBucket + k]), false, oldtag);
+      }
+    }
+    copy->num_items_ = filter_->num_items_;
+    return copy;
+  }
+
+  // number of elimination rounds that rehashed at least one bucket
+  size_t NumRounds() const { return num_rounds_; }
+
+  // number of times IngestFalsePositives ran out of seeds for a bucket that
+  // still matched a false positive
+  size_t NumUnfixableBuckets() const { return num_unfixable_; }
+
+  // number of items added
+  size_t Size() const { return filter_->Size(); }
+
+  // Hands over the seeded filter; the builder must not be used afterwards.
+  std::unique_ptr<Filter> Build() {
+    items_.clear();
+    items_.shrink_to_fit();
+    counts_.clear();
+    counts_.shrink_to_fit();
+    return std::move(filter_);
+  }
+};
+
+}  // namespace cuckoofilter
+#endif  // CUCKOO_FILTER_SEEDED_BUILDER_H_
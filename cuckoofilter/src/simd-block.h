@@ -9,16 +9,24 @@
 //
 // 2. The number of bits set per Add() is contant in order to take advantage of SIMD
 // instructions.
+//
+// 3. The directory may hold any number of buckets: the block index is the high half of
+// the hash reduced with a multiply-shift ("fastrange") rather than a bitmask, so the
+// filter can be sized exactly for a target false positive rate.
 
 #pragma once
 
+#include <climits>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 
 #include <algorithm>
 #include <new>
+#include <stdexcept>
 
 #include <immintrin.h>
+#include <sys/mman.h>
 
 #include "hashutil.h"
 
@@ -38,31 +46,52 @@ class SimdBlockFilter {
       (1 << LOG_BUCKET_BYTE_SIZE) == sizeof(Bucket) && sizeof(Bucket) == sizeof(__m256i),
       "Bucket sizing has gone awry.");
 
-  // log_num_buckets_ is the log (base 2) of the number of buckets in the directory:
-  const int log_num_buckets_;
+  // Directories of at least this many bytes are aligned to, and advised as, transparent
+  // huge pages, so that random probes do not each cost a TLB miss:
+  static constexpr size_t HUGE_PAGE_SIZE = 2 << 20;
 
-  // directory_mask_ is (1 << log_num_buckets_) - 1. It is precomputed in the contructor
-  // for efficiency reasons:
-  const uint32_t directory_mask_;
+  // num_buckets_ is the number of buckets in the directory, at most 2^32:
+  const uint64_t num_buckets_;
 
   Bucket* directory_;
 
   HashFamily hasher_;
 
  public:
+  // Exact heap budgets for the constructors below, rounded up to whole buckets:
+  struct Bytes { uint64_t value; };
+  struct Bits { uint64_t value; };
+
   // Consumes at most (1 << log_heap_space) bytes on the heap:
   explicit SimdBlockFilter(const int log_heap_space);
+  // Consumes heap_space.value bytes, rounded up to a multiple of 32:
+  explicit SimdBlockFilter(const Bytes heap_space);
+  explicit SimdBlockFilter(const Bits heap_space);
   SimdBlockFilter(SimdBlockFilter&& that)
-    : log_num_buckets_(that.log_num_buckets_),
-      directory_mask_(that.directory_mask_),
+    : num_buckets_(that.num_buckets_),
       directory_(that.directory_),
-      hasher_(that.hasher_) {}
+      hasher_(that.hasher_) {
+    that.directory_ = nullptr;
+  }
   ~SimdBlockFilter() noexcept;
   void Add(const uint64_t key) noexcept;
+  // Adds count keys, visiting their buckets in directory order rather than at random:
+  void AddAll(const uint64_t* keys, const size_t count);
   bool Find(const uint64_t key) const noexcept;
-  uint64_t SizeInBytes() const { return sizeof(Bucket) * (1ull << log_num_buckets_); }
+  uint64_t SizeInBytes() const { return sizeof(Bucket) * num_buckets_; }
 
  private:
+  // The number of buckets needed for heap_bytes bytes, at least 1:
+  static uint64_t BucketsForBytes(const uint64_t heap_bytes);
+
+  // Allocates and zeroes the directory; shared by the constructors:
+  void AllocateDirectory();
+
+  // Maps the high half of a hash onto [0, num_buckets_) with a multiply-shift:
+  uint32_t BucketIndex(const uint64_t hash) const noexcept {
+    return ((hash >> 32) * num_buckets_) >> 32;
+  }
+
   // A helper function for Insert()/Find(). Turns a 32-bit hash into a 256-bit Bucket
   // with 1 single 1-bit set in each 32-bit lane.
   static __m256i MakeMask(const uint32_t hash) noexcept;
@@ -75,19 +104,54 @@ template<typename HashFamily>
 SimdBlockFilter<HashFamily>::SimdBlockFilter(const int log_heap_space)
   :  // Since log_heap_space is in bytes, we need to convert it to the number of Buckets
      // we will use.
-    log_num_buckets_(::std::max(1, log_heap_space - LOG_BUCKET_BYTE_SIZE)),
-    // Don't use log_num_buckets_ if it will lead to undefined behavior by a shift that is
-    // too large.
-    directory_mask_((1ull << ::std::min(63, log_num_buckets_)) - 1),
+    num_buckets_(1ull << ::std::min(32, ::std::max(1, log_heap_space - LOG_BUCKET_BYTE_SIZE))),
+    directory_(nullptr),
+    hasher_() {
+  AllocateDirectory();
+}
+
+template<typename HashFamily>
+SimdBlockFilter<HashFamily>::SimdBlockFilter(const Bytes heap_space)
+  : num_buckets_(BucketsForBytes(heap_space.value)), directory_(nullptr), hasher_() {
+  AllocateDirectory();
+}
+
+template<typename HashFamily>
+SimdBlockFilter<HashFamily>::SimdBlockFilter(const Bits heap_space)
+  : num_buckets_(BucketsForBytes((heap_space.value + CHAR_BIT - 1) / CHAR_BIT)),
     directory_(nullptr),
     hasher_() {
+  AllocateDirectory();
+}
+
+template<typename HashFamily>
+uint64_t SimdBlockFilter<HashFamily>::BucketsForBytes(const uint64_t heap_bytes) {
+  const uint64_t buckets = (heap_bytes + sizeof(Bucket) - 1) / sizeof(Bucket);
+  if (buckets > (1ull << 32)) throw ::std::length_error("SimdBlockFilter is too large");
+  return ::std::max<uint64_t>(1, buckets);
+}
+
+template<typename HashFamily>
+void SimdBlockFilter<HashFamily>::AllocateDirectory() {
   if (!__builtin_cpu_supports("avx2")) {
     throw ::std::runtime_error("SimdBlockFilter does not work without AVX2 instructions");
   }
-  const size_t alloc_size = 1ull << (log_num_buckets_ + LOG_BUCKET_BYTE_SIZE);
+  size_t alloc_size = SizeInBytes();
+  size_t alignment = 64;
+  if (alloc_size >= HUGE_PAGE_SIZE) {
+    // Whole huge pages, so that the kernel can back all of the directory with them:
+    alignment = HUGE_PAGE_SIZE;
+    alloc_size = (alloc_size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+  }
   const int malloc_failed =
-      posix_memalign(reinterpret_cast<void**>(&directory_), 64, alloc_size);
+      posix_memalign(reinterpret_cast<void**>(&directory_), alignment, alloc_size);
   if (malloc_failed) throw ::std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+  if (alignment == HUGE_PAGE_SIZE) {
+    // Only a hint: without transparent huge pages this fails and regular pages are used.
+    madvise(directory_, alloc_size, MADV_HUGEPAGE);
+  }
+#endif
   memset(directory_, 0, alloc_size);
 }
 
@@ -119,19 +183,45 @@ SimdBlockFilter<HashFamily>::MakeMask(const uint32_t hash) noexcept {
 template <typename HashFamily>
 [[gnu::always_inline]] inline void
 SimdBlockFilter<HashFamily>::Add(const uint64_t key) noexcept {
-  const auto hash = hasher_(key);
-  const uint32_t bucket_idx = hash & directory_mask_;
-  const __m256i mask = MakeMask(hash >> log_num_buckets_);
+  const uint64_t hash = hasher_(key);
+  const uint32_t bucket_idx = BucketIndex(hash);
+  const __m256i mask = MakeMask(hash);
   __m256i* const bucket = &reinterpret_cast<__m256i*>(directory_)[bucket_idx];
   _mm256_store_si256(bucket, _mm256_or_si256(*bucket, mask));
 }
 
+// Bulk insertion keeps a small ring of hashed keys whose buckets have already been
+// prefetched, so up to PREFETCH_DISTANCE directory misses are in flight at once instead
+// of each Add() waiting on its own. Sorting the keys by bucket was tried first, but the
+// extra passes over the keys cost more than the random directory accesses they saved.
+template <typename HashFamily>
+void SimdBlockFilter<HashFamily>::AddAll(const uint64_t* keys, const size_t count) {
+  constexpr size_t PREFETCH_DISTANCE = 16;
+  uint64_t ring[PREFETCH_DISTANCE];
+  const size_t lead = ::std::min(count, PREFETCH_DISTANCE);
+  for (size_t i = 0; i < lead; ++i) {
+    ring[i] = hasher_(keys[i]);
+    __builtin_prefetch(&directory_[BucketIndex(ring[i])], 1);
+  }
+  for (size_t i = 0; i < count; ++i) {
+    const size_t slot = i % PREFETCH_DISTANCE;
+    const uint64_t hash = ring[slot];
+    if (i + PREFETCH_DISTANCE < count) {
+      ring[slot] = hasher_(keys[i + PREFETCH_DISTANCE]);
+      __builtin_prefetch(&directory_[BucketIndex(ring[slot])], 1);
+    }
+    const __m256i mask = MakeMask(hash);
+    __m256i* const bucket = &reinterpret_cast<__m256i*>(directory_)[BucketIndex(hash)];
+    _mm256_store_si256(bucket, _mm256_or_si256(*bucket, mask));
+  }
+}
+
 template <typename HashFamily>
 [[gnu::always_inline]] inline bool
 SimdBlockFilter<HashFamily>::Find(const uint64_t key) const noexcept {
-  const auto hash = hasher_(key);
-  const uint32_t bucket_idx = hash & directory_mask_;
-  const __m256i mask = MakeMask(hash >> log_num_buckets_);
+  const uint64_t hash = hasher_(key);
+  const uint32_t bucket_idx = BucketIndex(hash);
+  const __m256i mask = MakeMask(hash);
   const __m256i bucket = reinterpret_cast<__m256i*>(directory_)[bucket_idx];
   // We should return true if 'bucket' has a one wherever 'mask' does. _mm256_testc_si256
   // takes the negation of its first argument and ands that with its second argument. In
@@ -18,10 +18,22 @@ class SingleTable {
   static const size_t kBytesPerBucket =
       (bits_per_tag * kTagsPerBucket + 7) >> 3;
   static const uint32_t kTagMask = (1ULL << bits_per_tag) - 1;
+  // widths without a hand-written branch below use the generic bit-packed
+  // codec: tags are read with an unaligned uint64 load and shift, and buckets
+  // are searched by spreading all four tags into 16- or 32-bit lanes
+  static const bool kGenericCodec =
+      bits_per_tag != 2 && bits_per_tag != 4 && bits_per_tag != 8 &&
+      bits_per_tag != 12 && bits_per_tag != 16 && bits_per_tag != 32;
+  static_assert(!kGenericCodec || (bits_per_tag >= 4 && bits_per_tag <= 24),
+                "SingleTable supports 2, 4-24 and 32 bits per tag");
+  // tag widths clamped to the lane size, so the unused branches still compile
+  static const size_t kLaneBits16 = bits_per_tag < 16 ? bits_per_tag : 16;
+  static const size_t kLaneBits32 = bits_per_tag < 32 ? bits_per_tag : 32;
   // NOTE: accomodate extra buckets if necessary to avoid overrun
-  // as we always read a uint64
+  // as we always read a uint64 (from inside the bucket for the generic codec)
   static const size_t kPaddingBuckets =
-      ((((kBytesPerBucket + 7) / 8) * 8) - 1) / kBytesPerBucket;
+      kGenericCodec ? (8 + kBytesPerBucket - 1) / kBytesPerBucket
+                    : ((((kBytesPerBucket + 7) / 8) * 8) - 1) / kBytesPerBucket;
 
   struct Bucket {
     char bits_[kBytesPerBucket];
@@ -32,6 +44,12 @@ class SingleTable {
   size_t num_buckets_;
 
  public:
+  // tags per bucket, which CuckooFilter sizes its bucket count by
+  static constexpr double SizingTagsPerBucket() { return kTagsPerBucket; }
+
+  // whether PowerOfTwo sizing may round the bucket count up to a power of two
+  static constexpr bool PowerOfTwoBuckets() { return true; }
+
   explicit SingleTable(const size_t num) : num_buckets_(num) {
     buckets_ = new Bucket[num_buckets_ + kPaddingBuckets];
     memset(buckets_, 0, kBytesPerBucket * (num_buckets_ + kPaddingBuckets));
@@ -45,6 +63,8 @@ class SingleTable {
 
   size_t SizeInTags() const { return kTagsPerBucket * num_buckets_; }
 
+  void PrefetchBucket(const size_t i) const { __builtin_prefetch(&buckets_[i]); }
+
   std::string Info() const {
     std::stringstream ss;
     // ss << PrintTable() << "\n";
@@ -68,9 +88,19 @@ class SingleTable {
     std::cout << "]\t";
   }
 
+  static constexpr size_t BytesPerBucket() { return kBytesPerBucket; }
+
+  // the bytes of bucket i, laid out as ReadTagAt and FindTagAt expect; reads
+  // may run up to 8 bytes past its end
+  const char *BucketBytes(const size_t i) const { return buckets_[i].bits_; }
+
   // read tag from pos(i,j)
   inline uint32_t ReadTag(const size_t i, const size_t j) const {
-    const char *p = buckets_[i].bits_;
+    return ReadTagAt(buckets_[i].bits_, j);
+  }
+
+  // read tag j of the bucket stored at p
+  static inline uint32_t ReadTagAt(const char *p, const size_t j) {
     uint32_t tag;
     /* following code only works for little-endian */
     if (bits_per_tag == 2) {
@@ -89,6 +119,9 @@ class SingleTable {
       tag = *((uint16_t *)p);
     } else if (bits_per_tag == 32) {
       tag = ((uint32_t *)p)[j];
+    } else {
+      p += (j * bits_per_tag) >> 3;
+      tag = *((uint64_t *)p) >> ((j * bits_per_tag) & 7);
     }
     return tag & kTagMask;
   }
@@ -124,6 +157,17 @@ class SingleTable {
       ((uint16_t *)p)[j] = tag;
     } else if (bits_per_tag == 32) {
       ((uint32_t *)p)[j] = tag;
+    } else {
+      // the 8-byte window may run into the next bucket (or the padding), it
+      // is written back unchanged outside of this tag's bits
+      p = reinterpret_cast<char *>(buckets_) + i * kBytesPerBucket +
+          ((j * bits_per_tag) >> 3);
+      const size_t shift = (j * bits_per_tag) & 7;
+      uint64_t v;
+      memcpy(&v, p, sizeof(v));
+      v &= ~((uint64_t)kTagMask << shift);
+      v |= (uint64_t)tag << shift;
+      memcpy(p, &v, sizeof(v));
     }
   }
 
@@ -157,26 +201,38 @@ class SingleTable {
   }
 
   inline bool FindTagInBucket(const size_t i, const uint32_t tag) const {
+    return FindTagAt(buckets_[i].bits_, tag);
+  }
+
+  // whether the bucket stored at p holds tag
+  static inline bool FindTagAt(const char *p, const uint32_t tag) {
     // caution: unaligned access & assuming little endian
     if (bits_per_tag == 4 && kTagsPerBucket == 4) {
-      const char *p = buckets_[i].bits_;
       uint64_t v = *(uint64_t *)p;  // uint16_t may suffice
       return hasvalue4(v, tag);
     } else if (bits_per_tag == 8 && kTagsPerBucket == 4) {
-      const char *p = buckets_[i].bits_;
       uint64_t v = *(uint64_t *)p;  // uint32_t may suffice
       return hasvalue8(v, tag);
     } else if (bits_per_tag == 12 && kTagsPerBucket == 4) {
-      const char *p = buckets_[i].bits_;
       uint64_t v = *(uint64_t *)p;
       return hasvalue12(v, tag);
     } else if (bits_per_tag == 16 && kTagsPerBucket == 4) {
-      const char *p = buckets_[i].bits_;
       uint64_t v = *(uint64_t *)p;
       return hasvalue16(v, tag);
+    } else if (kGenericCodec && bits_per_tag <= 16 && kTagsPerBucket == 4) {
+      // broadcast-compare of all four tags, one per 16-bit lane
+      uint64_t v = spreadfields<kLaneBits16, 16, 4>(*(uint64_t *)p);
+      return hasvalue16(v, tag);
+    } else if (kGenericCodec && kTagsPerBucket == 4) {
+      // two tags per 64-bit word in 32-bit lanes
+      uint64_t lo = spreadfields<kLaneBits32, 32, 2>(*(uint64_t *)p);
+      const char *q = p + ((2 * bits_per_tag) >> 3);
+      uint64_t hi = spreadfields<kLaneBits32, 32, 2>(
+          *(uint64_t *)q >> ((2 * bits_per_tag) & 7));
+      return hasvalue32(lo, tag) || hasvalue32(hi, tag);
     } else {
       for (size_t j = 0; j < kTagsPerBucket; j++) {
-        if (ReadTag(i, j) == tag) {
+        if (ReadTagAt(p, j) == tag) {
           return true;
         }
       }
@@ -0,0 +1,273 @@
+#ifndef CUCKOO_FILTER_THREAD_POOL_H_
+#define CUCKOO_FILTER_THREAD_POOL_H_
+
+#include <stddef.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "numatopology.h"
+
+namespace cuckoofilter {
+
+// ParallelFor with grain = 0 aims for this many ranges per thread, enough
+// for stealing to even out ranges of uneven cost
+const size_t kParallelForRangesPerThread = 8;
+
+// A pool of worker threads for the parallel stages of a build (negative
+// sweeps, seed searches, certification, sharded builds), so that stages
+// running at once, or one nested in another, share one set of workers
+// instead of each starting its own threads.
+//
+// Each worker owns a deque of tasks. It pushes and pops tasks at the back of
+// its own deque, and when that is empty steals from the front of another
+// worker's, trying the workers of its own NUMA node first. Workers are spread
+// over the nodes in contiguous blocks and pinned to the CPUs of their node,
+// so stolen work usually stays on the node. Threads outside the pool queue
+// their tasks on a shared deque.
+//
+// A thread waiting for tasks (TaskGroup::Wait, ParallelFor) runs queued tasks
+// until its own are done, rather than block. That is what lets a task start
+// a ParallelFor of its own without deadlocking or oversubscribing the CPUs:
+// the waiting worker keeps executing the inner ranges itself.
+//
+//   ThreadPool::Default().ParallelFor(0, n, 0, [&](size_t lo, size_t hi) {
+//     for (size_t i = lo; i < hi; i++) ... items[i] ...
+//   });
+//
+// Tasks must not throw.
+class ThreadPool {
+  struct Task {
+    std::function<void()> fn;
+    std::atomic<size_t> *pending;
+  };
+
+  // queues_[w] belongs to worker w; queues_[NumThreads()] takes the tasks
+  // of threads outside the pool
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+    // the queues to steal from when this one is empty, in order
+    std::vector<size_t> victims;
+  };
+
+  // set before the workers start, which read it while threads_ still grows
+  size_t num_threads_;
+  std::vector<std::unique_ptr<Queue>> queues_;
+  std::vector<std::thread> threads_;
+  // tasks in all queues
+  std::atomic<size_t> queued_;
+  std::atomic<size_t> sleepers_;
+  std::mutex sleep_mutex_;
+  std::condition_variable wake_;
+  bool stop_;
+
+  // the pool and queue of the calling thread, if it is a worker
+  struct Self {
+    const ThreadPool *pool;
+    size_t queue;
+  };
+  static Self &Current() {
+    static thread_local Self self = {nullptr, 0};
+    return self;
+  }
+
+  size_t OwnQueue() const {
+    const Self &self = Current();
+    return self.pool == this ? self.queue : num_threads_;
+  }
+
+  // pops a task from the back of queue q, or from the front when stealing
+  bool Take(const size_t q, const bool steal, Task *task) {
+    Queue &queue = *queues_[q];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) return false;
+    if (steal) {
+      *task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+    } else {
+      *task = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+    }
+    queued_--;
+    return true;
+  }
+
+  // runs one queued task, the caller's own newest one if any, and returns
+  // whether there was one. The shared queue is FIFO: tasks from outside the
+  // pool are started in order.
+  bool RunOne() {
+    const size_t own = OwnQueue();
+    Task task;
+    bool found = Take(own, own == num_threads_, &task);
+    for (size_t k = 0; !found && k < queues_[own]->victims.size(); k++) {
+      found = Take(queues_[own]->victims[k], true, &task);
+    }
+    if (!found) return false;
+    task.fn();
+    task.pending->fetch_sub(1, std::memory_order_release);
+    return true;
+  }
+
+  void Work(const size_t index, const size_t node, const bool pin) {
+    Current() = {this, index};
+    // a worker whose node the affinity excludes runs where it is allowed to
+    if (pin) NumaTopology::PinToNode(node);
+    for (;;) {
+      if (RunOne()) continue;
+      std::unique_lock<std::mutex> lock(sleep_mutex_);
+      sleepers_++;
+      wake_.wait(lock, [this] { return stop_ || queued_ > 0; });
+      sleepers_--;
+      if (stop_ && queued_ == 0) return;
+    }
+  }
+
+  template <typename Body>
+  void SplitRange(std::atomic<size_t> *pending, const size_t lo, size_t hi,
+                  const size_t grain, const Body &body) {
+    // hand the upper halves to thieves, keep the lowest grain
+    while (hi - lo > grain) {
+      const size_t mid = lo + (hi - lo + grain - 1) / grain / 2 * grain;
+      Push(pending, [this, pending, mid, hi, grain, &body]() {
+        SplitRange(pending, mid, hi, grain, body);
+      });
+      hi = mid;
+    }
+    body(lo, hi);
+  }
+
+ public:
+  // num_threads workers, by default one less than the hardware threads: the
+  // thread waiting on the pool's work runs tasks too. With pin, each worker
+  // is restricted to the CPUs of its NUMA node.
+  explicit ThreadPool(size_t num_threads = 0, const bool pin = true)
+      : queued_(0), sleepers_(0), stop_(false) {
+    if (num_threads == 0) {
+      num_threads =
+          std::max<size_t>(1, std::thread::hardware_concurrency()) - 1;
+    }
+    num_threads_ = num_threads;
+    // nodes without CPUs (memory only) get no workers
+    std::vector<size_t> cpu_nodes;
+    for (size_t n = 0; n < NumaTopology::NumNodes(); n++) {
+      if (!NumaTopology::NodeCpus()[n].empty()) cpu_nodes.push_back(n);
+    }
+    if (cpu_nodes.empty()) cpu_nodes.push_back(0);
+    std::vector<size_t> node(num_threads);
+    for (size_t w = 0; w < num_threads; w++) {
+      node[w] = cpu_nodes[w * cpu_nodes.size() / num_threads];
+    }
+    for (size_t q = 0; q <= num_threads; q++) {
+      queues_.emplace_back(new Queue());
+    }
+    // a worker steals from the workers of its node first, starting with its
+    // neighbour, then from the others, then takes tasks from outside the
+    // pool; threads outside the pool take those first
+    for (size_t w = 0; w < num_threads; w++) {
+      for (const bool same_node : {true, false}) {
+        for (size_t k = 1; k < num_threads; k++) {
+          const size_t v = (w + k) % num_threads;
+          if ((node[v] == node[w]) == same_node) {
+            queues_[w]->victims.push_back(v);
+          }
+        }
+      }
+      queues_[w]->victims.push_back(num_threads);
+    }
+    for (size_t w = 0; w < num_threads; w++) {
+      queues_[num_threads]->victims.push_back(w);
+    }
+    for (size_t w = 0; w < num_threads; w++) {
+      threads_.emplace_back(&ThreadPool::Work, this, w, node[w], pin);
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(sleep_mutex_);
+      stop_ = true;
+    }
+    wake_.notify_all();
+    for (auto &t : threads_) t.join();
+  }
+
+  // the pool the build stages share unless given another
+  static ThreadPool &Default() {
+    static ThreadPool pool;
+    return pool;
+  }
+
+  size_t NumThreads() const { return num_threads_; }
+
+  // queues fn, counting it in *pending until it has run
+  void Push(std::atomic<size_t> *pending, std::function<void()> fn) {
+    pending->fetch_add(1, std::memory_order_relaxed);
+    Queue &queue = *queues_[OwnQueue()];
+    {
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      queue.tasks.push_back({std::move(fn), pending});
+      queued_++;
+    }
+    if (sleepers_ > 0) {
+      { std::lock_guard<std::mutex> lock(sleep_mutex_); }
+      wake_.notify_one();
+    }
+  }
+
+  // runs queued tasks until *pending drops to 0
+  void Wait(const std::atomic<size_t> *pending) {
+    while (pending->load(std::memory_order_acquire) > 0) {
+      if (!RunOne()) std::this_thread::yield();
+    }
+  }
+
+  // Calls body(lo, hi) for disjoint ranges covering [begin, end), in
+  // parallel, and returns once all calls returned. Ranges start at a
+  // multiple of grain from begin and are at most grain long; grain = 0 picks
+  // one that gives every thread kParallelForRangesPerThread ranges.
+  template <typename Body>
+  void ParallelFor(const size_t begin, const size_t end, size_t grain,
+                   const Body &body) {
+    if (end <= begin) return;
+    if (grain == 0) {
+      const size_t ranges = (num_threads_ + 1) * kParallelForRangesPerThread;
+      grain = std::max<size_t>(1, (end - begin) / ranges);
+    }
+    std::atomic<size_t> pending(0);
+    SplitRange(&pending, begin, end, grain, body);
+    Wait(&pending);
+  }
+};
+
+// Tasks run on a ThreadPool that can be waited for together.
+//
+//   TaskGroup group(pool);
+//   group.Run([&] { ... });
+//   group.Run([&] { ... });
+//   group.Wait();
+class TaskGroup {
+  ThreadPool &pool_;
+  std::atomic<size_t> pending_;
+
+ public:
+  explicit TaskGroup(ThreadPool &pool = ThreadPool::Default())
+      : pool_(pool), pending_(0) {}
+
+  ~TaskGroup() { Wait(); }
+
+  void Run(std::function<void()> fn) { pool_.Push(&pending_, std::move(fn)); }
+
+  // runs queued tasks, of this group or others, until this group's are done
+  void Wait() { pool_.Wait(&pending_); }
+};
+
+}  // namespace cuckoofilter
+#endif  // CUCKOO_FILTER_THREAD_POOL_H_
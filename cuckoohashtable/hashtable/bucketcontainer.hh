@@ -14,7 +14,7 @@ namespace cuckoohashtable
 {
     /**
      * manages storage of keys for the table
-     * sized by powers of two
+     * sized by powers of two, or by an exact bucket count
      * 
      * @tparam Key - type of keys in the table
      * @tparam Allocaator - type of key allocator
@@ -47,7 +47,7 @@ namespace cuckoohashtable
         class bucket
         {
         public:
-            bucket() noexcept : occupied_() {}
+            bucket() noexcept : occupied_(), version_(0) {}
 
             const key_type &key(size_type ind) const
             {
@@ -66,6 +66,10 @@ namespace cuckoohashtable
             bool occupied(size_type ind) const { return occupied_[ind]; }
             bool &occupied(size_type ind) { return occupied_[ind]; }
 
+            // write counter for optimistic readers, odd while the bucket is being
+            // changed; it sits in what would otherwise be tail padding
+            uint32_t &version() const { return version_; }
+
         public:
             friend class bucket_container;
 
@@ -88,11 +92,17 @@ namespace cuckoohashtable
                 keys_;
             std::array<partial_t, SLOT_PER_BUCKET> partials_;
             std::array<bool, SLOT_PER_BUCKET> occupied_;
+            mutable uint32_t version_;
         };
 
-        bucket_container(size_type hp, const allocator_type &allocator) : allocator_(allocator), bucket_allocator_(allocator),
-                                                                          hashpower_(hp), buckets_(bucket_allocator_.allocate(size()))
+        bucket_container(size_type hp, const allocator_type &allocator) : bucket_container(hp, size_type(1) << hp, allocator) {}
+
+        // num_buckets may be any count up to 2^hp; hp is then only the number of
+        // index bits, and the table maps hashes onto [0, num_buckets) itself
+        bucket_container(size_type hp, size_type num_buckets, const allocator_type &allocator) : allocator_(allocator), bucket_allocator_(allocator),
+                                                                                                hashpower_(hp), num_buckets_(num_buckets), buckets_(bucket_allocator_.allocate(size()))
         {
+            assert(num_buckets <= (size_type(1) << hp));
             // The bucket default constructor is nothrow, so we don't have to
             // worry about dealing with exceptions when constructing all the
             // elements.
@@ -117,7 +127,7 @@ namespace cuckoohashtable
             hashpower_.store(val, std::memory_order_release);
         }
 
-        size_type size() const { return size_type(1) << hashpower(); }
+        size_type size() const { return num_buckets_; }
 
         allocator_type get_allocator() const { return allocator_; }
 
@@ -298,6 +308,8 @@ namespace cuckoohashtable
         // This needs to be atomic, since it can be read and written by multiple
         // threads not necessarily synchronized by a lock.
         std::atomic<size_type> hashpower_;
+        // Number of buckets allocated, 2^hashpower_ unless sized exactly.
+        size_type num_buckets_;
         // These buckets are protected by striped locks (external to the
         // BucketContainer), which must be obtained before accessing a bucket.
         bucket_pointer buckets_;
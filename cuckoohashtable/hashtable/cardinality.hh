@@ -0,0 +1,237 @@
+#ifndef CARDINALITY_HH
+#define CARDINALITY_HH
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "pipelinedbuilder.hh"
+
+namespace cuckoohashtable
+{
+    /**
+     * Default precision of a hyperloglog: 2^14 one-byte registers (16 KB, so
+     * one per thread stays in L1) for a standard error of 0.8%.
+     */
+    static const std::size_t kSketchPrecision = 14;
+
+    /**
+     * presize() reserves room for the estimate plus this many standard
+     * errors, so a build only overflows its table about once in a thousand.
+     */
+    static const double kPresizeSigmas = 3;
+
+    /**
+     * The load factor presize() sizes tables for, the one the benchmarks and
+     * example.cc build at when they know the key count.
+     */
+    static const double kPresizeMaxLoad = 0.95;
+
+    /**
+     * A HyperLogLog sketch estimating the number of distinct keys added to it.
+     *
+     * Each key is mixed, its top precision bits pick one of 2^precision
+     * registers, and the register keeps the largest rank (leading zeros + 1)
+     * the remaining bits have shown. The estimate combines the histogram of
+     * the registers with Ertl's improved estimator, which needs neither the
+     * linear counting switch nor the bias tables of the original algorithm
+     * to stay unbiased from zero keys up.
+     *
+     * Sketches of the same precision merge by taking the larger of each pair
+     * of registers, so threads sketch parts of a stream on their own and
+     * merge at the end; with AVX2 the merge takes 32 registers per
+     * instruction. Adding stays scalar: it is a scattered max into random
+     * registers, which AVX2 has no scatter or conflict detection for.
+     *
+     *   hyperloglog sketch;
+     *   sketch.add(keys.data(), keys.size());
+     *   cuckoo_hashtable<...> table(presize(sketch), sizing_mode::exact);
+     */
+    class hyperloglog
+    {
+    public:
+        /**
+         * @param precision - log<SUB>2</SUB> of the number of registers,
+         * clamped to [4, 18]
+         */
+        explicit hyperloglog(std::size_t precision = kSketchPrecision)
+            : precision_(std::min<std::size_t>(18, std::max<std::size_t>(4, precision))),
+              registers_(std::size_t(1) << precision_, 0), num_added_(0) {}
+
+        std::size_t precision() const { return precision_; }
+
+        // keys added so far, duplicates included: an upper bound on the
+        // distinct ones
+        uint64_t num_added() const { return num_added_; }
+
+        void add(const uint64_t key)
+        {
+            update(mix(key));
+            num_added_++;
+        }
+
+        void add(const uint64_t *keys, const std::size_t n)
+        {
+            for (std::size_t i = 0; i < n; i++)
+                update(mix(keys[i]));
+            num_added_ += n;
+        }
+
+        /**
+         * Folds other into this sketch, which then estimates the distinct keys
+         * added to either.
+         *
+         * @throw std::invalid_argument if the precisions differ
+         */
+        void merge(const hyperloglog &other)
+        {
+            if (other.precision_ != precision_)
+                throw std::invalid_argument("sketches differ in precision");
+            uint8_t *dst = registers_.data();
+            const uint8_t *src = other.registers_.data();
+            std::size_t i = 0;
+#ifdef __AVX2__
+            for (; i + 32 <= registers_.size(); i += 32)
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i),
+                                    _mm256_max_epu8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst + i)),
+                                                    _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i))));
+#endif
+            for (; i < registers_.size(); i++)
+                dst[i] = std::max(dst[i], src[i]);
+            num_added_ += other.num_added_;
+        }
+
+        // the estimated number of distinct keys added
+        double estimate() const
+        {
+            const std::size_t q = 64 - precision_;
+            std::vector<uint32_t> histogram(q + 2, 0);
+            for (const uint8_t r : registers_)
+                histogram[r]++;
+            const double m = registers_.size();
+            double z = m * tau(1 - histogram[q + 1] / m);
+            for (std::size_t k = q; k >= 1; k--)
+                z = 0.5 * (z + histogram[k]);
+            z += m * sigma(histogram[0] / m);
+            return 0.5 / std::log(2.0) * m * m / z;
+        }
+
+        // the relative standard error of estimate()
+        double standard_error() const { return 1.04 / std::sqrt(double(registers_.size())); }
+
+    private:
+        // fmix64 of MurmurHash3: the index and rank bits must not follow the
+        // keys' own patterns (sequential ids, shared prefixes)
+        static uint64_t mix(uint64_t h)
+        {
+            h ^= h >> 33;
+            h *= 0xff51afd7ed558ccdULL;
+            h ^= h >> 33;
+            h *= 0xc4ceb93fe53b1a87ULL;
+            h ^= h >> 33;
+            return h;
+        }
+
+        void update(const uint64_t h)
+        {
+            // the sentinel bit caps the rank at 64 - precision_ + 1
+            const uint8_t rank = __builtin_clzll((h << precision_) | (uint64_t(1) << (precision_ - 1))) + 1;
+            uint8_t &r = registers_[h >> (64 - precision_)];
+            r = std::max(r, rank);
+        }
+
+        // sigma and tau of Ertl, "New cardinality estimation algorithms for
+        // HyperLogLog sketches" (2017), correcting for the registers still
+        // empty and the ones at the largest rank
+        static double sigma(double x)
+        {
+            if (x == 1)
+                return std::numeric_limits<double>::infinity();
+            double y = 1, z = x, z_prev;
+            do
+            {
+                x *= x;
+                z_prev = z;
+                z += x * y;
+                y += y;
+            } while (z != z_prev);
+            return z;
+        }
+
+        static double tau(double x)
+        {
+            if (x == 0 || x == 1)
+                return 0;
+            double y = 1, z = 1 - x, z_prev;
+            do
+            {
+                x = std::sqrt(x);
+                z_prev = z;
+                y *= 0.5;
+                z -= (1 - x) * (1 - x) * y;
+            } while (z != z_prev);
+            return z / 3;
+        }
+
+        std::size_t precision_;
+        std::vector<uint8_t> registers_;
+        uint64_t num_added_;
+    };
+
+    /**
+     * First pass of a streamed build: runs every source to exhaustion on a
+     * thread of its own, each into its own sketch, and returns their merge.
+     * The sources are of the same kind pipelined_builder::build() takes; the
+     * second pass needs a fresh set over the same input.
+     */
+    template <class Key>
+    hyperloglog sketch_sources(std::vector<std::function<std::size_t(Key *keys, std::size_t max)>> sources,
+                               std::size_t precision = kSketchPrecision)
+    {
+        static_assert(sizeof(Key) == sizeof(uint64_t), "sketched keys are 64 bits");
+        std::vector<hyperloglog> sketches(sources.size(), hyperloglog(precision));
+        std::vector<std::thread> threads;
+        for (std::size_t r = 0; r < sources.size(); r++)
+            threads.emplace_back([&, r]()
+                                 {
+                                     Key keys[kPipelineBatchKeys];
+                                     std::size_t count;
+                                     while ((count = sources[r](keys, kPipelineBatchKeys)) > 0)
+                                         sketches[r].add(reinterpret_cast<const uint64_t *>(keys), count);
+                                 });
+        for (auto &t : threads)
+            t.join();
+        hyperloglog merged(precision);
+        for (const auto &sketch : sketches)
+            merged.merge(sketch);
+        return merged;
+    }
+
+    /**
+     * The number of slots to construct a table with, in sizing_mode::exact,
+     * to hold the distinct keys sketched at max_load: the estimate plus
+     * kPresizeSigmas standard errors, but never more than the keys added.
+     * The table is then sized once, rather than for the length of the stream
+     * or for a guess that may fill up mid-build.
+     */
+    inline std::size_t presize(const hyperloglog &sketch, double max_load = kPresizeMaxLoad)
+    {
+        assert(max_load > 0 && max_load <= 1);
+        const double upper = sketch.estimate() * (1 + kPresizeSigmas * sketch.standard_error());
+        const double distinct = std::min<double>(upper, sketch.num_added());
+        return std::max<std::size_t>(1, std::ceil(distinct / max_load));
+    }
+}
+
+#endif // CARDINALITY_HH
@@ -0,0 +1,410 @@
+#ifndef CRL_INGEST_HH
+#define CRL_INGEST_HH
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <openssl/asn1.h>
+#include <openssl/evp.h>
+
+namespace cuckoohashtable
+{
+    // fmix64 of MurmurHash3: every input bit reaches every output bit, which
+    // the table needs, as it takes bucket indexes straight from key bits
+    inline uint64_t crl_mix(uint64_t h)
+    {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb93fe53b1a87ULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    /**
+     * 64 bits identifying a CRL issuer: the first 8 bytes of the SHA-256 of
+     * the DER encoding of its Name.
+     */
+    inline uint64_t crl_issuer_key(const unsigned char *der, std::size_t len)
+    {
+        unsigned char md[EVP_MAX_MD_SIZE];
+        unsigned int md_len = 0;
+        uint64_t key = 0;
+        if (EVP_Digest(der, len, md, &md_len, EVP_sha256(), nullptr) == 1)
+            std::memcpy(&key, md, sizeof(key));
+        return key;
+    }
+
+    /**
+     * The key of a revoked certificate: its issuer's crl_issuer_key() folded
+     * with its serial number, given as the big-endian bytes of its magnitude
+     * (the content of the DER INTEGER, leading zero octets dropped, which is
+     * also what ASN1_STRING_get0_data() returns for an ASN1_INTEGER).
+     */
+    inline uint64_t crl_entry_key(const uint64_t issuer, const unsigned char *serial, std::size_t len)
+    {
+        while (len > 0 && *serial == 0)
+        {
+            serial++;
+            len--;
+        }
+        uint64_t h = crl_mix(issuer ^ len);
+        for (; len >= 8; serial += 8, len -= 8)
+        {
+            uint64_t chunk;
+            std::memcpy(&chunk, serial, sizeof(chunk));
+            h = crl_mix(h ^ chunk);
+        }
+        uint64_t tail = 0;
+        std::memcpy(&tail, serial, len);
+        return crl_mix(h ^ tail);
+    }
+
+    /**
+     * Counters of a CRL ingestion, updated by every reader as it goes.
+     */
+    struct crl_ingest_stats
+    {
+        std::atomic<uint64_t> files{0};
+        // files that could not be read or are not a DER or PEM CRL
+        std::atomic<uint64_t> failed_files{0};
+        std::atomic<uint64_t> bytes{0};
+        std::atomic<uint64_t> entries{0};
+
+        // prints the totals, and the throughput over elapsed_ns
+        void report(std::ostream &out, const uint64_t elapsed_ns) const
+        {
+            const double seconds = elapsed_ns / 1e9;
+            out << files << " CRL files (" << failed_files << " unreadable), " << std::fixed << std::setprecision(1)
+                << bytes / 1e6 << " MB, " << entries << " entries: " << bytes / 1e6 / seconds << " MB/s, "
+                << entries / 1e6 / seconds << " M entries/s\n";
+        }
+    };
+
+    /**
+     * Reads the revoked certificates of CRL files, one file at a time.
+     *
+     * The file goes into a buffer the parser keeps across files, PEM files
+     * are decoded to DER, and the DER is walked with ASN1_get_object() down
+     * to the revokedCertificates list. next() then reads entries straight out
+     * of the buffer: an entry costs a TLV walk and a hash, with no
+     * allocation, unlike d2i_X509_CRL(), which builds an X509_REVOKED per
+     * entry. Signatures and extensions are not checked. A PEM file
+     * contributes its first CRL.
+     */
+    class crl_parser
+    {
+    public:
+        crl_parser() : file_bytes_(0), p_(nullptr), end_(nullptr), issuer_(0) {}
+
+        /**
+         * Loads the CRL in @p path, replacing the previous one.
+         *
+         * @return false if the file cannot be read or holds no well-formed CRL
+         */
+        bool open(const std::string &path)
+        {
+            p_ = end_ = nullptr;
+            if (!read_file(path))
+                return false;
+            static const char kPemHeader[] = "-----BEGIN";
+            if (der_.size() >= sizeof(kPemHeader) - 1 && std::memcmp(der_.data(), kPemHeader, sizeof(kPemHeader) - 1) == 0)
+            {
+                if (!decode_pem())
+                    return false;
+            }
+            return find_revoked();
+        }
+
+        // size of the file last opened
+        std::size_t file_bytes() const { return file_bytes_; }
+
+        // crl_issuer_key() of the issuer of the CRL last opened
+        uint64_t issuer() const { return issuer_; }
+
+        /**
+         * Writes the keys (crl_entry_key()) of up to @p max more revoked
+         * certificates to @p keys, and returns how many; 0 once the CRL is
+         * exhausted. A malformed entry ends the CRL early.
+         *
+         * @tparam Key - the table's key type, a 64-bit integer
+         */
+        template <class Key>
+        std::size_t next(Key *keys, const std::size_t max)
+        {
+            static_assert(std::is_integral<Key>::value && sizeof(Key) == sizeof(uint64_t),
+                          "CRL entries map to 64-bit integer keys");
+            std::size_t count = 0;
+            while (count < max && p_ < end_)
+            {
+                const unsigned char *entry = p_;
+                long len;
+                int tag;
+                if (!next_tlv(&entry, end_, &len, &tag) || tag != V_ASN1_SEQUENCE)
+                    break;
+                p_ = entry + len;
+                const unsigned char *serial = entry;
+                if (!next_tlv(&serial, p_, &len, &tag) || tag != V_ASN1_INTEGER)
+                    break;
+                keys[count++] = static_cast<Key>(crl_entry_key(issuer_, serial, len));
+            }
+            if (count < max)
+                p_ = end_;
+            return count;
+        }
+
+    private:
+        // reads path into der_, reusing its capacity
+        bool read_file(const std::string &path)
+        {
+            const int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+                return false;
+            struct stat st;
+            bool ok = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+            if (ok)
+            {
+                der_.resize(st.st_size);
+                std::size_t done = 0;
+                while (ok && done < der_.size())
+                {
+                    const ssize_t n = ::read(fd, der_.data() + done, der_.size() - done);
+                    ok = n > 0;
+                    done += ok ? n : 0;
+                }
+            }
+            close(fd);
+            file_bytes_ = ok ? der_.size() : 0;
+            return ok;
+        }
+
+        // replaces the PEM text in der_ with the DER of its first CRL. Each
+        // base64 line goes through EVP_DecodeBlock() into a buffer kept across
+        // files; PEM_read_bio() and EVP_DecodeUpdate() decode a character at
+        // a time and run several times slower
+        bool decode_pem()
+        {
+            static const char kBegin[] = "-----BEGIN X509 CRL-----";
+            static const char kEnd[] = "-----END X509 CRL-----";
+            const char *text = reinterpret_cast<const char *>(der_.data());
+            const char *text_end = text + der_.size();
+            const char *line = std::search(text, text_end, kBegin, kBegin + sizeof(kBegin) - 1);
+            if (line == text_end)
+                return false;
+            line += sizeof(kBegin) - 1;
+            const char *body_end = std::search(line, text_end, kEnd, kEnd + sizeof(kEnd) - 1);
+            if (body_end == text_end)
+                return false;
+            pem_.resize((body_end - line) / 4 * 3 + 3);
+            std::size_t len = 0;
+            while (line < body_end)
+            {
+                while (line < body_end && (*line == '\n' || *line == '\r'))
+                    line++;
+                const char *eol = std::find(line, body_end, '\n');
+                const char *last = eol;
+                while (last > line && (last[-1] == '\r' || last[-1] == ' '))
+                    last--;
+                if (last > line)
+                {
+                    const int n = EVP_DecodeBlock(pem_.data() + len, reinterpret_cast<const unsigned char *>(line),
+                                                  static_cast<int>(last - line));
+                    if (n < 0)
+                        return false;
+                    // EVP_DecodeBlock counts the bytes '=' padding stands for
+                    len += n - (last[-1] == '=') - (last - line > 1 && last[-2] == '=');
+                }
+                line = eol;
+            }
+            pem_.resize(len);
+            der_.swap(pem_);
+            return true;
+        }
+
+        // reads the header of the DER TLV at *p, which must lie within end, and
+        // moves *p to its contents; rejects the indefinite lengths of BER
+        static bool next_tlv(const unsigned char **p, const unsigned char *end, long *len, int *tag)
+        {
+            if (*p >= end)
+                return false;
+            int cls;
+            const int ret = ASN1_get_object(p, len, tag, &cls, end - *p);
+            if ((ret & 0x80) || ret == 0x21)
+                return false;
+            if (cls != V_ASN1_UNIVERSAL)
+                *tag = -1 - cls;
+            return true;
+        }
+
+        // walks CertificateList / TBSCertList (RFC 5280, 5.1) to the contents
+        // of revokedCertificates, hashing the issuer on the way
+        bool find_revoked()
+        {
+            const unsigned char *p = der_.data();
+            const unsigned char *end = p + der_.size();
+            long len;
+            int tag;
+            // CertificateList, then tbsCertList
+            for (int level = 0; level < 2; level++)
+            {
+                if (!next_tlv(&p, end, &len, &tag) || tag != V_ASN1_SEQUENCE)
+                    return false;
+                end = p + len;
+            }
+            if (!next_tlv(&p, end, &len, &tag))
+                return false;
+            // version, optional
+            if (tag == V_ASN1_INTEGER)
+            {
+                p += len;
+                if (!next_tlv(&p, end, &len, &tag))
+                    return false;
+            }
+            // signature
+            if (tag != V_ASN1_SEQUENCE)
+                return false;
+            p += len;
+            // issuer, hashed as a whole TLV
+            const unsigned char *issuer = p;
+            if (!next_tlv(&p, end, &len, &tag) || tag != V_ASN1_SEQUENCE)
+                return false;
+            p += len;
+            issuer_ = crl_issuer_key(issuer, p - issuer);
+            // thisUpdate
+            if (!next_tlv(&p, end, &len, &tag))
+                return false;
+            p += len;
+            // nextUpdate, optional; a CRL may also end here or go on with
+            // crlExtensions, in which case nothing is revoked
+            if (!next_tlv(&p, end, &len, &tag))
+                return true;
+            if (tag == V_ASN1_UTCTIME || tag == V_ASN1_GENERALIZEDTIME)
+            {
+                p += len;
+                if (!next_tlv(&p, end, &len, &tag))
+                    return true;
+            }
+            if (tag == V_ASN1_SEQUENCE)
+            {
+                p_ = p;
+                end_ = p + len;
+            }
+            return true;
+        }
+
+        std::vector<unsigned char> der_;
+        // the other buffer of PEM decoding, swapped with der_
+        std::vector<unsigned char> pem_;
+        std::size_t file_bytes_;
+        // the revoked entries not read yet
+        const unsigned char *p_;
+        const unsigned char *end_;
+        uint64_t issuer_;
+    };
+
+    /**
+     * The CRL files of a directory, read in parallel.
+     *
+     * Each source() is a reader: it claims the next unread file, parses it
+     * with a crl_parser of its own and hands out its entries, then claims
+     * another, so readers spread over files of uneven size. Sources fit
+     * pipelined_builder directly, or can be drained into insert() batches:
+     *
+     *   crl_directory crls(dir);
+     *   pipelined_builder<table_t> builder(table, 2);
+     *   builder.build({crls.source<uint64_t>(), crls.source<uint64_t>()});
+     *   crls.stats().report(std::cout, elapsed_ns);
+     *
+     * The directory must outlive its sources.
+     */
+    class crl_directory
+    {
+    public:
+        /**
+         * Lists the regular files of @p dir, except hidden ones, in name order.
+         */
+        explicit crl_directory(const std::string &dir) : next_(0)
+        {
+            DIR *d = opendir(dir.c_str());
+            if (d == nullptr)
+                return;
+            while (const dirent *e = readdir(d))
+            {
+                if (e->d_name[0] == '.')
+                    continue;
+                const std::string path = dir + "/" + e->d_name;
+                struct stat st;
+                if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+                    paths_.push_back(path);
+            }
+            closedir(d);
+            std::sort(paths_.begin(), paths_.end());
+        }
+
+        std::size_t num_files() const { return paths_.size(); }
+
+        const crl_ingest_stats &stats() const { return stats_; }
+
+        /**
+         * A reader of the files not claimed yet, in the form of a
+         * pipelined_builder source: it fills up to max keys and returns how
+         * many, 0 once every file has been claimed and read.
+         */
+        template <class Key>
+        std::function<std::size_t(Key *, std::size_t)> source()
+        {
+            std::shared_ptr<crl_parser> parser(new crl_parser());
+            return [this, parser](Key *keys, const std::size_t max)
+            {
+                std::size_t count = 0;
+                while (count < max)
+                {
+                    const std::size_t n = parser->next(keys + count, max - count);
+                    count += n;
+                    if (count < max && !open_next(*parser))
+                        break;
+                }
+                stats_.entries.fetch_add(count, std::memory_order_relaxed);
+                return count;
+            };
+        }
+
+    private:
+        // opens the next unclaimed file that parses, skipping the others
+        bool open_next(crl_parser &parser)
+        {
+            for (;;)
+            {
+                const std::size_t i = next_.fetch_add(1, std::memory_order_relaxed);
+                if (i >= paths_.size())
+                    return false;
+                const bool ok = parser.open(paths_[i]);
+                stats_.files.fetch_add(1, std::memory_order_relaxed);
+                stats_.bytes.fetch_add(parser.file_bytes(), std::memory_order_relaxed);
+                if (ok)
+                    return true;
+                stats_.failed_files.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        std::vector<std::string> paths_;
+        std::atomic<std::size_t> next_;
+        crl_ingest_stats stats_;
+    };
+}
+
+#endif // CRL_INGEST_HH
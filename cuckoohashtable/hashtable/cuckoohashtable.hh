@@ -29,6 +29,35 @@
 
 namespace cuckoohashtable
 {
+    /**
+     * How the table turns a requested capacity into a bucket count.
+     *
+     * power_of_two rounds the bucket count up to a power of two and indexes
+     * buckets with bitmasks. exact allocates just enough buckets for the
+     * requested capacity; indexes are then mapped with a multiply-shift
+     * (fastrange) and the alternate bucket satisfies i1 + i2 == offset (mod
+     * bucket_count()), which stays an involution for any bucket count.
+     */
+    enum class sizing_mode
+    {
+        power_of_two,
+        exact,
+    };
+
+    /**
+     * With a nonzero alt_range, keys whose mixed fingerprint has none of these
+     * bits set (one in four) still take their alternate bucket from the whole
+     * table, which keeps the blocks evenly loaded. Must match
+     * cuckoofilter::kAltRangeWideMask for exported filters to agree.
+     */
+    static const uint64_t kAltRangeWideMask = 3ull << 30;
+
+    /**
+     * rehash_buckets() only spreads its worklist over threads once every thread
+     * gets at least this many buckets; below that, starting them costs more
+     * than the rehash.
+     */
+    static const std::size_t kMinRehashBucketsPerThread = 4096;
 
     template <class Key, std::size_t bits_per_key, class Hash = std::hash<Key>, class KeyEqual = std::equal_to<Key>,
               class Allocator = std::allocator<Key>, std::size_t SLOT_PER_BUCKET = 4>
@@ -66,7 +95,46 @@ namespace cuckoohashtable
      */
         cuckoo_hashtable(size_type n = (1U << 16) * 4, const Hash &hf = Hash(),
                          const KeyEqual &equal = KeyEqual(), const Allocator &alloc = Allocator()) : num_items_(0), hash_fn_(hf), eq_fn_(equal),
-                                                                                                     buckets_(reserve_calc(n), alloc), seeds_(bucket_count()), num_lookup_rds_(0) {}
+                                                                                                     buckets_(reserve_calc(n), alloc), seeds_(bucket_count()), num_lookup_rds_(0), alt_range_(0),
+                                                                                                     dirty_bits_((bucket_count() + 63) / 64), next_seeds_(bucket_count()),
+                                                                                                     key_free_cuckoo_(alt_code_fits()) {}
+
+        /**
+     * Creates a new cuckoohashtable instance with the given sizing mode
+     *
+     * @param n - number of elements to reserve space for initiallly
+     * @param mode - sizing_mode::exact to allocate ceil(n / slot_per_bucket())
+     * buckets instead of rounding up to a power of two
+     */
+        cuckoo_hashtable(size_type n, sizing_mode mode, const Hash &hf = Hash(),
+                         const KeyEqual &equal = KeyEqual(), const Allocator &alloc = Allocator()) : num_items_(0), hash_fn_(hf), eq_fn_(equal),
+                                                                                                     buckets_(reserve_calc(n), mode == sizing_mode::exact ? bucket_calc(n) : hashsize(reserve_calc(n)), alloc),
+                                                                                                     seeds_(bucket_count()), num_lookup_rds_(0), alt_range_(0),
+                                                                                                     dirty_bits_((bucket_count() + 63) / 64), next_seeds_(bucket_count()),
+                                                                                                     key_free_cuckoo_(alt_code_fits()) {}
+
+        /**
+     * Creates a new cuckoohashtable instance whose alternate buckets mostly stay
+     * close to the first bucket
+     *
+     * @param n - number of elements to reserve space for initiallly
+     * @param mode - as above; exact rounds the bucket count up to a multiple of
+     * alt_range
+     * @param alt_range - a power of two number of buckets, or 0 for the whole
+     * table. Three in four keys then take their alternate bucket within the
+     * aligned block of alt_range buckets holding their first one (vacuum filter
+     * style), so a kick or a miss touches one page instead of two. Filters
+     * exported from this table must be built with the same alt_range.
+     */
+        cuckoo_hashtable(size_type n, sizing_mode mode, size_type alt_range, const Hash &hf = Hash(),
+                         const KeyEqual &equal = KeyEqual(), const Allocator &alloc = Allocator()) : num_items_(0), hash_fn_(hf), eq_fn_(equal),
+                                                                                                     buckets_(reserve_calc(n), mode == sizing_mode::exact ? alt_range_calc(bucket_calc(n), alt_range) : hashsize(reserve_calc(n)), alloc),
+                                                                                                     seeds_(bucket_count()), num_lookup_rds_(0), alt_range_(std::min(alt_range, bucket_count()) < 2 ? 0 : std::min(alt_range, bucket_count())),
+                                                                                                     dirty_bits_((bucket_count() + 63) / 64), next_seeds_(bucket_count()),
+                                                                                                     key_free_cuckoo_(alt_code_fits())
+        {
+            assert((alt_range_ & (alt_range_ - 1)) == 0 && bucket_count() % std::max<size_type>(alt_range_, 1) == 0);
+        }
 
         /**
      * Copy constructor
@@ -96,12 +164,27 @@ namespace cuckoohashtable
 
         /**
    * Returns the hashpower of the table, which is log<SUB>2</SUB>(@ref
-   * bucket_count()).
+   * bucket_count()), rounded up for exactly sized tables.
    *
    * @return the hashpower
    */
         size_type hashpower() const { return buckets_.hashpower(); }
 
+        /**
+     * Returns the size of the blocks most alternate buckets stay within, or 0
+     * if they are spread over the whole table
+     */
+        size_type alt_range() const { return alt_range_; }
+
+        /**
+     * Returns whether cuckoo path searches run on the partial keys alone. That
+     * is the case whenever the alternate bucket code (see alt_code) fits in the
+     * partial's bits above the fingerprint: up to 2^(32 - bits_per_key) buckets,
+     * one fewer power of two for exactly sized tables with an alt_range.
+     * Larger tables fall back to reading keys during the search.
+     */
+        bool key_free_cuckoo() const { return key_free_cuckoo_; }
+
         /**
    * Returns the number of buckets in the table.
    *
@@ -109,6 +192,15 @@ namespace cuckoohashtable
    */
         size_type bucket_count() const { return buckets_.size(); }
 
+        /**
+   * Returns whether the bucket count is a power of two, in which case buckets
+   * are indexed with bitmasks rather than fastrange.
+   */
+        bool power_of_two_buckets() const
+        {
+            return (bucket_count() & (bucket_count() - 1)) == 0;
+        }
+
         /**
    * Returns whether the table is empty or not.
    *
@@ -223,26 +315,70 @@ namespace cuckoohashtable
         template <typename K>
         std::pair<size_type, size_type> insert(K &&key)
         {
-            // get hashed key
-            size_type hv = hashed_key(key);
-            partial_t fp = partial_key(hv);
+            return insert(prehash(std::forward<K>(key)));
+        }
+
+        /**
+         * A key together with everything insert() computes from it before
+         * touching the table: its two buckets and its hash under seed 0, the
+         * seed of every bucket until lookup rounds bump it.
+         */
+        struct prehashed_key
+        {
+            key_type key;
+            size_type i1, i2;
+            size_type hv;
+        };
+
+        /**
+         * Hashes @p key for a later insert(). It only reads the table's geometry,
+         * so other threads can call it while one thread inserts, e.g. to hash
+         * the next keys of a stream in parallel with the insertion of these.
+         */
+        template <typename K>
+        prehashed_key prehash(K &&key) const
+        {
+            const TwoBuckets b = compute_buckets(key);
+            const size_type hv = hashed_key(key);
+            return prehashed_key{std::forward<K>(key), b.i1, b.i2, hv};
+        }
 
-            // std::cout << "HT inserting " << key << " hv: " << hv << " fp: " << fp << "\n";
+        /**
+         * Starts loading the buckets of a key hashed by prehash(), so that an
+         * insert() issued a few keys later finds them in cache.
+         */
+        void prefetch(const prehashed_key &p) const
+        {
+            __builtin_prefetch(&buckets_[p.i1]);
+            __builtin_prefetch(&buckets_[p.i2]);
+        }
 
+        /**
+         * Inserts a key hashed by prehash() (returns inserted location). The
+         * hash is only recomputed if the key lands in a bucket whose seed has
+         * been bumped.
+         */
+        std::pair<size_type, size_type> insert(prehashed_key p)
+        {
             // find position in table
-            auto b = compute_buckets(key);
+            TwoBuckets b(p.i1, p.i2);
+            key_type &key = p.key;
             table_position pos = cuckoo_insert_loop(b, key); // finds insert spot, does not actually insert
             // std::cout << "HT inserting key " << key << ": " << pos.index << ", " << pos.slot << "\n";// status: " << pos.status << "\n";
 
             // add to bucket
             if (pos.status == ok)
             {
-                add_to_bucket(pos.index, pos.slot, fp, std::forward<K>(key));
+                // fingerprint under the seed of the bucket it lands in, which may
+                // have been bumped by earlier lookup rounds
+                const size_type hv = seeds_[pos.index] == 0 ? p.hv : hashed_key(key, seeds_[pos.index]);
+                const partial_t fp = partial_key(hv) | stored_alt_code(hashpower(), key, pos.index);
+                add_to_bucket(pos.index, pos.slot, fp, std::move(key));
                 num_items_++;
             }
             else
             {
-                std::cout << "status NOT ok: " << pos.status << "\n";
+                // already stored: streamed inputs may repeat keys
                 assert(pos.status == failure_key_duplicated);
             }
             return std::make_pair(pos.index, pos.slot);
@@ -266,7 +402,7 @@ namespace cuckoohashtable
             auto b = compute_buckets(key);
 
             // search in both buckets
-            const table_position pos = cuckoo_find(key, b.i1, b.i2);
+            const table_position pos = cuckoo_find_stable(key, b.i1, b.i2);
             // return pos.status == ok;
             // return std::make_pair(pos.index, pos.slot);
             if (pos.status == ok)
@@ -294,21 +430,25 @@ namespace cuckoohashtable
             return num_lookup_rds_ - 1;
         }
 
+        // lookup checks key's fingerprints against both of its buckets. A bucket
+        // that matches gets its seed bumped, but only in next_seeds_: the bucket
+        // keeps hashing with its published seed, matching its stored fingerprints,
+        // until rehash_buckets() rewrites both at once.
         template <typename K>
         int32_t lookup(const K &key) const
         {
             // find position in table
             auto b = compute_buckets(key);
 
-            // get fingerprint
-            uint64_t hv1 = hashed_key(key, seeds_.at(b.i1));
-            uint64_t hv2 = hashed_key(key, seeds_.at(b.i2));
-            partial_t fp1 = partial_key(hv1);
-            partial_t fp2 = partial_key(hv2);
-
-            // search in both buckets
-            const table_position pos1 = cuckoo_find_fp(fp1, b.i1);
-            const table_position pos2 = cuckoo_find_fp(fp2, b.i2);
+            // get fingerprints under the published seeds and search in both
+            // buckets, as one consistent read of the pair
+            const std::pair<table_position, table_position> found = read_stable(b.i1, b.i2, [&]()
+                                                                                {
+                partial_t fp1 = partial_key(hashed_key(key, seeds_[b.i1]));
+                partial_t fp2 = partial_key(hashed_key(key, seeds_[b.i2]));
+                return std::make_pair(cuckoo_find_fp(fp1, b.i1), cuckoo_find_fp(fp2, b.i2)); });
+            const table_position pos1 = found.first;
+            const table_position pos2 = found.second;
             // return pos.status == ok;
 
             // omg this outer conditional is necessary if false pos. happen to occur in BOTH buckets - pos1 cannot return yet to check pos2 also
@@ -321,12 +461,7 @@ namespace cuckoohashtable
                     if (pos1.index != b.i1)
                         return -1;
 
-                    uint16_t &seed = seeds_.at(pos1.index);
-                    if (seed < num_lookup_rds_)
-                    {
-                        seed++;
-                        // std::cout << "fp on key: " << key << " hv: " << hv << " fp: " << fp << " at pos " << pos.index << ", " << pos.slot << ", seed to " << seed << "\n";
-                    }
+                    bump_seed(pos1.index);
                     // return fp1;
                     // return pos1.index;
                 }
@@ -341,12 +476,7 @@ namespace cuckoohashtable
                 if (pos2.status == ok)
                 {
                     assert(pos2.index == b.i2);
-                    uint16_t &seed = seeds_.at(pos2.index);
-                    if (seed < num_lookup_rds_)
-                    {
-                        seed++;
-                        // std::cout << "fp on key: " << key << " hv: " << hv << " fp: " << fp << " at pos " << pos.index << ", " << pos.slot << ", seed to " << seed << "\n";
-                    }
+                    bump_seed(pos2.index);
                     // return fp2;
                     return pos2.index;
                 }
@@ -356,33 +486,46 @@ namespace cuckoohashtable
         }
 
         // returns number of buckets rehashed during after a lookup round
+        //
+        // Only the buckets lookup() bumped a seed of since the last call are
+        // visited, so the cost follows the number of false positives rather than
+        // the table size. Large worklists are split across threads; the buckets
+        // are distinct, so the threads never write the same bucket.
         uint32_t rehash_buckets()
         {
-            uint32_t b_count = 0;
-            uint32_t last_index;
-            for (uint32_t i = 0; i < seeds_.size(); i++)
+            return rehash_buckets(spawn_threads());
+        }
+
+        /**
+         * rehash_buckets() with the worklist split by @p parallel_for instead of
+         * threads of its own, e.g. to share a thread pool with the other stages
+         * of a build. It is called as parallel_for(count, min_per_task, body)
+         * and must call body(begin, end) on disjoint ranges covering [0, count),
+         * each of at least min_per_task buckets unless count is smaller.
+         */
+        template <typename ParallelFor>
+        uint32_t rehash_buckets(ParallelFor &&parallel_for)
+        {
+            // lookups keep queueing buckets while these are rehashed, into a
+            // fresh dirty_ for the next call
+            std::vector<size_type> work;
             {
-                if (seeds_.at(i) == num_lookup_rds_) // incremented if false pos. during lookup for fp's
-                {
-                    last_index = i;
-                    b_count++;
-                    bucket &b = buckets_[i];
-                    for (uint8_t j = 0; j < static_cast<int>(slot_per_bucket()); ++j)
-                    {
-                        // rehash fp's at bucket index i
-                        const size_type key = b.key(j);
-                        size_type hv = hashed_key(key, seeds_.at(i));
-                        partial_t fp = partial_key(hv);
-                        if (b.occupied(j))
-                            fp_to_bucket(i, j, fp);
-                    }
-                }
+                std::lock_guard<std::mutex> lock(dirty_lock_.mutex);
+                work.swap(dirty_);
             }
+            // in bucket order, so each thread sweeps its share of the table forwards
+            std::sort(work.begin(), work.end());
+            const size_type count = work.size();
+            parallel_for(count, kMinRehashBucketsPerThread, [this, &work](const size_type begin, const size_type end)
+                         { rehash_dirty(work, begin, end); });
+            return count;
+        }
 
-            // if (b_count == 1)
-            //     cout << "LAST REHASHED BUCKET: " << last_index << "\n";
-
-            return b_count;
+        // number of buckets waiting for rehash_buckets()
+        size_type num_dirty_buckets() const
+        {
+            std::lock_guard<std::mutex> lock(dirty_lock_.mutex);
+            return dirty_.size();
         }
 
         uint16_t get_seed(const size_t i) const
@@ -407,7 +550,7 @@ namespace cuckoohashtable
                 std::vector<key_type> fp_bucket;
                 for (int j = 0; j < static_cast<int>(slot_per_bucket()); j++)
                 {
-                    fp_bucket.push_back(buckets_[i].partial(j));
+                    fp_bucket.push_back(buckets_[i].partial(j) & fp_mask());
                 }
                 fp_table.push_back(fp_bucket);
             }
@@ -447,12 +590,21 @@ namespace cuckoohashtable
             return fp;
         }
 
+        // fast_range maps a 32-bit hash onto [0, n) with a multiply-shift, which
+        // is much cheaper than a modulo (Lemire's "fastrange").
+        static inline size_type fast_range(const uint32_t hash, const size_type n)
+        {
+            return static_cast<size_type>((static_cast<uint64_t>(hash) * n) >> 32);
+        }
+
         // index_hash returns the first possible bucket that the given hashed key
         // could be.
-        static inline size_type index_hash(const size_type hp, const size_type key) // hv
+        inline size_type index_hash(const size_type hp, const size_type key) const // hv
         {
             const uint32_t hash = key >> 32;
-            return hash & hashmask(hp);
+            if (power_of_two_buckets())
+                return hash & hashmask(hp);
+            return fast_range(hash, bucket_count());
             // return hv & hashmask(hp);
         }
 
@@ -461,8 +613,12 @@ namespace cuckoohashtable
         // this function will return the first possible bucket if index is the
         // second possible bucket, so alt_index(ti, partial, alt_index(ti, partial,
         // index_hash(ti, hv))) == index_hash(ti, hv).
-        static inline size_type alt_index(const size_type hp, const size_type key,
-                                          const size_type index)
+        //
+        // For exactly sized tables the XOR below would leave [0, bucket_count()),
+        // so the alternate bucket is offset - index (mod bucket_count()) instead,
+        // with the offset derived from the same nonzero fp.
+        inline size_type alt_index(const size_type hp, const size_type key,
+                                   const size_type index) const
         {
             // (libcuckoo) ensure fp is nonzero for the multiply. 0xc6a4a7935bd1e995 is the
             // hash constant from 64-bit MurmurHash2
@@ -471,11 +627,89 @@ namespace cuckoohashtable
 
             // >> (right shift)
             const size_t fp = (key >> hp) + 1;
+            const uint64_t mixed = fp * 0xc6a4a7935bd1e995;
             // std::cout << "HT hp: " << hp << ", right shift: " << fp << "key: " << key << "\n";
 
+            // page-local: stay within the aligned block of alt_range_ buckets,
+            // except for the keys with no kAltRangeWideMask bit set
+            if (alt_range_ != 0 && (mixed & kAltRangeWideMask) != 0)
+            {
+                const size_type delta = (mixed >> 32) & (alt_range_ - 1);
+                return index ^ (delta == 0 ? 1 : delta);
+            }
+
+            if (!power_of_two_buckets())
+            {
+                const size_type n = bucket_count();
+                const size_type offset = fast_range(static_cast<uint32_t>(mixed >> 32), n);
+                return index <= offset ? offset - index : offset + n - index;
+            }
+
             // ^ (bitwise XOR), & (bitwise AND)
             // std::cout << "HT hashmask(hp): " << hashmask(hp) << "\n";
-            return (index ^ (fp * 0xc6a4a7935bd1e995)) & hashmask(hp);
+            return (index ^ mixed) & hashmask(hp);
+        }
+
+        // fp_mask selects the fingerprint in a stored partial; the bits above it
+        // hold the alt code when key_free_cuckoo_
+        static constexpr partial_t fp_mask()
+        {
+            return static_cast<partial_t>((1ULL << bits_per_key) - 1);
+        }
+
+        // alt_code_bits is the width of an alt code: a bucket index, plus a flag
+        // for exactly sized tables with an alt_range
+        size_type alt_code_bits() const
+        {
+            return hashpower() + (!power_of_two_buckets() && alt_range_ != 0);
+        }
+
+        bool alt_code_fits() const
+        {
+            return bits_per_key + alt_code_bits() <= 8 * sizeof(partial_t);
+        }
+
+        // alt_code encodes the pair of buckets of key, given either of them, so
+        // that alt_from_code can map either bucket to the other without the key:
+        // i1 ^ i2 for power of two tables, where both alternate schemes XOR;
+        // i1 + i2 (mod bucket_count()) for exact ones, tagged with whether the
+        // pair is block-local (XOR) if the table has an alt_range.
+        size_type alt_code(const size_type hp, const size_type key, const size_type index) const
+        {
+            const size_type alt = alt_index(hp, key, index);
+            if (power_of_two_buckets())
+                return index ^ alt;
+            if (alt_range_ != 0)
+            {
+                const uint64_t mixed = ((key >> hp) + 1) * 0xc6a4a7935bd1e995;
+                if (mixed & kAltRangeWideMask)
+                    return ((index ^ alt) << 1) | 1;
+                return ((index + alt) % bucket_count()) << 1;
+            }
+            return (index + alt) % bucket_count();
+        }
+
+        size_type alt_from_code(const size_type index, size_type code) const
+        {
+            if (power_of_two_buckets())
+                return index ^ code;
+            if (alt_range_ != 0)
+            {
+                if (code & 1)
+                    return index ^ (code >> 1);
+                code >>= 1;
+            }
+            const size_type n = bucket_count();
+            return index <= code ? code - index : code + n - index;
+        }
+
+        // stored_alt_code is alt_code placed above the fingerprint, or 0 when
+        // the partials do not carry it
+        partial_t stored_alt_code(const size_type hp, const size_type key, const size_type index) const
+        {
+            if (!key_free_cuckoo_)
+                return 0;
+            return static_cast<partial_t>(alt_code(hp, key, index) << bits_per_key);
         }
 
         class TwoBuckets
@@ -547,6 +781,41 @@ namespace cuckoohashtable
             return table_position{0, 0, failure_key_not_found};
         }
 
+        // cuckoo_find_stable is cuckoo_find as one consistent read (see
+        // read_stable). A hit in i1 only needs i1 to have been stable, so the
+        // common case does not touch i2. A miss in i1 then reads i2 under its own
+        // version; i1 staying unchanged until i2 is validated makes the pair a
+        // snapshot as of the i2 read.
+        template <typename K>
+        table_position cuckoo_find_stable(const K &key, const size_type i1, const size_type i2) const
+        {
+            for (;;)
+            {
+                const uint32_t v1 = __atomic_load_n(&buckets_[i1].version(), __ATOMIC_ACQUIRE);
+                if (v1 & 1)
+                    continue;
+                int slot = try_read_from_bucket(buckets_[i1], key);
+                if (slot != -1)
+                {
+                    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+                    if (__atomic_load_n(&buckets_[i1].version(), __ATOMIC_RELAXED) == v1)
+                        return table_position{i1, static_cast<size_type>(slot), ok};
+                    continue;
+                }
+                const uint32_t v2 = __atomic_load_n(&buckets_[i2].version(), __ATOMIC_ACQUIRE);
+                if (v2 & 1)
+                    continue;
+                slot = try_read_from_bucket(buckets_[i2], key);
+                __atomic_thread_fence(__ATOMIC_ACQUIRE);
+                if (__atomic_load_n(&buckets_[i1].version(), __ATOMIC_RELAXED) != v1 ||
+                    __atomic_load_n(&buckets_[i2].version(), __ATOMIC_RELAXED) != v2)
+                    continue;
+                if (slot != -1)
+                    return table_position{i2, static_cast<size_type>(slot), ok};
+                return table_position{0, 0, failure_key_not_found};
+            }
+        }
+
         table_position cuckoo_find_fp(const partial_t &fp1, const size_type i1) const
         {
             int slot;
@@ -584,7 +853,7 @@ namespace cuckoohashtable
         {
             for (int i = 0; i < static_cast<int>(slot_per_bucket()); ++i)
             {
-                if (key_eq()(p, b.partial(i)))
+                if (key_eq()(p, b.partial(i) & fp_mask()))
                 {
                     // std::cout << "found " << p << " == " << b.partial(i) << " at slot " << i << "\n";
                     return i;
@@ -708,12 +977,199 @@ namespace cuckoohashtable
         template <typename K>                                                                             // , typename... Args
         void add_to_bucket(const size_type bucket_ind, const size_type slot, const partial_t fp, K &&key) // , Args &&... k
         {
+            const bucket_write_guard guard(*this, bucket_ind);
             buckets_.setK(bucket_ind, slot, fp, std::forward<K>(key)); // , std::forward<Args>(k)...
         }
 
+        // read_stable runs read, which may only read buckets i1 and i2 and their
+        // seeds, until it gets a run no write overlapped, and returns its result.
+        // Writers bump a bucket's version (kept in the bucket, so it costs no
+        // extra cache miss) to odd before changing it and back to even after, so a run is consistent iff both versions were even and
+        // unchanged around it (a seqlock per bucket). Readers never wait on a
+        // lock; they only retry, and only while a write to one of their two
+        // buckets is in progress. Keys are read while they may be changing, so
+        // this relies on them being trivially copyable, like the 64-bit keys and
+        // hashes the table is used with.
+        template <typename F>
+        auto read_stable(const size_type i1, const size_type i2, F read) const -> decltype(read())
+        {
+            for (;;)
+            {
+                const uint32_t v1 = __atomic_load_n(&buckets_[i1].version(), __ATOMIC_ACQUIRE);
+                const uint32_t v2 = __atomic_load_n(&buckets_[i2].version(), __ATOMIC_ACQUIRE);
+                if ((v1 | v2) & 1)
+                    continue;
+                const auto result = read();
+                __atomic_thread_fence(__ATOMIC_ACQUIRE);
+                if (__atomic_load_n(&buckets_[i1].version(), __ATOMIC_RELAXED) == v1 &&
+                    __atomic_load_n(&buckets_[i2].version(), __ATOMIC_RELAXED) == v2)
+                    return result;
+            }
+        }
+
+        // bucket_write_guard marks one or two buckets as being written for its
+        // lifetime (see read_stable). Writes come from a single maintenance
+        // thread, or from rehash_buckets() threads owning disjoint buckets.
+        class bucket_write_guard
+        {
+        public:
+            bucket_write_guard(const cuckoo_hashtable &table, const size_type i1)
+                : bucket_write_guard(table, i1, i1) {}
+
+            bucket_write_guard(const cuckoo_hashtable &table, const size_type i1, const size_type i2)
+                : buckets_(table.buckets_), i1_(i1), i2_(i2)
+            {
+                begin(i1_);
+                if (i2_ != i1_)
+                    begin(i2_);
+                __atomic_thread_fence(__ATOMIC_RELEASE);
+            }
+
+            ~bucket_write_guard()
+            {
+                if (i2_ != i1_)
+                    end(i2_);
+                end(i1_);
+            }
+
+        private:
+            void begin(const size_type i)
+            {
+                uint32_t &version = buckets_[i].version();
+                __atomic_store_n(&version, version + 1, __ATOMIC_RELAXED);
+            }
+
+            void end(const size_type i)
+            {
+                uint32_t &version = buckets_[i].version();
+                __atomic_store_n(&version, version + 1, __ATOMIC_RELEASE);
+            }
+
+            const buckets_t &buckets_;
+            const size_type i1_, i2_;
+        };
+
+        // the parallel_for of rehash_buckets(): a thread per min_per_thread
+        // items, up to the number of hardware threads
+        struct spawn_threads
+        {
+            template <typename Body>
+            void operator()(const size_type count, const size_type min_per_thread, const Body &body) const
+            {
+                const size_type num_threads = std::max<size_type>(1, std::min<size_type>(std::thread::hardware_concurrency(),
+                                                                                         count / min_per_thread));
+                if (num_threads == 1)
+                {
+                    body(0, count);
+                    return;
+                }
+                std::vector<std::thread> threads;
+                for (size_type t = 0; t < num_threads; ++t)
+                    threads.emplace_back(body, count * t / num_threads, count * (t + 1) / num_threads);
+                for (auto &t : threads)
+                    t.join();
+            }
+        };
+
+        // bump_seed moves the pending seed of bucket i up by one for each false
+        // positive lookup() finds in it, so a round with several in one bucket
+        // bumps it several times; it stops at num_lookup_rds_, the most rounds
+        // the seed can have needed. Lookups run concurrently, so the increment
+        // is a compare-and-swap.
+        void bump_seed(const size_type i) const
+        {
+            uint16_t &seed = next_seeds_.at(i);
+            uint16_t current = __atomic_load_n(&seed, __ATOMIC_RELAXED);
+            while (current < num_lookup_rds_)
+            {
+                if (__atomic_compare_exchange_n(&seed, &current, uint16_t(current + 1), false, __ATOMIC_RELAXED,
+                                                __ATOMIC_RELAXED))
+                {
+                    mark_dirty(i);
+                    return;
+                }
+            }
+        }
+
+        // mark_dirty queues bucket i for the next rehash_buckets(), once. The bit
+        // is claimed atomically so that concurrent lookups queue it only once;
+        // the append itself is rare (one per bucket per round) and takes a lock.
+        void mark_dirty(const size_type i) const
+        {
+            const uint64_t bit = uint64_t(1) << (i % 64);
+            // release: a rehash that clears the bit after this sees the bump
+            if (__atomic_fetch_or(&dirty_bits_[i / 64], bit, __ATOMIC_ACQ_REL) & bit)
+                return;
+            std::lock_guard<std::mutex> lock(dirty_lock_.mutex);
+            dirty_.push_back(i);
+        }
+
+        // rehash_dirty publishes the pending seeds of the buckets in
+        // work[begin, end) together with the fingerprints recomputed under
+        // them, one write section per bucket. Buckets go through in
+        // batches: the occupied slots of a batch are gathered first, then hashed
+        // in one loop of independent hashes, which the CPU overlaps (or the
+        // compiler vectorizes, for an inlinable hash), then written back. Empty
+        // slots are skipped before their key is read.
+        //
+        // Each bucket's dirty bit is cleared before its pending seed is read,
+        // once: a lookup bumping the seed after that queues the bucket again
+        // for the next call, rather than have its bump dropped or published
+        // without the fingerprints to match.
+        void rehash_dirty(const std::vector<size_type> &work, const size_type begin, const size_type end)
+        {
+            static constexpr size_type kBatch = 16;
+            const key_type *keys[kBatch * SLOT_PER_BUCKET];
+            uint16_t seeds[kBatch * SLOT_PER_BUCKET];
+            size_type where[kBatch * SLOT_PER_BUCKET];
+            uint64_t hvs[kBatch * SLOT_PER_BUCKET];
+            // the slots of work[first + d] are where[ends[d - 1] .. ends[d]),
+            // to be published with seed bucket_seeds[d]
+            size_type ends[kBatch];
+            uint16_t bucket_seeds[kBatch];
+            for (size_type first = begin; first < end; first += kBatch)
+            {
+                const size_type last = std::min(first + kBatch, end);
+                for (size_type d = last; d < std::min(last + kBatch, end); ++d)
+                    __builtin_prefetch(&buckets_[work[d]]);
+
+                size_type m = 0;
+                for (size_type d = first; d < last; ++d)
+                {
+                    const size_type i = work[d];
+                    __atomic_fetch_and(&dirty_bits_[i / 64], ~(uint64_t(1) << (i % 64)), __ATOMIC_ACQ_REL);
+                    const uint16_t seed = __atomic_load_n(&next_seeds_[i], __ATOMIC_RELAXED);
+                    bucket_seeds[d - first] = seed;
+                    const bucket &b = buckets_[i];
+                    for (size_type j = 0; j < slot_per_bucket(); ++j)
+                    {
+                        if (!b.occupied(j))
+                            continue;
+                        keys[m] = &b.key(j);
+                        seeds[m] = seed;
+                        where[m] = j;
+                        m++;
+                    }
+                    ends[d - first] = m;
+                }
+                for (size_type k = 0; k < m; ++k)
+                    hvs[k] = hashed_key(*keys[k], seeds[k]);
+                for (size_type d = first, k = 0; d < last; ++d)
+                {
+                    const size_type i = work[d];
+                    const bucket_write_guard guard(*this, i);
+                    seeds_[i] = bucket_seeds[d - first];
+                    for (; k < ends[d - first]; ++k)
+                        fp_to_bucket(i, where[k], partial_key(hvs[k]));
+                }
+            }
+        }
+
+        // fp_to_bucket replaces the fingerprint of a slot, keeping its alt code
         void fp_to_bucket(const size_type bucket_ind, const size_type slot, const partial_t fp)
         {
-            buckets_.setFP(bucket_ind, slot, fp);
+            const partial_t code = buckets_[bucket_ind].partial(slot) & ~fp_mask();
+            buckets_.setFP(bucket_ind, slot, fp | code);
         }
 
         // try_find_insert_bucket will search the bucket for the given key, and for
@@ -754,6 +1210,9 @@ namespace cuckoohashtable
             size_type bucket;
             size_type slot;
             size_type key;
+            // the stored partial, which identifies the item instead of key when
+            // key_free_cuckoo_
+            partial_t partial;
         } CuckooRecord;
 
         // The maximum number of items in a cuckoo BFS path. It determines the
@@ -834,26 +1293,36 @@ namespace cuckoohashtable
                 {
                     return 0;
                 }
-                first.key = b.key(first.slot);
+                record(first, b);
             }
             for (int i = 1; i <= x.depth; ++i)
             {
                 CuckooRecord &curr = cuckoo_path[i];
                 const CuckooRecord &prev = cuckoo_path[i - 1];
-                assert(prev.bucket == index_hash(hp, prev.key) || prev.bucket == alt_index(hp, prev.key, index_hash(hp, prev.key)));
+                assert(key_free_cuckoo_ || prev.bucket == index_hash(hp, prev.key) || prev.bucket == alt_index(hp, prev.key, index_hash(hp, prev.key)));
                 // We get the bucket that this slot is on by computing the alternate index of the previous bucket
-                curr.bucket = alt_index(hp, prev.key, prev.bucket);
+                curr.bucket = key_free_cuckoo_ ? alt_from_code(prev.bucket, prev.partial >> bits_per_key)
+                                               : alt_index(hp, prev.key, prev.bucket);
                 const bucket &b = buckets_[curr.bucket];
                 if (!b.occupied(curr.slot))
                 {
                     // We can terminate here!
                     return i;
                 }
-                curr.key = b.key(curr.slot);
+                record(curr, b);
             }
             return x.depth;
         }
 
+        // record identifies the item in rec.slot of b for cuckoopath_move, by its
+        // partial alone when the search is key-free
+        void record(CuckooRecord &rec, const bucket &b) const
+        {
+            rec.partial = b.partial(rec.slot);
+            if (!key_free_cuckoo_)
+                rec.key = b.key(rec.slot);
+        }
+
         // cuckoopath_move moves keys along the given cuckoo path in order to make
         // an empty slot in one of the buckets in cuckoo_insert.
         bool cuckoopath_move(const size_type hp, CuckooRecords &cuckoo_path, size_type depth, TwoBuckets &b)
@@ -891,14 +1360,26 @@ namespace cuckoohashtable
                 // std::cout << "from: " << from.bucket << ", " << from.slot << "\n";
                 // std::cout << "to: " << to.bucket << ", " << to.slot << "\n";
 
-                // checks valid cuckoo, and that the hash value is the same
-                if (tb.occupied(ts) || !fb.occupied(fs) || fb.key(fs) != from.key)
+                // checks valid cuckoo, and that the slot still holds the item found
+                // by the search
+                if (tb.occupied(ts) || !fb.occupied(fs) || fb.partial(fs) != from.partial ||
+                    (!key_free_cuckoo_ && fb.key(fs) != from.key))
                 {
                     return false;
                 }
 
-                buckets_.setK(to.bucket, ts, fb.partial(fs), std::move(fb.key(fs)));
-                buckets_.eraseK(from.bucket, fs);
+                {
+                    // one write section over both ends, so a reader never sees
+                    // the key in neither bucket
+                    const bucket_write_guard guard(*this, to.bucket, from.bucket);
+                    // the alt code is the same from either bucket; the fingerprint
+                    // only needs rehashing if the seeds differ
+                    const partial_t fp = seeds_[to.bucket] == seeds_[from.bucket]
+                                             ? fb.partial(fs)
+                                             : partial_key(hashed_key(fb.key(fs), seeds_[to.bucket])) | (fb.partial(fs) & ~fp_mask());
+                    buckets_.setK(to.bucket, ts, fp, std::move(fb.key(fs)));
+                    buckets_.eraseK(from.bucket, fs);
+                }
                 depth--;
                 // std::cout << "depth: " << depth << "\n";
             }
@@ -1020,11 +1501,12 @@ namespace cuckoohashtable
                     // If x has less than the maximum number of path components,
                     // create a new b_slot item, that represents the bucket we could
                     // have to come from if we kicked out the item at this slot.
-                    const size_type key = b.key(slot);
                     if (x.depth < MAX_BFS_PATH_LEN - 1)
                     {
                         assert(!q.full());
-                        b_slot y(alt_index(hp, key, x.bucket), x.pathcode * slot_per_bucket() + slot, x.depth + 1);
+                        const size_type alt = key_free_cuckoo_ ? alt_from_code(x.bucket, b.partial(slot) >> bits_per_key)
+                                                               : alt_index(hp, b.key(slot), x.bucket);
+                        b_slot y(alt, x.pathcode * slot_per_bucket() + slot, x.depth + 1);
                         q.enqueue(y);
                     }
                 }
@@ -1049,6 +1531,25 @@ namespace cuckoohashtable
             return blog2;
         }
 
+        // bucket_calc returns the smallest number of buckets that will hold n
+        // elements, for exactly sized tables.
+        static size_type bucket_calc(const size_type n)
+        {
+            return std::max<size_type>(1, (n + slot_per_bucket() - 1) / slot_per_bucket());
+        }
+
+        // alt_range_calc rounds an exact bucket count so that it splits into
+        // whole blocks of alt_range buckets: a multiple of alt_range, or the next
+        // power of two if it is smaller than one block.
+        static size_type alt_range_calc(const size_type buckets, const size_type alt_range)
+        {
+            if (alt_range < 2)
+                return buckets;
+            if (buckets < alt_range)
+                return hashsize(reserve_calc(buckets * slot_per_bucket()));
+            return (buckets + alt_range - 1) / alt_range * alt_range;
+        }
+
         // Member variables
 
         // The hash function
@@ -1065,8 +1566,33 @@ namespace cuckoohashtable
         // necessary.
         mutable buckets_t buckets_;
 
-        mutable std::vector<uint16_t> seeds_;
+        // the seed each bucket's stored fingerprints were computed with
+        std::vector<uint16_t> seeds_;
         mutable size_t num_lookup_rds_;
+
+        // 0, or the size of the aligned blocks most alternate buckets stay in
+        size_type alt_range_;
+
+        // buckets whose seed lookup() bumped since the last rehash_buckets(), and
+        // one bit per bucket marking membership
+        mutable std::vector<size_type> dirty_;
+        mutable std::vector<uint64_t> dirty_bits_;
+
+        // a mutex that copies of the table get a fresh one of
+        struct copyable_mutex
+        {
+            std::mutex mutex;
+            copyable_mutex() {}
+            copyable_mutex(const copyable_mutex &) {}
+            copyable_mutex &operator=(const copyable_mutex &) { return *this; }
+        };
+        mutable copyable_mutex dirty_lock_;
+
+        // the seeds lookup() bumped, published to seeds_ by rehash_buckets()
+        mutable std::vector<uint16_t> next_seeds_;
+
+        // whether partials carry the alt code, so cuckoo path searches need no keys
+        bool key_free_cuckoo_;
     };
 
 }; // namespace cuckoohashtable
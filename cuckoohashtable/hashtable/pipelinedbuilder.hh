@@ -0,0 +1,261 @@
+#ifndef PIPELINED_BUILDER_HH
+#define PIPELINED_BUILDER_HH
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "ringbuffer.hh"
+
+namespace cuckoohashtable
+{
+    /**
+     * Keys travel between the stages of a pipelined_builder in batches of this
+     * many, so the rings are touched once per batch rather than once per key.
+     */
+    static const std::size_t kPipelineBatchKeys = 256;
+
+    /**
+     * Batches each ring between two stages holds: enough to absorb a reader
+     * stalled on I/O or a burst of long cuckoo paths without stopping the
+     * other stages.
+     */
+    static const std::size_t kPipelineRingBatches = 64;
+
+    /**
+     * The owner prefetches the buckets of the key this many places ahead of
+     * the one it inserts: its buckets are known before its turn, so their
+     * cache misses overlap with the inserts in between.
+     */
+    static const std::size_t kPipelinePrefetchKeys = 8;
+
+    /**
+     * Builds a table from streamed keys in three overlapping stages:
+     *
+     *   readers       one thread per source, each pulling keys from its
+     *                 source (parsing a file, a socket...) into batches
+     *   hash workers  compute the buckets and base hash of every key with
+     *                 table.prehash()
+     *   owner         the calling thread, the only one to touch the table,
+     *                 inserts the pre-hashed keys
+     *
+     * Readers spread their batches over the hash workers' mpsc_rings, and each
+     * hash worker hands its results to the owner through an spsc_ring of its
+     * own. Every stage only waits when its input is empty or its output full,
+     * so the owner never waits on I/O or hashing as long as the earlier stages
+     * keep up: it is busy inserting while the next keys are read and hashed.
+     *
+     * There is a single owner rather than one per bucket range because a
+     * cuckoo path can move keys anywhere in the table (alt_range only keeps
+     * three in four alternates in their block), so ranges could not be
+     * inserted into independently.
+     *
+     *   pipelined_builder<table_t> builder(table, 2);
+     *   builder.build({reader_a, reader_b});
+     *
+     * @tparam Table - a cuckoo_hashtable
+     */
+    template <class Table>
+    class pipelined_builder
+    {
+    public:
+        using key_type = typename Table::key_type;
+        using size_type = typename Table::size_type;
+
+        /**
+         * A source fills up to max keys, returning how many it wrote; 0 means
+         * it is exhausted. Each is called from a reader thread of its own.
+         */
+        using source = std::function<std::size_t(key_type *keys, std::size_t max)>;
+
+        /**
+         * @param table - the table to insert into; only build() may use it
+         * until build() returns
+         * @param num_hash_workers - threads hashing keys between the readers and
+         * the owner
+         */
+        explicit pipelined_builder(Table &table, std::size_t num_hash_workers = 1)
+            : table_(table), num_hash_workers_(std::max<std::size_t>(1, num_hash_workers)), owner_wait_ns_(0) {}
+
+        /**
+         * Runs every source to exhaustion and inserts all their keys into the
+         * table, returning the number of keys read. The keys of one source are
+         * inserted in order when there is a single hash worker; otherwise
+         * batches from different workers interleave.
+         *
+         * @throw whatever table.insert() throws (std::out_of_range once the table
+         * is full), after the other stages have stopped
+         */
+        std::size_t build(std::vector<source> sources)
+        {
+            std::vector<std::unique_ptr<mpsc_ring<key_batch>>> keys;
+            std::vector<std::unique_ptr<spsc_ring<hashed_batch>>> hashed;
+            for (std::size_t w = 0; w < num_hash_workers_; w++)
+            {
+                keys.emplace_back(new mpsc_ring<key_batch>(kPipelineRingBatches));
+                hashed.emplace_back(new spsc_ring<hashed_batch>(kPipelineRingBatches));
+            }
+            std::atomic<std::size_t> readers_left(sources.size());
+            std::atomic<std::size_t> workers_left(num_hash_workers_);
+            std::atomic<std::size_t> num_keys(0);
+            std::atomic<bool> cancelled(false);
+
+            std::vector<std::thread> threads;
+            for (std::size_t r = 0; r < sources.size(); r++)
+                threads.emplace_back([&, r]()
+                                     { read(sources[r], r, keys, readers_left, num_keys, cancelled); });
+            for (std::size_t w = 0; w < num_hash_workers_; w++)
+                threads.emplace_back([&, w]()
+                                     { hash(*keys[w], *hashed[w], readers_left, workers_left, cancelled); });
+
+            std::exception_ptr error;
+            try
+            {
+                insert_all(hashed, workers_left);
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+                cancelled.store(true, std::memory_order_relaxed);
+            }
+            for (auto &t : threads)
+                t.join();
+            if (error)
+                std::rethrow_exception(error);
+            return num_keys.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Nanoseconds the owner spent in the last build() with nothing to
+         * insert: near zero when the readers and hash workers keep ahead.
+         */
+        uint64_t owner_wait_ns() const { return owner_wait_ns_; }
+
+    private:
+        struct key_batch
+        {
+            std::size_t count;
+            key_type keys[kPipelineBatchKeys];
+        };
+
+        struct hashed_batch
+        {
+            std::size_t count;
+            typename Table::prehashed_key keys[kPipelineBatchKeys];
+        };
+
+        // reader r: fills batches from its source and pushes each to the first
+        // hash worker with room, starting after the one it used last
+        void read(source &src, const std::size_t r, std::vector<std::unique_ptr<mpsc_ring<key_batch>>> &keys,
+                  std::atomic<std::size_t> &readers_left, std::atomic<std::size_t> &num_keys,
+                  const std::atomic<bool> &cancelled)
+        {
+            std::size_t next = r % num_hash_workers_;
+            key_batch batch;
+            while (!cancelled.load(std::memory_order_relaxed))
+            {
+                batch.count = src(batch.keys, kPipelineBatchKeys);
+                if (batch.count == 0)
+                    break;
+                num_keys.fetch_add(batch.count, std::memory_order_relaxed);
+                for (std::size_t tries = 0;; tries++)
+                {
+                    mpsc_ring<key_batch> &ring = *keys[next];
+                    next = (next + 1) % num_hash_workers_;
+                    if (ring.try_push(std::move(batch)) || cancelled.load(std::memory_order_relaxed))
+                        break;
+                    if (tries % num_hash_workers_ == num_hash_workers_ - 1)
+                        std::this_thread::yield();
+                }
+            }
+            readers_left.fetch_sub(1, std::memory_order_release);
+        }
+
+        // hash worker: prehashes the batches of its mpsc_ring into its
+        // spsc_ring, until every reader is done and the ring drained
+        void hash(mpsc_ring<key_batch> &in, spsc_ring<hashed_batch> &out, const std::atomic<std::size_t> &readers_left,
+                  std::atomic<std::size_t> &workers_left, const std::atomic<bool> &cancelled)
+        {
+            while (!cancelled.load(std::memory_order_relaxed))
+            {
+                // readers_left first: a batch pushed before the last reader
+                // left is visible once it reads 0
+                const bool readers_done = readers_left.load(std::memory_order_acquire) == 0;
+                key_batch *batch = in.front();
+                if (batch == nullptr)
+                {
+                    if (readers_done)
+                        break;
+                    std::this_thread::yield();
+                    continue;
+                }
+                hashed_batch *slot;
+                while ((slot = out.begin_push()) == nullptr)
+                {
+                    if (cancelled.load(std::memory_order_relaxed))
+                        break;
+                    std::this_thread::yield();
+                }
+                if (slot == nullptr)
+                    break;
+                for (std::size_t k = 0; k < batch->count; k++)
+                    slot->keys[k] = table_.prehash(batch->keys[k]);
+                slot->count = batch->count;
+                in.pop();
+                out.end_push();
+            }
+            workers_left.fetch_sub(1, std::memory_order_release);
+        }
+
+        // owner: inserts from the hash workers' rings in turn until all of
+        // them are done and drained
+        void insert_all(std::vector<std::unique_ptr<spsc_ring<hashed_batch>>> &hashed,
+                        const std::atomic<std::size_t> &workers_left)
+        {
+            owner_wait_ns_ = 0;
+            for (;;)
+            {
+                const bool workers_done = workers_left.load(std::memory_order_acquire) == 0;
+                bool inserted = false;
+                for (auto &ring : hashed)
+                {
+                    hashed_batch *batch;
+                    while ((batch = ring->front()) != nullptr)
+                    {
+                        for (std::size_t k = 0; k < batch->count; k++)
+                        {
+                            if (k + kPipelinePrefetchKeys < batch->count)
+                                table_.prefetch(batch->keys[k + kPipelinePrefetchKeys]);
+                            table_.insert(std::move(batch->keys[k]));
+                        }
+                        ring->pop();
+                        inserted = true;
+                    }
+                }
+                if (inserted)
+                    continue;
+                if (workers_done)
+                    return;
+                const auto start = std::chrono::steady_clock::now();
+                std::this_thread::yield();
+                owner_wait_ns_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                      std::chrono::steady_clock::now() - start)
+                                      .count();
+            }
+        }
+
+        Table &table_;
+        const std::size_t num_hash_workers_;
+        uint64_t owner_wait_ns_;
+    };
+}
+
+#endif // PIPELINED_BUILDER_HH
@@ -0,0 +1,209 @@
+#ifndef RING_BUFFER_HH
+#define RING_BUFFER_HH
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+namespace cuckoohashtable
+{
+    /**
+     * Size of a cache line: the indexes a producer writes and the ones a
+     * consumer writes are padded this far apart, so the two never contend for
+     * the same line.
+     */
+    static const std::size_t kCacheLineBytes = 64;
+
+    /**
+     * A bounded lock-free queue between one producer and one consumer thread.
+     *
+     * The producer fills the slot begin_push() hands out in place and
+     * publishes it with end_push(); the consumer reads front() and releases it
+     * with pop(). Each side keeps a cached copy of the other side's index and
+     * only reloads it when the ring looks full (or empty), so a steady stream
+     * costs one shared cache line transfer per lap rather than per item.
+     *
+     * @tparam T - type of the slots, default constructible
+     */
+    template <class T>
+    class spsc_ring
+    {
+    public:
+        /**
+         * @param capacity - number of slots, rounded up to a power of two
+         */
+        explicit spsc_ring(std::size_t capacity) : head_(0), tail_cache_(0), tail_(0), head_cache_(0)
+        {
+            mask_ = 1;
+            while (mask_ < capacity)
+                mask_ <<= 1;
+            slots_.reset(new T[mask_]);
+            mask_--;
+        }
+
+        std::size_t capacity() const { return mask_ + 1; }
+
+        // the free slot to fill next, or nullptr if the ring is full (producer)
+        T *begin_push()
+        {
+            const std::size_t tail = tail_.load(std::memory_order_relaxed);
+            if (tail - head_cache_ > mask_)
+            {
+                head_cache_ = head_.load(std::memory_order_acquire);
+                if (tail - head_cache_ > mask_)
+                    return nullptr;
+            }
+            return &slots_[tail & mask_];
+        }
+
+        // publishes the slot begin_push() returned (producer)
+        void end_push()
+        {
+            tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        bool try_push(T value)
+        {
+            T *slot = begin_push();
+            if (slot == nullptr)
+                return false;
+            *slot = std::move(value);
+            end_push();
+            return true;
+        }
+
+        // the oldest published slot, or nullptr if the ring is empty (consumer)
+        T *front()
+        {
+            const std::size_t head = head_.load(std::memory_order_relaxed);
+            if (head == tail_cache_)
+            {
+                tail_cache_ = tail_.load(std::memory_order_acquire);
+                if (head == tail_cache_)
+                    return nullptr;
+            }
+            return &slots_[head & mask_];
+        }
+
+        // hands the slot front() returned back to the producer (consumer)
+        void pop()
+        {
+            head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+    private:
+        std::unique_ptr<T[]> slots_;
+        std::size_t mask_;
+        // padding rather than alignas, which plain new does not honour before
+        // C++17
+        char pad0_[kCacheLineBytes];
+        // written by the consumer
+        std::atomic<std::size_t> head_;
+        std::size_t tail_cache_;
+        char pad1_[kCacheLineBytes];
+        // written by the producer
+        std::atomic<std::size_t> tail_;
+        std::size_t head_cache_;
+        char pad2_[kCacheLineBytes];
+    };
+
+    /**
+     * A bounded lock-free queue from any number of producer threads to one
+     * consumer thread (Vyukov's bounded queue, with the consumer side left
+     * uncontended).
+     *
+     * Producers claim a position with a compare-and-swap on the tail and fill
+     * its slot, then publish it through the slot's sequence number, so a
+     * producer stalled mid-write holds up only the consumer, never the other
+     * producers. A slot at position p is free while its sequence is p and
+     * readable once it is p + 1.
+     *
+     * @tparam T - type of the slots, default constructible
+     */
+    template <class T>
+    class mpsc_ring
+    {
+    public:
+        /**
+         * @param capacity - number of slots, rounded up to a power of two
+         */
+        explicit mpsc_ring(std::size_t capacity) : head_(0), tail_(0)
+        {
+            mask_ = 1;
+            while (mask_ < capacity)
+                mask_ <<= 1;
+            cells_.reset(new cell[mask_]);
+            for (std::size_t i = 0; i < mask_; i++)
+                cells_[i].sequence.store(i, std::memory_order_relaxed);
+            mask_--;
+        }
+
+        std::size_t capacity() const { return mask_ + 1; }
+
+        // moves value into the ring, or returns false if it is full (producers)
+        bool try_push(T &&value)
+        {
+            std::size_t pos = tail_.load(std::memory_order_relaxed);
+            for (;;)
+            {
+                cell &c = cells_[pos & mask_];
+                const std::size_t sequence = c.sequence.load(std::memory_order_acquire);
+                if (sequence == pos)
+                {
+                    if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    {
+                        c.value = std::move(value);
+                        c.sequence.store(pos + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (sequence < pos)
+                {
+                    // still holds the value from the previous lap
+                    return false;
+                }
+                else
+                {
+                    pos = tail_.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        // the oldest published value, or nullptr if there is none (consumer)
+        T *front()
+        {
+            cell &c = cells_[head_ & mask_];
+            if (c.sequence.load(std::memory_order_acquire) != head_ + 1)
+                return nullptr;
+            return &c.value;
+        }
+
+        // frees the slot front() returned for a later lap (consumer)
+        void pop()
+        {
+            cells_[head_ & mask_].sequence.store(head_ + mask_ + 1, std::memory_order_release);
+            head_++;
+        }
+
+    private:
+        struct cell
+        {
+            std::atomic<std::size_t> sequence;
+            T value;
+        };
+
+        std::unique_ptr<cell[]> cells_;
+        std::size_t mask_;
+        char pad0_[kCacheLineBytes];
+        // only touched by the consumer
+        std::size_t head_;
+        char pad1_[kCacheLineBytes];
+        // claimed by the producers
+        std::atomic<std::size_t> tail_;
+        char pad2_[kCacheLineBytes];
+    };
+}
+
+#endif // RING_BUFFER_HH
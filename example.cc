@@ -1,9 +1,16 @@
 #include "cuckoofilter/src/cuckoofilter.h"
+#include "cuckoofilter/src/certifier.h"
+#include "cuckoofilter/src/quotientfilter.h"
+#include "cuckoofilter/src/threadpool.h"
 
 #include <math.h>
+#include <atomic>
+#include <chrono>
 #include <cstdlib>
+#include <mutex>
 
 #include "cuckoohashtable/city_hasher.hh"
+#include "cuckoohashtable/hashtable/crlingest.hh"
 #include "cuckoohashtable/hashtable/cuckoohashtable.hh"
 
 using namespace std;
@@ -16,10 +23,40 @@ void random_gen(int n, vector<uint64_t> &store, mt19937 &rd)
         store[i] = (uint64_t(rd()) << 32) + rd();
 }
 
+// read the (issuer, serial) keys of the revoked certificates in the CRL files of
+// dir, one reader per thread of the pool, without duplicates
+void crl_gen(const string &dir, vector<uint64_t> &store, cuckoofilter::ThreadPool &pool)
+{
+    cuckoohashtable::crl_directory crls(dir);
+    mutex store_lock;
+    const auto start = chrono::steady_clock::now();
+    cuckoofilter::TaskGroup readers(pool);
+    for (size_t t = 0; t <= pool.NumThreads(); t++)
+    {
+        readers.Run([&]()
+        {
+            auto source = crls.source<uint64_t>();
+            vector<uint64_t> keys;
+            uint64_t batch[256];
+            size_t n;
+            while ((n = source(batch, 256)) > 0)
+                keys.insert(keys.end(), batch, batch + n);
+            lock_guard<mutex> lock(store_lock);
+            store.insert(store.end(), keys.begin(), keys.end());
+        });
+    }
+    readers.Wait();
+    crls.stats().report(cout, chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+
+    // the same certificate may be listed by several CRLs (e.g. a base and a delta CRL)
+    sort(store.begin(), store.end());
+    store.erase(unique(store.begin(), store.end()), store.end());
+}
+
 template <typename KeyType>
-vector<uint16_t> hashtable_ops(const uint64_t &init_size, vector<KeyType> &r, vector<KeyType> &s, vector<vector<KeyType>> &fp_table, FILE *file)
+vector<uint16_t> hashtable_ops(const uint64_t &init_size, cuckoohashtable::sizing_mode mode, vector<KeyType> &r, vector<KeyType> &s, vector<vector<KeyType>> &fp_table, cuckoofilter::ThreadPool &pool, FILE *file)
 {
-    cuckoohashtable::cuckoo_hashtable<KeyType, 12, CityHasher<KeyType>> table(init_size);
+    cuckoohashtable::cuckoo_hashtable<KeyType, 12, CityHasher<KeyType>> table(init_size, mode);
 
     // add set R to table
     for (KeyType c : r)
@@ -29,13 +66,16 @@ vector<uint16_t> hashtable_ops(const uint64_t &init_size, vector<KeyType> &r, ve
 
     // check for false negatives with set R
     // size_t false_negs = 0;
-    for (KeyType c : r)
+    pool.ParallelFor(0, r.size(), 0, [&](size_t lo, size_t hi)
     {
-        assert(table.lookup(c) >= 0);
-        assert(table.find(c).first >= 0); // first = index, second = slot
-        // if (table.lookup(c) < 0)
-        //     false_negs++;
-    }
+        for (size_t i = lo; i < hi; i++)
+        {
+            assert(table.lookup(r[i]) >= 0);
+            assert(table.find(r[i]).first >= 0); // first = index, second = slot
+            // if (table.lookup(r[i]) < 0)
+            //     false_negs++;
+        }
+    });
     // assert(false_negs == 0);
 
     // lookup set S and count false positives
@@ -50,35 +90,39 @@ vector<uint16_t> hashtable_ops(const uint64_t &init_size, vector<KeyType> &r, ve
      * with an incremented seed until no false positives remain from lookup.
      */
     fprintf(file, "lookup round, false positives, percent fp's\n");
+    std::mutex sweep_mutex;
     while (1)
     {
-        size_t total_queries = 0;
+        size_t total_queries = s.size();
         size_t false_queries = 0;
         size_t definite_queries = 0;
 
+        // lookups of a round run concurrently: each only bumps pending seeds,
+        // which the next rehash_buckets() publishes
         table.start_lookup();
-        for (KeyType l : s)
+        pool.ParallelFor(0, s.size(), 0, [&](size_t lo, size_t hi)
         {
-            if (table.find(l).first >= 0)
-                definite_queries++;
-            total_queries++;
-
-            int index = table.lookup(l);
-            if (index >= 0)
+            size_t definite = 0;
+            vector<int> rehashed;
+            for (size_t i = lo; i < hi; i++)
             {
-                false_queries++;
-                // if (rehashBSet.find(index) == rehashBSet.end())
-                // {
-                rehashBSet.insert(index);
-                // }
-                // if (index == 1487)
-                //     cout << "FALSE POS " << index << " on round " << table.num_rehashes() + 1 << ", query #" << total_queries << ", false query #" << false_queries << "\n";
-            } else
-            {
-                assert(index == -1); // ensures not found returns -1
+                if (table.find(s[i]).first >= 0)
+                    definite++;
+
+                int index = table.lookup(s[i]);
+                if (index >= 0)
+                {
+                    rehashed.push_back(index);
+                } else
+                {
+                    assert(index == -1); // ensures not found returns -1
+                }
             }
-            
-        }
+            std::lock_guard<std::mutex> lock(sweep_mutex);
+            definite_queries += definite;
+            false_queries += rehashed.size();
+            rehashBSet.insert(rehashed.begin(), rehashed.end());
+        });
         assert(definite_queries == 0); // normal HT should only result in true negatives, no fp's
 
         double fp = (double)false_queries * 100.0 / total_queries;
@@ -88,7 +132,8 @@ vector<uint16_t> hashtable_ops(const uint64_t &init_size, vector<KeyType> &r, ve
         fprintf(file, "%lu, %lu, %.6f\n", table.num_rehashes() + 1, false_queries, fp);
 
         if (false_queries > 0)
-            total_rehash += table.rehash_buckets();
+            total_rehash += table.rehash_buckets([&pool](size_t count, size_t min_per_task, const auto &body)
+                                                 { pool.ParallelFor(0, count, min_per_task, body); });
         else
             break;
     }
@@ -128,7 +173,7 @@ vector<uint16_t> hashtable_ops(const uint64_t &init_size, vector<KeyType> &r, ve
 }
 
 template <typename KeyType>
-void create_filter(const uint64_t &init_size, vector<vector<KeyType>> &fp_table, vector<uint16_t> &seeds, vector<KeyType> &r, vector<KeyType> &s, FILE *file)
+void create_filter(const uint64_t &init_size, vector<vector<KeyType>> &fp_table, vector<uint16_t> &seeds, vector<KeyType> &r, vector<KeyType> &s, cuckoofilter::ThreadPool &pool, FILE *file)
 {
     cuckoofilter::CuckooFilter<KeyType, 12, CityHasher<KeyType>> filter(init_size, seeds);
 
@@ -153,38 +198,69 @@ void create_filter(const uint64_t &init_size, vector<vector<KeyType>> &fp_table,
         }
     }
 
-    // check no false negatives - failing here with sizes above 10k :(
-    cout << "\nChecking CF false negatives:\n";
-    for (auto c : r)
-    {
-        // if (filter.Contain(c) != cuckoofilter::Ok)
-        // {
-            // CityHasher<int> ch;
-            // cout << "\n494 cityhash: " << ch.operator()(494, seeds.at(494)) << "\n";
-            // cout  << "1487 cityhash: " << ch.operator()(1487, seeds.at(1487)) << "\n";
-        // }
-        // cout << "false neg at " << table.find(c).first << ", " << table.find(c).second << "\n";
-        assert(filter.Contain(c) == cuckoofilter::Ok);
-    }
-
-    size_t total_queries = 0;
-    size_t false_queries = 0;
-    for (auto l : s)
-    {
-        if (filter.Contain(l) == cuckoofilter::Ok)
-        {
-            false_queries++;
-        }
-        assert(false_queries == 0);
-        total_queries++;
-    }
+    // certify: no false negatives over R, no false positives over S
+    cout << "\nCertifying CF against R and S:\n";
+    const auto start = chrono::steady_clock::now();
+    const cuckoofilter::CertifyReport<KeyType> report =
+        cuckoofilter::CertifyFilter(filter, r.data(), r.size(), s.data(), s.size(), pool);
+    const double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "false negatives: " << report.false_negatives << " out of " << report.positives_checked << "\n";
+    for (const auto &o : report.false_negative_items)
+        cout << "\tfalse negative " << o.item << " in buckets " << o.i1 << ", " << o.i2 << "\n";
+    for (const auto &o : report.false_positive_items)
+        cout << "\tfalse positive " << o.item << " in buckets " << o.i1 << ", " << o.i2 << "\n";
+    fprintf(file, "certified keys, false negatives, false positives, seconds\n");
+    fprintf(file, "%lu, %lu, %lu, %.3f\n\n", report.positives_checked + report.negatives_checked,
+            report.false_negatives, report.false_positives, secs);
+    assert(report.Passed());
 
     // Output the measured false positive rate
     std::cout << "false positive rate is "
-              << 100.0 * false_queries / total_queries << "%\n";
+              << 100.0 * report.false_positives / report.negatives_checked << "%\n";
     cout << filter.Info() << "\n";
 }
 
+// builds a quotient filter from the same R, streamed in as a base set and a
+// later update, and measures its false positives over S; with no seeds there
+// is nothing to certify them away
+template <typename KeyType>
+void create_quotient_filter(vector<KeyType> &r, vector<KeyType> &s, cuckoofilter::ThreadPool &pool, FILE *file)
+{
+    const auto start = chrono::steady_clock::now();
+    // remainders are stored in 16-bit words, so 16 bits cost no more than 12
+    cuckoofilter::QuotientFilter<KeyType, 16, CityHasher<KeyType>> filter(r.size());
+    const size_t base = r.size() * 9 / 10;
+    cuckoofilter::Status status = filter.AddAll(r.data(), base);
+    assert(status == cuckoofilter::Ok);
+    status = filter.AddAll(r.data() + base, r.size() - base);
+    assert(status == cuckoofilter::Ok);
+    const double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    atomic<size_t> false_negs(0), false_pos(0);
+    pool.ParallelFor(0, r.size(), 0, [&](size_t lo, size_t hi)
+    {
+        size_t n = 0;
+        for (size_t i = lo; i < hi; i++)
+            n += filter.Contain(r[i]) != cuckoofilter::Ok;
+        false_negs += n;
+    });
+    pool.ParallelFor(0, s.size(), 0, [&](size_t lo, size_t hi)
+    {
+        size_t n = 0;
+        for (size_t i = lo; i < hi; i++)
+            n += filter.Contain(s[i]) == cuckoofilter::Ok;
+        false_pos += n;
+    });
+    double fp = 100.0 * false_pos / s.size();
+    cout << "\nQuotient filter over R and S:\nfalse negatives: " << false_negs << " out of " << r.size()
+         << "\nfalse positives: " << false_pos << " out of " << s.size() << ", fp rate: " << fp << "%\n";
+    cout << filter.Info() << "\n";
+    fprintf(file, "quotient filter keys, false negatives, false positives, fp rate, bits per key, seconds\n");
+    fprintf(file, "%lu, %lu, %lu, %.6f, %.2f, %.3f\n\n", filter.Size(), false_negs.load(), false_pos.load(), fp,
+            filter.BitsPerItem(), secs);
+    assert(false_negs == 0);
+}
+
 /**
      * CityHash usage:
      * init/declare: CityHasher<int> ch;
@@ -195,21 +271,50 @@ int main(int argc, char **argv)
 {
     if (argc <= 1)
     {
-        cout << "Enter number of items to insert!\n";
+        cout << "Enter number of items to insert! (optionally followed by \"exact\" for non-power-of-two bucket counts)\n"
+             << "Or \"crl <dir>\" to insert the revoked certificates of the CRL files in dir\n";
         return {};
     }
 
+    // R from the CRL files of a directory rather than random numbers
+    const bool from_crls = string(argv[1]) == "crl";
+    if (from_crls && argc <= 2)
+    {
+        cout << "Enter a directory of CRL files!\n";
+        return {};
+    }
+    const int mode_arg = from_crls ? 3 : 2;
+
     typedef uint64_t KeyType;
     vector<KeyType> r;
     vector<KeyType> s;
 
-    uint64_t size = atoi(argv[1]); // 240000 for ~91% load factor
+    uint64_t size = from_crls ? 0 : atoi(argv[1]); // 240000 for ~91% load factor
+
+    // size the table (and so the filter) to exactly init_size slots instead of the next power of two
+    cuckoohashtable::sizing_mode mode = cuckoohashtable::sizing_mode::power_of_two;
+    if (argc > mode_arg && string(argv[mode_arg]) == "exact")
+        mode = cuckoohashtable::sizing_mode::exact;
 
     int seed = 1;
     mt19937 rd(seed);
 
+    // one pool for every parallel phase, so they never run more threads than CPUs
+    cuckoofilter::ThreadPool pool;
+
     // 64-bit random numbers to insert and lookup -> lookup_size = insert_size * 100
-    random_gen(size, r, rd);
+    if (from_crls)
+    {
+        crl_gen(argv[2], r, pool);
+        size = r.size();
+        if (size == 0)
+        {
+            cout << "No revoked certificates in " << argv[2] << "!\n";
+            return {};
+        }
+    }
+    else
+        random_gen(size, r, rd);
     random_gen(size * 100, s, rd);
 
     // max load factor of 95%
@@ -227,8 +332,10 @@ int main(int argc, char **argv)
     fprintf(file, "insert size, lookup size, init size, max percent load factor\n");
     fprintf(file, "%lu, %lu, %lu, %.1f\n\n", size, size * 100, init_size, max_lf * 100);
 
+    cout << "worker threads: " << pool.NumThreads() << " + main\n";
+
     vector<vector<KeyType>> fp_table;
-    vector<uint16_t> seeds = hashtable_ops(init_size, r, s, fp_table, file);
+    vector<uint16_t> seeds = hashtable_ops(init_size, mode, r, s, fp_table, pool, file);
 
     /*
     cout << "retrieved seeds: [ ";
@@ -239,7 +346,9 @@ int main(int argc, char **argv)
     cout << "]\n";
     */
 
-    create_filter(init_size, fp_table, seeds, r, s, file);
+    create_filter(init_size, fp_table, seeds, r, s, pool, file);
+
+    create_quotient_filter(r, s, pool, file);
 
     fclose(file);
 
@@ -1,4 +1,4 @@
-#include "cuckoofilter/src/cuckoofilter.h"
+#include "cuckoofilter/src/seededbuilder.h"
 #include <assert.h>
 #include <math.h>
 #include <iostream>
@@ -14,7 +14,9 @@ void random_gen(int n, vector<uint64_t> &store, mt19937 &rd)
         store[i] = (uint64_t(rd()) << 32) + rd();
 }
 
-size_t lookup(cuckoofilter::CuckooFilter<size_t, 16> &cf, vector<uint64_t> &s)
+typedef cuckoofilter::SeededFilterBuilder<uint64_t, 16, cuckoofilter::WyHasher<uint64_t>> Builder;
+
+size_t lookup(const Builder::Filter &cf, vector<uint64_t> &s)
 {
     // lookup set S and count false positives
     cout << "s lookup\n";
@@ -47,7 +49,7 @@ int main(int argc, char **argv)
     size_t n = total_items / 0.95;
     // int n = total_items/1.2;
     cout << "creating filter size " << n << "\n";
-    cuckoofilter::CuckooFilter<size_t, 16> cf(n);
+    Builder builder(n);
     vector<uint64_t> r;
     vector<uint64_t> s;
 
@@ -55,29 +57,21 @@ int main(int argc, char **argv)
     random_gen(total_items, r, rd);
     random_gen(total_items * 100, s, rd);
 
-    // add set R to filter
+    // add set R to the builder
     for (auto c : r)
     {
-        assert(cf.Add(c) == cuckoofilter::Ok);
-        assert(cf.Contain(c) == cuckoofilter::Ok);
-        // if(cf.Contain(c) != cuckoofilter::Ok) {
-        //     cout << "ERROR\n";
-        //     return 1;
-        // }
+        cuckoofilter::Status status = builder.Add(c);
+        assert(status == cuckoofilter::Ok);
     }
 
-    // cout << cf.Info() << "\n";
-    size_t rehash_lup = 0;
-    while (lookup(cf, s) > 0 && rehash_lup < rehash_limit)
-    {
-        cf.RehashCheck(s);
-        rehash_lup++;
-        if (rehash_lup >= rehash_limit)
-            cout << "rehashed too many times...\n";
-    }
-    cout << "full rehash lookup count: " << rehash_lup << "\n";
-    // lookup(cf, s);
-    // for(auto c : r)
-    //     assert(cf.Contain(c) == cuckoofilter::Ok);
+    // rehash buckets giving false positives on S, then take the seeded filter
+    size_t left = builder.EliminateFalsePositives(s.data(), s.size(), rehash_limit);
+    if (left > 0)
+        cout << "rehashed too many times...\n";
+    cout << "full rehash lookup count: " << builder.NumRounds() << "\n";
+    std::unique_ptr<Builder::Filter> cf = builder.Build();
+    for (auto c : r)
+        assert(cf->Contain(c) == cuckoofilter::Ok);
+    lookup(*cf, s);
     return 0;
 }